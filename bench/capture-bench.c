@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Measures the capture path from end to end against a fake compositor.
+ *
+ * Usage: capture-bench [-p wlr|ext] [-s static|typing|scrolling|video]
+ *                      [-t seconds] [-r refresh-rate] [-m max-rate]
+ *                      [-g WIDTHxHEIGHT] [-c] [-d client-delay-ms]
+ *                      [-T trace-file]
+ *
+ * Frames are captured through the same screencopy, buffer and damage code as
+ * wayvnc uses and then go through wayvnc's frame pipeline, which does change
+ * detection, coalescing and rate limiting before it feeds them to a neatvnc
+ * display. No VNC client is attached, so encoding is not part of the
+ * measurement. With -d, a simulated client asks for the next update this long
+ * after each frame, and frames are paced to it as they would be to a real
+ * client. The CPU time is that of the main
+ * thread, which is where wayvnc does its work. Without a protocol or a scene,
+ * all combinations are run.
+ *
+ * With -T, a damage trace that was recorded by wayvnc --record-trace is
+ * replayed instead of a scene, with the damage and timing of the original
+ * frames. The replayed frames take the same path as any other, so the number
+ * of frames that were coalesced shows what rate limiting and pacing did to the
+ * recorded session.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <aml.h>
+#include <neatvnc.h>
+#include <pixman.h>
+#include <wayland-client.h>
+
+#include "fake-compositor.h"
+#include "wayland.h"
+#include "output.h"
+#include "buffer.h"
+#include "screencopy-interface.h"
+#include "frame-pipeline.h"
+#include "histogram.h"
+#include "pixels.h"
+#include "time-util.h"
+
+#define DEFAULT_SECONDS 2.0
+
+struct wayland* wayland = NULL;
+
+struct bench {
+	struct nvnc* nvnc;
+	struct nvnc_display* display;
+	struct screencopy* screencopy;
+
+	struct frame_pipeline pipeline;
+	struct frame_pipeline_display pipeline_display;
+
+	// Simulated client, enabled by -d
+	uint64_t client_delay;
+	struct aml_timer* client_timer;
+	uint64_t last_update_request_time;
+
+	bool is_failed;
+	uint64_t n_frames;
+	uint64_t n_failed;
+	uint64_t damage_area;
+	struct histogram latency;
+};
+
+struct result {
+	double frame_rate;
+	double cpu_per_frame;
+	double damage_fraction;
+	uint64_t n_failed;
+	uint64_t n_coalesced;
+	uint64_t n_dropped;
+	uint32_t latency_mean, latency_p50, latency_p99;
+};
+
+static double rate_format(const void* userdata, enum wv_buffer_type type,
+		uint32_t format, uint64_t modifier)
+{
+	const struct bench* self = userdata;
+	return nvnc_rate_pixel_format(self->nvnc, NVNC_BUFFER_SIMPLE, format,
+			modifier);
+}
+
+static void start_capture(struct frame_pipeline* pipeline)
+{
+	struct bench* self = pipeline->userdata;
+	screencopy_start(self->screencopy, false);
+}
+
+static bool has_ready_client(const struct frame_pipeline_display* display)
+{
+	const struct bench* self = display->pipeline->userdata;
+	return self->last_update_request_time >= display->last_send_time;
+}
+
+static void on_client_update_request(struct aml_timer* timer)
+{
+	struct bench* self = aml_get_userdata(timer);
+	self->last_update_request_time = gettime_us();
+	frame_pipeline_schedule(&self->pipeline);
+}
+
+static void on_feed(struct frame_pipeline_display* display,
+		struct wv_buffer* buffer, struct pixman_region16* damage)
+{
+	struct bench* self = display->pipeline->userdata;
+
+	self->n_frames++;
+	self->damage_area += calculate_region_area(damage);
+	if (buffer->capture_time)
+		histogram_record(&self->latency,
+				gettime_us() - buffer->capture_time);
+
+	if (self->client_timer) {
+		aml_stop(aml_get_default(), self->client_timer);
+		aml_set_duration(self->client_timer, self->client_delay);
+		aml_start(aml_get_default(), self->client_timer);
+	}
+}
+
+static void on_capture_done(enum screencopy_result result,
+		struct wv_buffer* buffer, struct image_source* source,
+		void* userdata)
+{
+	struct bench* self = userdata;
+
+	switch (result) {
+	case SCREENCOPY_FATAL:
+		fprintf(stderr, "Capturing failed\n");
+		self->is_failed = true;
+		break;
+	case SCREENCOPY_FAILED:
+		self->n_failed++;
+		screencopy_start(self->screencopy, false);
+		break;
+	case SCREENCOPY_DONE:
+		frame_pipeline_submit(&self->pipeline, &self->pipeline_display,
+				buffer);
+		break;
+	}
+}
+
+static uint64_t get_thread_cpu_time_us(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	return usage.ru_utime.tv_sec * UINT64_C(1000000) +
+		usage.ru_utime.tv_usec + usage.ru_stime.tv_sec *
+		UINT64_C(1000000) + usage.ru_stime.tv_usec;
+}
+
+static int run_benchmark(struct aml* aml,
+		const struct fake_compositor_config* config, double seconds,
+		int max_rate, bool change_detection, double client_delay_ms,
+		struct result* result)
+{
+	int rc = -1;
+	struct bench self = {
+		.pipeline = {
+			.max_rate = max_rate,
+			.damage_simplify = {
+				.tile_size = 64,
+				.max_overhead = 25,
+				.max_rects = 16,
+			},
+			.change_detection = change_detection ?
+				CHANGE_DETECTION_ON : CHANGE_DETECTION_OFF,
+			.start_capture = start_capture,
+			.on_feed = on_feed,
+		},
+	};
+	self.pipeline.userdata = &self;
+	frame_pipeline_init(&self.pipeline);
+	histogram_reset(&self.latency);
+
+	if (client_delay_ms > 0) {
+		self.client_delay = client_delay_ms * 1000.0;
+		self.client_timer = aml_timer_new(0, on_client_update_request,
+				&self, NULL);
+		if (!self.client_timer)
+			return -1;
+		self.pipeline.has_ready_client = has_ready_client;
+	}
+
+	struct fake_compositor* compositor = fake_compositor_start(config);
+	if (!compositor) {
+		fprintf(stderr, "Failed to start compositor\n");
+		goto compositor_failure;
+	}
+
+	wayland = wayland_connect(fake_compositor_get_socket(compositor), 0);
+	if (!wayland) {
+		fprintf(stderr, "Failed to connect to compositor\n");
+		goto wayland_failure;
+	}
+	wl_display_roundtrip(wayland->display);
+
+	struct output* output = output_first(&wayland->outputs);
+	if (!output) {
+		fprintf(stderr, "No output\n");
+		goto nvnc_failure;
+	}
+
+	self.nvnc = nvnc_new();
+	if (!self.nvnc)
+		goto nvnc_failure;
+
+	self.display = nvnc_display_new(0, 0);
+	if (!self.display)
+		goto display_failure;
+	nvnc_add_display(self.nvnc, self.display);
+
+	if (frame_pipeline_display_init(&self.pipeline_display, &self.pipeline,
+				self.display) < 0)
+		goto pipeline_failure;
+
+	self.screencopy = screencopy_create(&output->image_source, false);
+	if (!self.screencopy) {
+		fprintf(stderr, "Capture protocol is missing\n");
+		goto screencopy_failure;
+	}
+	self.screencopy->on_done = on_capture_done;
+	self.screencopy->rate_format = rate_format;
+	self.screencopy->userdata = &self;
+	self.screencopy->rate_limit = max_rate;
+	self.screencopy->enable_linux_dmabuf = false;
+
+	uint64_t cpu_start = get_thread_cpu_time_us();
+	uint64_t start_time = gettime_us();
+	uint64_t end_time = start_time + seconds * 1000000.0;
+
+	screencopy_start(self.screencopy, true);
+	wl_display_dispatch_pending(wayland->display);
+
+	uint64_t now;
+	while (!self.is_failed && (now = gettime_us()) < end_time) {
+		wayland_flush(wayland);
+		aml_poll(aml, (end_time - now + 999) / 1000);
+		aml_dispatch(aml);
+	}
+
+	uint64_t cpu_time = get_thread_cpu_time_us() - cpu_start;
+	uint64_t duration = gettime_us() - start_time;
+
+	screencopy_stop(self.screencopy);
+
+	uint64_t n_frames = self.n_frames ? self.n_frames : 1;
+	result->frame_rate = self.n_frames * 1000000.0 / duration;
+	result->cpu_per_frame = (double)cpu_time / n_frames;
+	int width, height;
+	fake_compositor_get_size(compositor, &width, &height);
+	result->damage_fraction = (double)self.damage_area / n_frames /
+		((double)width * height);
+	result->n_failed = self.n_failed;
+	result->n_coalesced = self.pipeline.stats.n_coalesced;
+	result->n_dropped = self.pipeline.stats.n_dropped;
+	result->latency_mean = histogram_mean(&self.latency);
+	result->latency_p50 = histogram_percentile(&self.latency, 50);
+	result->latency_p99 = histogram_percentile(&self.latency, 99);
+
+	rc = self.is_failed ? -1 : 0;
+
+	screencopy_destroy(self.screencopy);
+screencopy_failure:
+	frame_pipeline_deinit(&self.pipeline);
+pipeline_failure:
+	nvnc_remove_display(self.nvnc, self.display);
+	nvnc_display_unref(self.display);
+display_failure:
+	nvnc_del(self.nvnc);
+nvnc_failure:
+	wayland_destroy(wayland);
+	wayland = NULL;
+wayland_failure:
+	fake_compositor_stop(compositor);
+compositor_failure:
+	if (self.client_timer) {
+		aml_stop(aml_get_default(), self.client_timer);
+		aml_unref(self.client_timer);
+	}
+	return rc;
+}
+
+static void print_result(const struct fake_compositor_config* config,
+		const struct result* result)
+{
+	printf("  %-22s %-9s %7.1f fps %8.1f µs cpu/frame %6.1f %% damage"
+			" latency %5"PRIu32"/%5"PRIu32"/%5"PRIu32" µs",
+			fake_compositor_protocol_name(config->protocol),
+			fake_compositor_scene_name(config->scene),
+			result->frame_rate, result->cpu_per_frame,
+			100.0 * result->damage_fraction,
+			result->latency_mean, result->latency_p50,
+			result->latency_p99);
+	if (result->n_coalesced || result->n_dropped)
+		printf(" (%"PRIu64" coalesced, %"PRIu64" dropped)",
+				result->n_coalesced, result->n_dropped);
+	if (result->n_failed)
+		printf(" (%"PRIu64" failed)", result->n_failed);
+	printf("\n");
+}
+
+static int parse_protocol(const char* value,
+		enum fake_compositor_protocol* protocol)
+{
+	if (strcmp(value, "wlr") == 0)
+		*protocol = FAKE_COMPOSITOR_WLR_SCREENCOPY;
+	else if (strcmp(value, "ext") == 0)
+		*protocol = FAKE_COMPOSITOR_EXT_IMAGE_COPY_CAPTURE;
+	else
+		return -1;
+	return 0;
+}
+
+static int parse_scene(const char* value, enum fake_compositor_scene* scene)
+{
+	for (int i = FAKE_COMPOSITOR_SCENE_STATIC;
+			i <= FAKE_COMPOSITOR_SCENE_VIDEO; ++i)
+		if (strcmp(value, fake_compositor_scene_name(i)) == 0) {
+			*scene = i;
+			return 0;
+		}
+	return -1;
+}
+
+static int usage(int rc)
+{
+	fprintf(rc ? stderr : stdout, "Usage: capture-bench [-p wlr|ext] "
+			"[-s static|typing|scrolling|video] [-t seconds] "
+			"[-r refresh-rate] [-m max-rate] [-g WIDTHxHEIGHT] "
+			"[-c] [-d client-delay-ms] [-T trace-file]\n");
+	return rc;
+}
+
+int main(int argc, char* argv[])
+{
+	struct fake_compositor_config config = {
+		.width = 1920,
+		.height = 1080,
+		.refresh_rate = 60,
+	};
+	bool have_protocol = false;
+	bool have_scene = false;
+	bool change_detection = false;
+	double seconds = DEFAULT_SECONDS;
+	int max_rate = 60;
+	double client_delay_ms = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:s:t:r:m:g:cd:T:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			if (parse_protocol(optarg, &config.protocol) < 0)
+				return usage(1);
+			have_protocol = true;
+			break;
+		case 's':
+			if (parse_scene(optarg, &config.scene) < 0)
+				return usage(1);
+			have_scene = true;
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		case 'r':
+			config.refresh_rate = atoi(optarg);
+			break;
+		case 'm':
+			max_rate = atoi(optarg);
+			break;
+		case 'g':
+			if (sscanf(optarg, "%dx%d", &config.width,
+						&config.height) != 2)
+				return usage(1);
+			break;
+		case 'c':
+			change_detection = true;
+			break;
+		case 'd':
+			client_delay_ms = atof(optarg);
+			break;
+		case 'T':
+			config.trace_path = optarg;
+			config.scene = FAKE_COMPOSITOR_SCENE_TRACE;
+			have_scene = true;
+			break;
+		case 'h':
+			return usage(0);
+		default:
+			return usage(1);
+		}
+	}
+
+	if (seconds <= 0 || config.refresh_rate <= 0 || max_rate <= 0 ||
+			client_delay_ms < 0 ||
+			config.width <= 2 * 64 || config.height <= 2 * 64)
+		return usage(1);
+
+	nvnc_set_log_level(NVNC_LOG_WARNING);
+
+	struct aml* aml = aml_new();
+	if (!aml)
+		return 1;
+	aml_set_default(aml);
+
+	int rc = 0;
+
+	if (config.trace_path)
+		printf("%s", config.trace_path);
+	else
+		printf("%dx%d@%d", config.width, config.height,
+				config.refresh_rate);
+	printf(", max rate %d, change detection %s", max_rate,
+			change_detection ? "on" : "off");
+	if (client_delay_ms > 0)
+		printf(", client delay %.1f ms", client_delay_ms);
+	printf(":\n");
+
+	for (int p = FAKE_COMPOSITOR_WLR_SCREENCOPY;
+			p <= FAKE_COMPOSITOR_EXT_IMAGE_COPY_CAPTURE; ++p) {
+		if (have_protocol && p != (int)config.protocol)
+			continue;
+
+		for (int s = FAKE_COMPOSITOR_SCENE_STATIC;
+				s <= FAKE_COMPOSITOR_SCENE_TRACE; ++s) {
+			if (have_scene ? s != (int)config.scene :
+					s == FAKE_COMPOSITOR_SCENE_TRACE)
+				continue;
+
+			struct fake_compositor_config run_config = config;
+			run_config.protocol = p;
+			run_config.scene = s;
+
+			struct result result = { 0 };
+			if (run_benchmark(aml, &run_config, seconds, max_rate,
+						change_detection, client_delay_ms,
+						&result) < 0) {
+				rc = 1;
+				continue;
+			}
+			print_result(&run_config, &result);
+		}
+	}
+
+	aml_unref(aml);
+	return rc;
+}
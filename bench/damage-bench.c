@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Measures the cost and the effect of damage simplification.
+ *
+ * Usage: damage-bench [trace-file...]
+ *
+ * A trace file contains one frame per line, each line being a list of
+ * rectangles given as "x y width height". Without trace files, a few
+ * synthetic traces are used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pixman.h>
+
+#include "damage-simplify.h"
+#include "time-util.h"
+
+#define WIDTH 3840
+#define HEIGHT 2160
+#define N_FRAMES 500
+
+struct trace {
+	const char* name;
+	struct pixman_region16* frames;
+	int n_frames;
+};
+
+static const struct {
+	const char* name;
+	struct damage_simplify_config config;
+} configs[] = {
+	{ "tiles", { .tile_size = 64 } },
+	{ "merge", { .max_overhead = 25 } },
+	{ "cap", { .max_rects = 16 } },
+	{ "all", { .tile_size = 64, .max_overhead = 25, .max_rects = 16 } },
+};
+
+static uint32_t rand_state = 1;
+
+static uint32_t next_rand(void)
+{
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 8;
+}
+
+static void trace_alloc(struct trace* trace, const char* name, int n_frames)
+{
+	trace->name = name;
+	trace->n_frames = n_frames;
+	trace->frames = calloc(n_frames, sizeof(*trace->frames));
+	for (int i = 0; i < n_frames; ++i)
+		pixman_region_init(&trace->frames[i]);
+}
+
+static void trace_free(struct trace* trace)
+{
+	for (int i = 0; i < trace->n_frames; ++i)
+		pixman_region_fini(&trace->frames[i]);
+	free(trace->frames);
+}
+
+// A cursor blinking and glyphs appearing along a line of text
+static void generate_typing(struct trace* trace)
+{
+	trace_alloc(trace, "typing", N_FRAMES);
+	for (int i = 0; i < N_FRAMES; ++i) {
+		int x = 100 + (i % 200) * 9;
+		int y = 100 + (i / 200) * 18;
+		pixman_region_union_rect(&trace->frames[i], &trace->frames[i],
+				x, y, 9, 18);
+		pixman_region_union_rect(&trace->frames[i], &trace->frames[i],
+				x + 9, y, 2, 18);
+	}
+}
+
+// Many small, unrelated updates such as a busy dashboard
+static void generate_scattered(struct trace* trace)
+{
+	trace_alloc(trace, "scattered", N_FRAMES);
+	for (int i = 0; i < N_FRAMES; ++i)
+		for (int j = 0; j < 64; ++j)
+			pixman_region_union_rect(&trace->frames[i],
+					&trace->frames[i],
+					next_rand() % WIDTH, next_rand() % HEIGHT,
+					1 + next_rand() % 40, 1 + next_rand() % 20);
+}
+
+// Line-by-line updates as reported by some compositors when scrolling
+static void generate_scrolling(struct trace* trace)
+{
+	trace_alloc(trace, "scrolling", N_FRAMES);
+	for (int i = 0; i < N_FRAMES; ++i)
+		for (int y = 200; y < 1800; y += 20)
+			pixman_region_union_rect(&trace->frames[i],
+					&trace->frames[i], 300 + (y % 7),
+					y, 2000, 18);
+}
+
+static int load_trace(struct trace* trace, const char* path)
+{
+	FILE* stream = fopen(path, "r");
+	if (!stream) {
+		perror(path);
+		return -1;
+	}
+
+	int n_frames = 0;
+	char* line = NULL;
+	size_t len = 0;
+	while (getline(&line, &len, stream) >= 0)
+		++n_frames;
+
+	trace_alloc(trace, path, n_frames);
+	rewind(stream);
+
+	for (int i = 0; i < n_frames && getline(&line, &len, stream) >= 0; ++i) {
+		char* p = line;
+		int x, y, width, height, n;
+		while (sscanf(p, "%d %d %d %d%n", &x, &y, &width, &height,
+					&n) == 4) {
+			pixman_region_union_rect(&trace->frames[i],
+					&trace->frames[i], x, y, width, height);
+			p += n;
+		}
+	}
+
+	free(line);
+	fclose(stream);
+	return 0;
+}
+
+static uint64_t region_area(struct pixman_region16* region)
+{
+	int n = 0;
+	pixman_box16_t* boxes = pixman_region_rectangles(region, &n);
+	uint64_t area = 0;
+	for (int i = 0; i < n; ++i)
+		area += (uint64_t)(boxes[i].x2 - boxes[i].x1) *
+			(boxes[i].y2 - boxes[i].y1);
+	return area;
+}
+
+static void run_benchmark(const struct trace* trace)
+{
+	uint64_t rects_in = 0, area_in = 0;
+	for (int i = 0; i < trace->n_frames; ++i) {
+		rects_in += pixman_region_n_rects(&trace->frames[i]);
+		area_in += region_area(&trace->frames[i]);
+	}
+
+	printf("%s: %.1f rects per frame\n", trace->name,
+			(double)rects_in / trace->n_frames);
+
+	for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); ++c) {
+		uint64_t rects_out = 0, area_out = 0, time = 0;
+
+		struct pixman_region16 result;
+		pixman_region_init(&result);
+
+		for (int i = 0; i < trace->n_frames; ++i) {
+			uint64_t start_time = gettime_us();
+			damage_simplify(&result, &trace->frames[i],
+					&configs[c].config, WIDTH, HEIGHT);
+			time += gettime_us() - start_time;
+
+			rects_out += pixman_region_n_rects(&result);
+			area_out += region_area(&result);
+		}
+
+		pixman_region_fini(&result);
+
+		printf("  %-8s %8.2f us/frame %8.1f rects/frame %8.1f %% area overhead\n",
+				configs[c].name, (double)time / trace->n_frames,
+				(double)rects_out / trace->n_frames,
+				area_in ? 100.0 * (area_out - area_in) / area_in : 0);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int n_traces = argc > 1 ? argc - 1 : 3;
+	struct trace* traces = calloc(n_traces, sizeof(*traces));
+
+	if (argc > 1) {
+		for (int i = 0; i < n_traces; ++i)
+			if (load_trace(&traces[i], argv[i + 1]) < 0)
+				return 1;
+	} else {
+		generate_typing(&traces[0]);
+		generate_scattered(&traces[1]);
+		generate_scrolling(&traces[2]);
+	}
+
+	for (int i = 0; i < n_traces; ++i) {
+		run_benchmark(&traces[i]);
+		trace_free(&traces[i]);
+	}
+
+	free(traces);
+	return 0;
+}
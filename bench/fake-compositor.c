@@ -0,0 +1,982 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* A headless compositor that is just enough of a Wayland compositor for
+ * wayvnc to capture frames from it. Scenes are rendered into plain memory,
+ * so that no GPU is needed.
+ */
+
+#include "fake-compositor.h"
+#include "damage-trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <pixman.h>
+#include <wayland-server.h>
+
+#include "wlr-screencopy-unstable-v1-server.h"
+#include "ext-image-capture-source-v1-server.h"
+#include "ext-image-copy-capture-v1-server.h"
+
+#define GLYPH_WIDTH 9
+#define GLYPH_HEIGHT 18
+#define MARGIN 32
+
+#define BACKGROUND_COLOUR 0xff202020
+#define FOREGROUND_COLOUR 0xffd0d0d0
+
+struct fake_compositor {
+	struct fake_compositor_config config;
+
+	struct wl_display* display;
+	const char* socket;
+	struct wl_event_source* timer;
+	pthread_t thread;
+
+	uint32_t* pixels;
+	int stride;
+	uint64_t tick;
+
+	struct damage_trace* trace;
+	struct pixman_region16 trace_damage;
+	// The next frame to replay
+	struct damage_trace_frame trace_frame;
+	// Only frames from the source of the first frame are replayed
+	uint32_t trace_source;
+	bool have_trace_source;
+	int trace_interval_ms;
+
+	// Scene damage since the last completed capture
+	struct pixman_region16 damage;
+
+	// Captures that are waiting for the next frame
+	struct wl_list captures;
+};
+
+struct capture {
+	struct wl_list link;
+	struct fake_compositor* compositor;
+	struct wl_resource* resource;
+
+	struct wl_resource* buffer;
+	struct wl_listener buffer_destroy;
+
+	bool is_ext;
+	bool is_captured;
+	bool wants_damage;
+
+	// Damage that the client reported for its buffer (ext only)
+	struct pixman_region16 buffer_damage;
+};
+
+static uint32_t hash32(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+static void add_damage(struct fake_compositor* self, int x, int y, int width,
+		int height)
+{
+	pixman_region_union_rect(&self->damage, &self->damage, x, y, width,
+			height);
+}
+
+static void fill_rect(struct fake_compositor* self, int x, int y, int width,
+		int height, uint32_t colour)
+{
+	for (int row = y; row < y + height; ++row) {
+		uint32_t* p = self->pixels + row * self->stride + x;
+		for (int col = 0; col < width; ++col)
+			p[col] = colour;
+	}
+}
+
+static void draw_glyph(struct fake_compositor* self, int x, int y,
+		uint32_t seed)
+{
+	for (int row = 0; row < GLYPH_HEIGHT; ++row) {
+		uint32_t bits = hash32(seed * GLYPH_HEIGHT + row);
+		bool is_blank = row < 3 || row >= GLYPH_HEIGHT - 4;
+		uint32_t* p = self->pixels + (y + row) * self->stride + x;
+
+		for (int col = 0; col < GLYPH_WIDTH; ++col)
+			p[col] = !is_blank && col < GLYPH_WIDTH - 2 &&
+				(bits & (1 << col)) ?
+				FOREGROUND_COLOUR : BACKGROUND_COLOUR;
+	}
+}
+
+static int text_columns(const struct fake_compositor* self)
+{
+	return (self->config.width - 2 * MARGIN) / GLYPH_WIDTH;
+}
+
+static int text_rows(const struct fake_compositor* self)
+{
+	return (self->config.height - 2 * MARGIN) / GLYPH_HEIGHT;
+}
+
+static void draw_text_line(struct fake_compositor* self, int y, uint32_t seed)
+{
+	int n_cols = text_columns(self);
+	int length = hash32(seed) % n_cols;
+
+	fill_rect(self, MARGIN, y, n_cols * GLYPH_WIDTH, GLYPH_HEIGHT,
+			BACKGROUND_COLOUR);
+	for (int i = 0; i < length; ++i)
+		draw_glyph(self, MARGIN + i * GLYPH_WIDTH, y, seed + i);
+}
+
+static int tick_interval_ms(const struct fake_compositor* self)
+{
+	int interval = self->config.scene == FAKE_COMPOSITOR_SCENE_TRACE ?
+		self->trace_interval_ms : 1000 / self->config.refresh_rate;
+	return interval > 0 ? interval : 1;
+}
+
+static void scene_init(struct fake_compositor* self)
+{
+	int width = self->config.width;
+	int height = self->config.height;
+
+	fill_rect(self, 0, 0, width, height, BACKGROUND_COLOUR);
+
+	if (self->config.scene != FAKE_COMPOSITOR_SCENE_TYPING &&
+			self->config.scene != FAKE_COMPOSITOR_SCENE_TRACE)
+		for (int row = 0; row < text_rows(self); ++row)
+			draw_text_line(self, MARGIN + row * GLYPH_HEIGHT, row);
+
+	add_damage(self, 0, 0, width, height);
+}
+
+static void scene_step_typing(struct fake_compositor* self)
+{
+	int n_cols = text_columns(self);
+	int n_rows = text_rows(self);
+	int pos = (self->tick - 1) % (n_cols * n_rows);
+
+	if (pos == 0 && self->tick > 1) {
+		fill_rect(self, MARGIN, MARGIN, n_cols * GLYPH_WIDTH,
+				n_rows * GLYPH_HEIGHT, BACKGROUND_COLOUR);
+		add_damage(self, MARGIN, MARGIN, n_cols * GLYPH_WIDTH,
+				n_rows * GLYPH_HEIGHT);
+	}
+
+	int x = MARGIN + (pos % n_cols) * GLYPH_WIDTH;
+	int y = MARGIN + (pos / n_cols) * GLYPH_HEIGHT;
+
+	draw_glyph(self, x, y, self->tick);
+	add_damage(self, x, y, GLYPH_WIDTH, GLYPH_HEIGHT);
+
+	// The caret
+	if (pos % n_cols != n_cols - 1) {
+		fill_rect(self, x + GLYPH_WIDTH, y, 2, GLYPH_HEIGHT,
+				FOREGROUND_COLOUR);
+		add_damage(self, x + GLYPH_WIDTH, y, 2, GLYPH_HEIGHT);
+	}
+}
+
+static void scene_step_scrolling(struct fake_compositor* self)
+{
+	int n_rows = text_rows(self);
+	int height = n_rows * GLYPH_HEIGHT;
+	int width = self->config.width;
+	uint32_t* top = self->pixels + MARGIN * self->stride;
+
+	memmove(top, top + GLYPH_HEIGHT * self->stride,
+			(size_t)(height - GLYPH_HEIGHT) * self->stride * 4);
+	draw_text_line(self, MARGIN + height - GLYPH_HEIGHT,
+			self->tick + n_rows);
+
+	// Compositors usually report the whole scrolled area
+	add_damage(self, 0, MARGIN, width, height);
+}
+
+static void scene_step_video(struct fake_compositor* self)
+{
+	int width = self->config.width / 2;
+	int height = self->config.height / 2;
+	int x0 = width / 2;
+	int y0 = height / 2;
+	uint32_t t = self->tick;
+
+	for (int y = 0; y < height; ++y) {
+		uint32_t* p = self->pixels + (y0 + y) * self->stride + x0;
+		for (int x = 0; x < width; ++x) {
+			uint32_t r = (x + t * 3) & 0xff;
+			uint32_t g = (y + t * 5) & 0xff;
+			uint32_t b = (x + y + t * 7) & 0xff;
+			p[x] = 0xff000000 | r << 16 | g << 8 | b;
+		}
+	}
+
+	add_damage(self, x0, y0, width, height);
+}
+
+static uint64_t trace_frame_time(const struct damage_trace_frame* frame)
+{
+	return frame->present_time ? frame->present_time : frame->done_time;
+}
+
+static int read_trace_frame(struct fake_compositor* self)
+{
+	for (;;) {
+		int rc = damage_trace_read(self->trace, &self->trace_frame);
+		if (rc == 0) {
+			// Start over from the beginning
+			if (damage_trace_rewind(self->trace) < 0)
+				return -1;
+			rc = damage_trace_read(self->trace, &self->trace_frame);
+		}
+		if (rc <= 0)
+			return -1;
+
+		if (!self->have_trace_source) {
+			self->trace_source = self->trace_frame.source;
+			self->have_trace_source = true;
+		}
+
+		// Frames of other outputs are interleaved with desktop capture
+		if (self->trace_frame.source == self->trace_source)
+			return 0;
+	}
+}
+
+static void scene_step_trace(struct fake_compositor* self)
+{
+	int width = self->config.width;
+	int height = self->config.height;
+	uint32_t colour = 0xff000000 | hash32(self->tick);
+
+	int n_rects = 0;
+	pixman_box16_t* rects = pixman_region_rectangles(&self->trace_damage,
+			&n_rects);
+	for (int i = 0; i < n_rects; ++i) {
+		int x1 = rects[i].x1;
+		int y1 = rects[i].y1;
+		int x2 = rects[i].x2 < width ? rects[i].x2 : width;
+		int y2 = rects[i].y2 < height ? rects[i].y2 : height;
+		if (x1 >= x2 || y1 >= y2)
+			continue;
+
+		fill_rect(self, x1, y1, x2 - x1, y2 - y1, colour);
+		add_damage(self, x1, y1, x2 - x1, y2 - y1);
+	}
+
+	uint64_t time = trace_frame_time(&self->trace_frame);
+
+	if (read_trace_frame(self) < 0) {
+		fprintf(stderr, "Failed to read damage trace\n");
+		self->config.scene = FAKE_COMPOSITOR_SCENE_STATIC;
+		return;
+	}
+
+	// Going back in time means that the trace started over
+	uint64_t next_time = trace_frame_time(&self->trace_frame);
+	self->trace_interval_ms = next_time > time ?
+		(next_time - time + 500) / 1000 :
+		1000 / self->config.refresh_rate;
+}
+
+static void scene_step(struct fake_compositor* self)
+{
+	switch (self->config.scene) {
+	case FAKE_COMPOSITOR_SCENE_STATIC:
+		break;
+	case FAKE_COMPOSITOR_SCENE_TYPING:
+		scene_step_typing(self);
+		break;
+	case FAKE_COMPOSITOR_SCENE_SCROLLING:
+		scene_step_scrolling(self);
+		break;
+	case FAKE_COMPOSITOR_SCENE_VIDEO:
+		scene_step_video(self);
+		break;
+	case FAKE_COMPOSITOR_SCENE_TRACE:
+		scene_step_trace(self);
+		break;
+	}
+}
+
+static void send_presentation_time(struct capture* capture)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	uint64_t sec = ts.tv_sec;
+	if (capture->is_ext)
+		ext_image_copy_capture_frame_v1_send_presentation_time(
+				capture->resource, sec >> 32, sec & 0xffffffff,
+				ts.tv_nsec);
+	else
+		zwlr_screencopy_frame_v1_send_ready(capture->resource,
+				sec >> 32, sec & 0xffffffff, ts.tv_nsec);
+}
+
+static void send_failed(struct capture* capture)
+{
+	if (capture->is_ext)
+		ext_image_copy_capture_frame_v1_send_failed(capture->resource,
+				EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS);
+	else
+		zwlr_screencopy_frame_v1_send_failed(capture->resource);
+}
+
+static void send_damage(struct capture* capture,
+		struct pixman_region16* damage)
+{
+	int n_rects = 0;
+	pixman_box16_t* rects = pixman_region_rectangles(damage, &n_rects);
+
+	for (int i = 0; i < n_rects; ++i) {
+		int x = rects[i].x1;
+		int y = rects[i].y1;
+		int width = rects[i].x2 - x;
+		int height = rects[i].y2 - y;
+
+		if (capture->is_ext)
+			ext_image_copy_capture_frame_v1_send_damage(
+					capture->resource, x, y, width, height);
+		else
+			zwlr_screencopy_frame_v1_send_damage(capture->resource,
+					x, y, width, height);
+	}
+}
+
+static void copy_region(struct fake_compositor* self,
+		struct wl_shm_buffer* buffer, struct pixman_region16* region)
+{
+	uint8_t* dst = wl_shm_buffer_get_data(buffer);
+	int dst_stride = wl_shm_buffer_get_stride(buffer);
+
+	int n_rects = 0;
+	pixman_box16_t* rects = pixman_region_rectangles(region, &n_rects);
+
+	wl_shm_buffer_begin_access(buffer);
+
+	for (int i = 0; i < n_rects; ++i) {
+		size_t row_size = (rects[i].x2 - rects[i].x1) * 4;
+		for (int y = rects[i].y1; y < rects[i].y2; ++y)
+			memcpy(dst + y * dst_stride + rects[i].x1 * 4,
+					self->pixels + y * self->stride +
+					rects[i].x1, row_size);
+	}
+
+	wl_shm_buffer_end_access(buffer);
+}
+
+static void capture_complete(struct capture* capture)
+{
+	struct fake_compositor* self = capture->compositor;
+	int width = self->config.width;
+	int height = self->config.height;
+
+	struct wl_shm_buffer* buffer = capture->buffer ?
+		wl_shm_buffer_get(capture->buffer) : NULL;
+	if (!buffer || wl_shm_buffer_get_width(buffer) != width ||
+			wl_shm_buffer_get_height(buffer) != height ||
+			wl_shm_buffer_get_format(buffer) !=
+				WL_SHM_FORMAT_XRGB8888) {
+		send_failed(capture);
+		return;
+	}
+
+	struct pixman_region16 damage, copy;
+	pixman_region_init(&copy);
+	pixman_region_init_rect(&damage, 0, 0, width, height);
+
+	if (capture->wants_damage)
+		pixman_region_intersect(&damage, &damage, &self->damage);
+
+	if (capture->is_ext) {
+		// Only the parts of the buffer that are out of date are copied
+		pixman_region_union(&copy, &damage, &capture->buffer_damage);
+		pixman_region_intersect_rect(&copy, &copy, 0, 0, width,
+				height);
+	} else {
+		pixman_region_init_rect(&copy, 0, 0, width, height);
+	}
+
+	copy_region(self, buffer, &copy);
+
+	if (capture->is_ext) {
+		ext_image_copy_capture_frame_v1_send_transform(
+				capture->resource, WL_OUTPUT_TRANSFORM_NORMAL);
+		send_damage(capture, &damage);
+		send_presentation_time(capture);
+		ext_image_copy_capture_frame_v1_send_ready(capture->resource);
+	} else {
+		zwlr_screencopy_frame_v1_send_flags(capture->resource, 0);
+		if (wl_resource_get_version(capture->resource) >= 2)
+			send_damage(capture, &damage);
+		send_presentation_time(capture);
+	}
+
+	pixman_region_fini(&copy);
+	pixman_region_fini(&damage);
+}
+
+static int on_tick(void* data)
+{
+	struct fake_compositor* self = data;
+
+	self->tick++;
+	scene_step(self);
+
+	struct capture* capture;
+	struct capture* tmp;
+	wl_list_for_each_safe(capture, tmp, &self->captures, link) {
+		// Like a real compositor, only send frames that have changes
+		if (capture->wants_damage &&
+				!pixman_region_not_empty(&self->damage))
+			continue;
+
+		wl_list_remove(&capture->link);
+		wl_list_init(&capture->link);
+
+		capture_complete(capture);
+		pixman_region_clear(&self->damage);
+	}
+
+	wl_event_source_timer_update(self->timer, tick_interval_ms(self));
+	return 0;
+}
+
+static void handle_buffer_destroy(struct wl_listener* listener, void* data)
+{
+	struct capture* capture =
+		wl_container_of(listener, capture, buffer_destroy);
+	capture->buffer = NULL;
+	wl_list_remove(&capture->buffer_destroy.link);
+	wl_list_init(&capture->buffer_destroy.link);
+}
+
+static void capture_set_buffer(struct capture* capture,
+		struct wl_resource* buffer)
+{
+	wl_list_remove(&capture->buffer_destroy.link);
+	wl_list_init(&capture->buffer_destroy.link);
+
+	capture->buffer = buffer;
+	if (buffer)
+		wl_resource_add_destroy_listener(buffer,
+				&capture->buffer_destroy);
+}
+
+static void capture_start(struct capture* capture)
+{
+	capture->is_captured = true;
+	wl_list_insert(capture->compositor->captures.prev, &capture->link);
+}
+
+static void capture_resource_destroy(struct wl_resource* resource)
+{
+	struct capture* capture = wl_resource_get_user_data(resource);
+	wl_list_remove(&capture->link);
+	wl_list_remove(&capture->buffer_destroy.link);
+	pixman_region_fini(&capture->buffer_damage);
+	free(capture);
+}
+
+static void handle_destroy(struct wl_client* client,
+		struct wl_resource* resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static struct capture* capture_create(struct fake_compositor* self,
+		struct wl_client* client, const struct wl_interface* interface,
+		int version, uint32_t id, const void* implementation)
+{
+	struct capture* capture = calloc(1, sizeof(*capture));
+	if (!capture) {
+		wl_client_post_no_memory(client);
+		return NULL;
+	}
+
+	capture->resource = wl_resource_create(client, interface, version, id);
+	if (!capture->resource) {
+		free(capture);
+		wl_client_post_no_memory(client);
+		return NULL;
+	}
+
+	capture->compositor = self;
+	wl_list_init(&capture->link);
+	wl_list_init(&capture->buffer_destroy.link);
+	capture->buffer_destroy.notify = handle_buffer_destroy;
+	pixman_region_init(&capture->buffer_damage);
+
+	wl_resource_set_implementation(capture->resource, implementation,
+			capture, capture_resource_destroy);
+	return capture;
+}
+
+/* wlr-screencopy */
+
+static void wlr_frame_copy(struct wl_client* client,
+		struct wl_resource* resource, struct wl_resource* buffer)
+{
+	struct capture* capture = wl_resource_get_user_data(resource);
+	if (capture->is_captured) {
+		wl_resource_post_error(resource,
+				ZWLR_SCREENCOPY_FRAME_V1_ERROR_ALREADY_USED,
+				"Frame has already been used");
+		return;
+	}
+
+	capture_set_buffer(capture, buffer);
+	capture->wants_damage = false;
+	capture_start(capture);
+}
+
+static void wlr_frame_copy_with_damage(struct wl_client* client,
+		struct wl_resource* resource, struct wl_resource* buffer)
+{
+	struct capture* capture = wl_resource_get_user_data(resource);
+	wlr_frame_copy(client, resource, buffer);
+	capture->wants_damage = true;
+}
+
+static const struct zwlr_screencopy_frame_v1_interface wlr_frame_impl = {
+	.copy = wlr_frame_copy,
+	.destroy = handle_destroy,
+	.copy_with_damage = wlr_frame_copy_with_damage,
+};
+
+static void wlr_capture_output(struct wl_client* client,
+		struct wl_resource* resource, uint32_t id,
+		int32_t overlay_cursor, struct wl_resource* output)
+{
+	struct fake_compositor* self = wl_resource_get_user_data(resource);
+	int version = wl_resource_get_version(resource);
+
+	struct capture* capture = capture_create(self, client,
+			&zwlr_screencopy_frame_v1_interface, version, id,
+			&wlr_frame_impl);
+	if (!capture)
+		return;
+
+	int width = self->config.width;
+	int height = self->config.height;
+
+	zwlr_screencopy_frame_v1_send_buffer(capture->resource,
+			WL_SHM_FORMAT_XRGB8888, width, height, width * 4);
+	if (version >= 3)
+		zwlr_screencopy_frame_v1_send_buffer_done(capture->resource);
+}
+
+static void wlr_capture_output_region(struct wl_client* client,
+		struct wl_resource* resource, uint32_t id,
+		int32_t overlay_cursor, struct wl_resource* output,
+		int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	// Regions are not used by wayvnc, so the whole output will do
+	wlr_capture_output(client, resource, id, overlay_cursor, output);
+}
+
+static const struct zwlr_screencopy_manager_v1_interface wlr_manager_impl = {
+	.capture_output = wlr_capture_output,
+	.capture_output_region = wlr_capture_output_region,
+	.destroy = handle_destroy,
+};
+
+static void bind_wlr_manager(struct wl_client* client, void* data,
+		uint32_t version, uint32_t id)
+{
+	struct wl_resource* resource = wl_resource_create(client,
+			&zwlr_screencopy_manager_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &wlr_manager_impl, data,
+			NULL);
+}
+
+/* ext-image-copy-capture */
+
+static void ext_frame_attach_buffer(struct wl_client* client,
+		struct wl_resource* resource, struct wl_resource* buffer)
+{
+	struct capture* capture = wl_resource_get_user_data(resource);
+	capture_set_buffer(capture, buffer);
+}
+
+static void ext_frame_damage_buffer(struct wl_client* client,
+		struct wl_resource* resource, int32_t x, int32_t y,
+		int32_t width, int32_t height)
+{
+	struct capture* capture = wl_resource_get_user_data(resource);
+	pixman_region_union_rect(&capture->buffer_damage,
+			&capture->buffer_damage, x, y, width, height);
+}
+
+static void ext_frame_capture(struct wl_client* client,
+		struct wl_resource* resource)
+{
+	struct capture* capture = wl_resource_get_user_data(resource);
+	if (capture->is_captured) {
+		wl_resource_post_error(resource,
+				EXT_IMAGE_COPY_CAPTURE_FRAME_V1_ERROR_ALREADY_CAPTURED,
+				"Frame has already been captured");
+		return;
+	}
+	if (!capture->buffer) {
+		wl_resource_post_error(resource,
+				EXT_IMAGE_COPY_CAPTURE_FRAME_V1_ERROR_NO_BUFFER,
+				"No buffer attached");
+		return;
+	}
+
+	capture_start(capture);
+}
+
+static const struct ext_image_copy_capture_frame_v1_interface ext_frame_impl = {
+	.destroy = handle_destroy,
+	.attach_buffer = ext_frame_attach_buffer,
+	.damage_buffer = ext_frame_damage_buffer,
+	.capture = ext_frame_capture,
+};
+
+struct ext_session {
+	struct fake_compositor* compositor;
+	bool has_frame;
+};
+
+static void ext_session_create_frame(struct wl_client* client,
+		struct wl_resource* resource, uint32_t id)
+{
+	struct ext_session* session = wl_resource_get_user_data(resource);
+
+	struct capture* capture = capture_create(session->compositor, client,
+			&ext_image_copy_capture_frame_v1_interface,
+			wl_resource_get_version(resource), id, &ext_frame_impl);
+	if (!capture)
+		return;
+
+	capture->is_ext = true;
+
+	// The first frame of a session always contains everything
+	capture->wants_damage = session->has_frame;
+	session->has_frame = true;
+}
+
+static const struct ext_image_copy_capture_session_v1_interface ext_session_impl = {
+	.create_frame = ext_session_create_frame,
+	.destroy = handle_destroy,
+};
+
+static void ext_session_resource_destroy(struct wl_resource* resource)
+{
+	free(wl_resource_get_user_data(resource));
+}
+
+static void ext_create_session(struct wl_client* client,
+		struct wl_resource* resource, uint32_t id,
+		struct wl_resource* source, uint32_t options)
+{
+	struct fake_compositor* self = wl_resource_get_user_data(resource);
+
+	struct ext_session* session = calloc(1, sizeof(*session));
+	if (!session) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	session->compositor = self;
+
+	struct wl_resource* session_resource = wl_resource_create(client,
+			&ext_image_copy_capture_session_v1_interface,
+			wl_resource_get_version(resource), id);
+	if (!session_resource) {
+		free(session);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(session_resource, &ext_session_impl,
+			session, ext_session_resource_destroy);
+
+	ext_image_copy_capture_session_v1_send_buffer_size(session_resource,
+			self->config.width, self->config.height);
+	ext_image_copy_capture_session_v1_send_shm_format(session_resource,
+			WL_SHM_FORMAT_XRGB8888);
+	ext_image_copy_capture_session_v1_send_done(session_resource);
+}
+
+static void ext_create_pointer_cursor_session(struct wl_client* client,
+		struct wl_resource* resource, uint32_t id,
+		struct wl_resource* source, struct wl_resource* pointer)
+{
+	// There are no seats, so this can't happen
+	wl_client_post_implementation_error(client,
+			"Cursor sessions are not supported");
+}
+
+static const struct ext_image_copy_capture_manager_v1_interface ext_manager_impl = {
+	.create_session = ext_create_session,
+	.create_pointer_cursor_session = ext_create_pointer_cursor_session,
+	.destroy = handle_destroy,
+};
+
+static void bind_ext_manager(struct wl_client* client, void* data,
+		uint32_t version, uint32_t id)
+{
+	struct wl_resource* resource = wl_resource_create(client,
+			&ext_image_copy_capture_manager_v1_interface, version,
+			id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &ext_manager_impl, data,
+			NULL);
+}
+
+static const struct ext_image_capture_source_v1_interface ext_source_impl = {
+	.destroy = handle_destroy,
+};
+
+static void ext_create_source(struct wl_client* client,
+		struct wl_resource* resource, uint32_t id,
+		struct wl_resource* output)
+{
+	struct wl_resource* source = wl_resource_create(client,
+			&ext_image_capture_source_v1_interface,
+			wl_resource_get_version(resource), id);
+	if (!source) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(source, &ext_source_impl, NULL, NULL);
+}
+
+static const struct ext_output_image_capture_source_manager_v1_interface ext_source_manager_impl = {
+	.create_source = ext_create_source,
+	.destroy = handle_destroy,
+};
+
+static void bind_ext_source_manager(struct wl_client* client, void* data,
+		uint32_t version, uint32_t id)
+{
+	struct wl_resource* resource = wl_resource_create(client,
+			&ext_output_image_capture_source_manager_v1_interface,
+			version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &ext_source_manager_impl,
+			data, NULL);
+}
+
+/* wl_output */
+
+static void output_release(struct wl_client* client,
+		struct wl_resource* resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct wl_output_interface output_impl = {
+	.release = output_release,
+};
+
+static void bind_output(struct wl_client* client, void* data,
+		uint32_t version, uint32_t id)
+{
+	struct fake_compositor* self = data;
+
+	struct wl_resource* resource = wl_resource_create(client,
+			&wl_output_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &output_impl, self, NULL);
+
+	wl_output_send_geometry(resource, 0, 0, 0, 0,
+			WL_OUTPUT_SUBPIXEL_UNKNOWN, "wayvnc", "fake",
+			WL_OUTPUT_TRANSFORM_NORMAL);
+	wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT,
+			self->config.width, self->config.height,
+			self->config.refresh_rate * 1000);
+	wl_output_send_scale(resource, 1);
+	wl_output_send_done(resource);
+}
+
+static void* compositor_thread(void* arg)
+{
+	struct fake_compositor* self = arg;
+	wl_display_run(self->display);
+	return NULL;
+}
+
+struct fake_compositor* fake_compositor_start(
+		const struct fake_compositor_config* config)
+{
+	struct fake_compositor* self = calloc(1, sizeof(*self));
+	if (!self)
+		return NULL;
+
+	self->config = *config;
+	if (self->config.refresh_rate <= 0)
+		self->config.refresh_rate = 60;
+
+	wl_list_init(&self->captures);
+	pixman_region_init(&self->damage);
+	pixman_region_init(&self->trace_damage);
+	self->trace_frame.damage = &self->trace_damage;
+
+	if (config->scene == FAKE_COMPOSITOR_SCENE_TRACE) {
+		self->trace = damage_trace_open(config->trace_path);
+		if (!self->trace) {
+			fprintf(stderr, "Failed to open damage trace \"%s\"\n",
+					config->trace_path);
+			goto failure;
+		}
+
+		if (read_trace_frame(self) < 0 || !self->trace_frame.width ||
+				!self->trace_frame.height) {
+			fprintf(stderr, "Damage trace has no valid frames\n");
+			goto failure;
+		}
+
+		self->config.width = self->trace_frame.width;
+		self->config.height = self->trace_frame.height;
+		self->trace_interval_ms = 1000 / self->config.refresh_rate;
+	}
+
+	self->stride = self->config.width;
+	self->pixels = malloc((size_t)self->config.width *
+			self->config.height * 4);
+	if (!self->pixels)
+		goto failure;
+
+	scene_init(self);
+
+	self->display = wl_display_create();
+	if (!self->display)
+		goto failure;
+
+	if (wl_display_init_shm(self->display) < 0)
+		goto failure;
+
+	self->socket = wl_display_add_socket_auto(self->display);
+	if (!self->socket)
+		goto failure;
+
+	wl_global_create(self->display, &wl_output_interface, 3, self,
+			bind_output);
+
+	switch (config->protocol) {
+	case FAKE_COMPOSITOR_WLR_SCREENCOPY:
+		wl_global_create(self->display,
+				&zwlr_screencopy_manager_v1_interface, 3, self,
+				bind_wlr_manager);
+		break;
+	case FAKE_COMPOSITOR_EXT_IMAGE_COPY_CAPTURE:
+		wl_global_create(self->display,
+				&ext_output_image_capture_source_manager_v1_interface,
+				1, self, bind_ext_source_manager);
+		wl_global_create(self->display,
+				&ext_image_copy_capture_manager_v1_interface, 1,
+				self, bind_ext_manager);
+		break;
+	}
+
+	struct wl_event_loop* loop = wl_display_get_event_loop(self->display);
+	self->timer = wl_event_loop_add_timer(loop, on_tick, self);
+	if (!self->timer)
+		goto failure;
+	wl_event_source_timer_update(self->timer, tick_interval_ms(self));
+
+	if (pthread_create(&self->thread, NULL, compositor_thread, self) != 0)
+		goto failure;
+
+	return self;
+
+failure:
+	if (self->timer)
+		wl_event_source_remove(self->timer);
+	if (self->display)
+		wl_display_destroy(self->display);
+	damage_trace_close(self->trace);
+	pixman_region_fini(&self->trace_damage);
+	pixman_region_fini(&self->damage);
+	free(self->pixels);
+	free(self);
+	return NULL;
+}
+
+void fake_compositor_stop(struct fake_compositor* self)
+{
+	wl_display_terminate(self->display);
+	pthread_join(self->thread, NULL);
+
+	wl_event_source_remove(self->timer);
+	wl_display_destroy_clients(self->display);
+	wl_display_destroy(self->display);
+
+	damage_trace_close(self->trace);
+	pixman_region_fini(&self->trace_damage);
+	pixman_region_fini(&self->damage);
+	free(self->pixels);
+	free(self);
+}
+
+const char* fake_compositor_get_socket(const struct fake_compositor* self)
+{
+	return self->socket;
+}
+
+void fake_compositor_get_size(const struct fake_compositor* self,
+		int* width, int* height)
+{
+	*width = self->config.width;
+	*height = self->config.height;
+}
+
+const char* fake_compositor_scene_name(enum fake_compositor_scene scene)
+{
+	switch (scene) {
+	case FAKE_COMPOSITOR_SCENE_STATIC: return "static";
+	case FAKE_COMPOSITOR_SCENE_TYPING: return "typing";
+	case FAKE_COMPOSITOR_SCENE_SCROLLING: return "scrolling";
+	case FAKE_COMPOSITOR_SCENE_VIDEO: return "video";
+	case FAKE_COMPOSITOR_SCENE_TRACE: return "trace";
+	}
+	return "unknown";
+}
+
+const char* fake_compositor_protocol_name(
+		enum fake_compositor_protocol protocol)
+{
+	switch (protocol) {
+	case FAKE_COMPOSITOR_WLR_SCREENCOPY: return "wlr-screencopy";
+	case FAKE_COMPOSITOR_EXT_IMAGE_COPY_CAPTURE:
+		return "ext-image-copy-capture";
+	}
+	return "unknown";
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+enum fake_compositor_protocol {
+	FAKE_COMPOSITOR_WLR_SCREENCOPY = 0,
+	FAKE_COMPOSITOR_EXT_IMAGE_COPY_CAPTURE,
+};
+
+enum fake_compositor_scene {
+	// Nothing changes after the first frame
+	FAKE_COMPOSITOR_SCENE_STATIC = 0,
+	// A glyph at a time is added along lines of text
+	FAKE_COMPOSITOR_SCENE_TYPING,
+	// Most of the output moves up by a line of text each frame
+	FAKE_COMPOSITOR_SCENE_SCROLLING,
+	// A quarter of the output changes completely each frame
+	FAKE_COMPOSITOR_SCENE_VIDEO,
+	// Damage and timing are replayed from a damage trace
+	FAKE_COMPOSITOR_SCENE_TRACE,
+};
+
+struct fake_compositor_config {
+	int width, height;
+	// Scene updates per second
+	int refresh_rate;
+	enum fake_compositor_protocol protocol;
+	enum fake_compositor_scene scene;
+	/* Only used by the trace scene. The size of the output and the
+	 * refresh rate are taken from the trace. A trace of several outputs
+	 * is replayed for the output of its first frame.
+	 */
+	const char* trace_path;
+};
+
+struct fake_compositor;
+
+/* Starts a headless compositor with a single output on a thread of its own.
+ * It offers wl_shm, wl_output and the chosen capture protocol, and renders
+ * the chosen scene into memory at the given refresh rate.
+ */
+struct fake_compositor* fake_compositor_start(
+		const struct fake_compositor_config* config);
+void fake_compositor_stop(struct fake_compositor* self);
+
+// The name of the socket, to be passed to wl_display_connect()
+const char* fake_compositor_get_socket(const struct fake_compositor* self);
+void fake_compositor_get_size(const struct fake_compositor* self,
+		int* width, int* height);
+
+const char* fake_compositor_scene_name(enum fake_compositor_scene scene);
+const char* fake_compositor_protocol_name(
+		enum fake_compositor_protocol protocol);
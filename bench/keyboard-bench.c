@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Measures the per-keystroke cost of translating symbols into key codes.
+ *
+ * Usage: keyboard-bench [layouts [text-file]]
+ *
+ * The text is fed through keyboard_feed() as key presses and releases, using
+ * a mock virtual keyboard that only counts the requests that would have been
+ * sent to the compositor. Mixing scripts in the text exercises layout group
+ * switching when multiple layouts are given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <xkbcommon/xkbcommon.h>
+#include <wayland-client.h>
+#include <neatvnc.h>
+
+#include "keyboard.h"
+#include "time-util.h"
+
+#define N_ROUNDS 200
+
+static const char default_text[] =
+	"The quick brown fox jumps over the lazy dog. 0123456789 !\"#$%&/()=?\n"
+	"Zwölf Boxkämpfer jagen Viktor quer über den großen Sylter Deich.\n"
+	"Portez ce vieux whisky au juge blond qui fume.\n"
+	"Съешь же ещё этих мягких французских булок, да выпей чаю.\n"
+	"Ξεσκεπάζω την ψυχοφθόρα βδελυγμία.\n";
+
+static uint64_t n_requests;
+
+/* The generated protocol stubs marshal requests through these; replacing them
+ * means that no compositor is needed.
+ */
+struct wl_proxy* wl_proxy_marshal_flags(struct wl_proxy* proxy,
+		uint32_t opcode, const struct wl_interface* interface,
+		uint32_t version, uint32_t flags, ...)
+{
+	n_requests++;
+	return NULL;
+}
+
+void wl_proxy_marshal(struct wl_proxy* proxy, uint32_t opcode, ...)
+{
+	n_requests++;
+}
+
+uint32_t wl_proxy_get_version(struct wl_proxy* proxy)
+{
+	return 1;
+}
+
+void wl_proxy_destroy(struct wl_proxy* proxy)
+{
+}
+
+static size_t utf8_decode(const char* src, uint32_t* dst, size_t max_len)
+{
+	const unsigned char* p = (const unsigned char*)src;
+	size_t len = 0;
+
+	while (*p && len < max_len) {
+		uint32_t c = *p++;
+		int n_cont = 0;
+
+		if (c >= 0xf0) {
+			c &= 0x07;
+			n_cont = 3;
+		} else if (c >= 0xe0) {
+			c &= 0x0f;
+			n_cont = 2;
+		} else if (c >= 0xc0) {
+			c &= 0x1f;
+			n_cont = 1;
+		}
+
+		for (int i = 0; i < n_cont && (*p & 0xc0) == 0x80; ++i)
+			c = (c << 6) | (*p++ & 0x3f);
+
+		dst[len++] = c;
+	}
+
+	return len;
+}
+
+static char* read_file(const char* path)
+{
+	FILE* stream = fopen(path, "r");
+	if (!stream) {
+		perror(path);
+		return NULL;
+	}
+
+	fseek(stream, 0, SEEK_END);
+	long size = ftell(stream);
+	rewind(stream);
+
+	char* data = calloc(1, size + 1);
+	if (data && fread(data, 1, size, stream) != (size_t)size) {
+		free(data);
+		data = NULL;
+	}
+
+	fclose(stream);
+	return data;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* layouts = argc > 1 ? argv[1] : "us,de,fr,ru,gr";
+	char* text = argc > 2 ? read_file(argv[2]) : strdup(default_text);
+	if (!text)
+		return 1;
+
+	size_t max_len = strlen(text);
+	uint32_t* codepoints = calloc(max_len, sizeof(*codepoints));
+	xkb_keysym_t* symbols = calloc(max_len, sizeof(*symbols));
+	size_t len = utf8_decode(text, codepoints, max_len);
+	free(text);
+
+	size_t n_symbols = 0;
+	for (size_t i = 0; i < len; ++i) {
+		xkb_keysym_t symbol = codepoints[i] == '\n' ? XKB_KEY_Return :
+			xkb_utf32_to_keysym(codepoints[i]);
+		if (symbol != XKB_KEY_NoSymbol)
+			symbols[n_symbols++] = symbol;
+	}
+	free(codepoints);
+
+	struct xkb_rule_names rule_names = {
+		.layout = layouts,
+		.model = "pc105",
+	};
+
+	static int dummy;
+	struct keyboard keyboard = {
+		.virtual_keyboard = (struct zwp_virtual_keyboard_v1*)&dummy,
+	};
+
+	// Keep per-key debug logging out of the measurement
+	nvnc_set_log_level(NVNC_LOG_ERROR);
+
+	uint64_t start_time = gettime_us();
+	if (keyboard_init(&keyboard, &rule_names) < 0) {
+		fprintf(stderr, "Failed to create keymap for \"%s\"\n", layouts);
+		return 1;
+	}
+	uint64_t init_time = gettime_us() - start_time;
+
+	n_requests = 0;
+	start_time = gettime_us();
+	for (int round = 0; round < N_ROUNDS; ++round)
+		for (size_t i = 0; i < n_symbols; ++i) {
+			keyboard_feed(&keyboard, symbols[i], true);
+			keyboard_feed(&keyboard, symbols[i], false);
+		}
+	uint64_t feed_time = gettime_us() - start_time;
+
+	uint64_t n_keystrokes = (uint64_t)N_ROUNDS * n_symbols;
+	printf("layouts: %s\n", layouts);
+	printf("  keymap init: %.2f ms\n", init_time / 1000.0);
+	printf("  keystrokes: %"PRIu64"\n", n_keystrokes);
+	printf("  time per keystroke: %.1f ns\n",
+			1000.0 * feed_time / n_keystrokes);
+	printf("  requests per keystroke: %.2f\n",
+			(double)n_requests / n_keystrokes);
+
+	keyboard_destroy(&keyboard);
+	free(symbols);
+	return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Compares how fast frames can be read out of shared memory that is backed by
+ * regular pages, transparent huge pages and explicit huge pages.
+ *
+ * The workload mimics what the encoders do: the frame is walked in 64x64
+ * tiles and each tile is converted into another pixel format. Walking in
+ * tiles touches a new page for every row of a tile, so it is sensitive to
+ * TLB misses.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pixman.h>
+
+#include "shm.h"
+#include "time-util.h"
+
+#define WIDTH 3840
+#define HEIGHT 2160
+#define STRIDE (WIDTH * 4)
+#define TILE_SIZE 64
+#define N_ITERATIONS 50
+
+enum mode {
+	MODE_REGULAR = 0,
+	MODE_THP,
+	MODE_HUGETLB,
+};
+
+static const char* mode_names[] = {
+	[MODE_REGULAR] = "regular",
+	[MODE_THP] = "thp",
+	[MODE_HUGETLB] = "hugetlb",
+};
+
+static void* map_frame(enum mode mode, size_t* size)
+{
+	*size = STRIDE * HEIGHT;
+
+	int fd = mode == MODE_HUGETLB ? shm_alloc_hugetlb_fd(size) :
+		shm_alloc_fd(*size);
+	if (fd < 0)
+		return NULL;
+
+	void* pixels = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			0);
+	close(fd);
+	if (pixels == MAP_FAILED)
+		return NULL;
+
+	if (mode == MODE_THP)
+		shm_advise_hugepages(pixels, *size);
+
+	return pixels;
+}
+
+static void convert_tiles(pixman_image_t* src, pixman_image_t* dst)
+{
+	for (int y = 0; y < HEIGHT; y += TILE_SIZE)
+		for (int x = 0; x < WIDTH; x += TILE_SIZE)
+			pixman_image_composite(PIXMAN_OP_SRC, src, NULL, dst,
+					x, y, 0, 0, 0, 0, TILE_SIZE, TILE_SIZE);
+}
+
+static int run_benchmark(enum mode mode)
+{
+	size_t size;
+	uint32_t* pixels = map_frame(mode, &size);
+	if (!pixels) {
+		printf("%-10s unavailable\n", mode_names[mode]);
+		return 0;
+	}
+
+	uint64_t start_time = gettime_us();
+	for (int i = 0; i < WIDTH * HEIGHT; ++i)
+		pixels[i] = i * 2654435761u;
+	uint64_t fault_time = gettime_us() - start_time;
+
+	pixman_image_t* src = pixman_image_create_bits_no_clear(PIXMAN_x8r8g8b8,
+			WIDTH, HEIGHT, pixels, STRIDE);
+	pixman_image_t* dst = pixman_image_create_bits_no_clear(PIXMAN_r5g6b5,
+			TILE_SIZE, TILE_SIZE, NULL, 0);
+
+	// Warm up the caches
+	convert_tiles(src, dst);
+
+	start_time = gettime_us();
+	for (int i = 0; i < N_ITERATIONS; ++i)
+		convert_tiles(src, dst);
+	uint64_t convert_time = gettime_us() - start_time;
+
+	double mpixels = (double)WIDTH * HEIGHT * N_ITERATIONS / 1e6;
+	printf("%-10s %10.1f %14.1f\n", mode_names[mode], fault_time / 1e3,
+			mpixels / (convert_time / 1e6));
+
+	pixman_image_unref(dst);
+	pixman_image_unref(src);
+	munmap(pixels, size);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	printf("%-10s %10s %14s\n", "mode", "fill (ms)", "convert (Mpx/s)");
+
+	int r = 0;
+	r |= run_benchmark(MODE_REGULAR);
+	r |= run_benchmark(MODE_THP);
+	r |= run_benchmark(MODE_HUGETLB);
+	return r;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Measures the cost of finding changed tiles in a frame.
+ *
+ * Usage: tile-hash-bench
+ *
+ * Each scenario is run on 1080p and 4K frames with whole-frame damage, as
+ * reported by compositors without damage tracking.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pixman.h>
+
+#include "tile-hash.h"
+#include "time-util.h"
+
+#define N_FRAMES 50
+
+static const struct {
+	int width, height;
+} sizes[] = {
+	{ 1920, 1080 },
+	{ 3840, 2160 },
+};
+
+enum scenario {
+	SCENARIO_STATIC = 0,
+	SCENARIO_CURSOR,
+	SCENARIO_VIDEO,
+	SCENARIO_COUNT,
+};
+
+static const char* scenario_names[SCENARIO_COUNT] = {
+	[SCENARIO_STATIC] = "static",
+	[SCENARIO_CURSOR] = "cursor",
+	[SCENARIO_VIDEO] = "video",
+};
+
+static void modify_frame(uint32_t* pixels, int width, int height,
+		enum scenario scenario, int frame)
+{
+	switch (scenario) {
+	case SCENARIO_STATIC:
+		break;
+	case SCENARIO_CURSOR:;
+		// A small square moving across the screen
+		int x0 = (frame * 37) % (width - 16);
+		int y0 = (frame * 23) % (height - 16);
+		for (int y = y0; y < y0 + 16; ++y)
+			for (int x = x0; x < x0 + 16; ++x)
+				pixels[y * width + x] ^= 0xffffff;
+		break;
+	case SCENARIO_VIDEO:
+		// A quarter of the screen changes on every frame
+		for (int y = 0; y < height / 2; ++y)
+			for (int x = 0; x < width / 2; ++x)
+				pixels[y * width + x] += frame;
+		break;
+	case SCENARIO_COUNT:
+		break;
+	}
+}
+
+static void run_benchmark(int width, int height, enum scenario scenario)
+{
+	int stride = width * 4;
+	uint32_t* pixels = malloc((size_t)stride * height);
+	for (int i = 0; i < width * height; ++i)
+		pixels[i] = i * 2654435761u;
+
+	struct tile_hash hash;
+	tile_hash_init(&hash, width, height);
+
+	struct pixman_region16 damage;
+	pixman_region_init(&damage);
+
+	uint64_t time = 0, area = 0;
+
+	for (int i = 0; i <= N_FRAMES; ++i) {
+		modify_frame(pixels, width, height, scenario, i);
+		pixman_region_fini(&damage);
+		pixman_region_init_rect(&damage, 0, 0, width, height);
+
+		uint64_t start_time = gettime_us();
+		tile_hash_apply(&hash, pixels, stride, 4, &damage);
+		uint64_t dt = gettime_us() - start_time;
+
+		// The first frame only seeds the hashes
+		if (i == 0)
+			continue;
+
+		time += dt;
+
+		int n = 0;
+		pixman_box16_t* boxes = pixman_region_rectangles(&damage, &n);
+		for (int j = 0; j < n; ++j)
+			area += (uint64_t)(boxes[j].x2 - boxes[j].x1) *
+				(boxes[j].y2 - boxes[j].y1);
+	}
+
+	double frame_bytes = (double)stride * height;
+	printf("  %-8s %8.2f ms/frame %8.2f GB/s %8.1f %% damage remaining\n",
+			scenario_names[scenario],
+			time / 1000.0 / N_FRAMES,
+			frame_bytes * N_FRAMES / (time * 1000.0),
+			100.0 * area / ((double)width * height * N_FRAMES));
+
+	pixman_region_fini(&damage);
+	tile_hash_deinit(&hash);
+	free(pixels);
+}
+
+int main(void)
+{
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		printf("%dx%d:\n", sizes[i].width, sizes[i].height);
+		for (int s = 0; s < SCENARIO_COUNT; ++s)
+			run_benchmark(sizes[i].width, sizes[i].height, s);
+	}
+	return 0;
+}
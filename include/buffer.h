@@ -19,6 +19,8 @@
 #include "sys/queue.h"
 #include "config.h"
 #include "observer.h"
+#include "histogram.h"
+#include "damage-ring.h"
 
 #include <unistd.h>
 #include <stdbool.h>
@@ -28,10 +30,12 @@
 #include <stdatomic.h>
 
 struct wl_buffer;
+struct wl_shm_pool;
 struct gbm_bo;
 struct gbm_device;
 struct nvnc_frame;
 struct nvnc_buffer;
+struct wv_buffer_pool;
 
 enum wv_buffer_type {
 	WV_BUFFER_UNSPEC = 0,
@@ -52,11 +56,17 @@ struct wv_gbm_device {
 struct wv_buffer {
 	enum wv_buffer_type type;
 	LIST_ENTRY(wv_buffer) link;
+	struct wv_buffer_pool* pool;
 
 	struct nvnc_frame* nvnc_frame;
 	struct nvnc_buffer* buffer;
 	struct wl_buffer* wl_buffer;
 
+	/* The shm pool is kept around so that the memory can be reused with a
+	 * different pixel format.
+	 */
+	struct wl_shm_pool* shm_pool;
+
 	void* pixels;
 	size_t size;
 	int width, height, stride;
@@ -67,6 +77,13 @@ struct wv_buffer {
 
 	struct pixman_region16 frame_damage;
 	struct pixman_region16 buffer_damage;
+	/* buffer_damage covers all frames before this sequence number */
+	uint64_t damage_seq;
+
+	/* Time at which capturing into this buffer was requested, in µs */
+	uint64_t capture_time;
+	/* Presentation time reported by the compositor in µs, or 0 */
+	uint64_t present_time;
 
 #ifdef ENABLE_SCREENCOPY_DMABUF
 	/* The following is only applicable to DMABUF */
@@ -97,17 +114,48 @@ struct wv_buffer_config {
 	uint64_t* modifiers;
 };
 
+struct wv_buffer_pool_stats {
+	enum wv_buffer_type type;
+	int width, height;
+	uint32_t format;
+
+	/* Buffers that are alive, including ones from previous configs */
+	uint32_t n_allocated;
+	/* Buffers that have been acquired and not yet released */
+	uint32_t n_in_use;
+	uint64_t n_bytes;
+	/* Number of times that an acquire failed because of max_buffers */
+	uint32_t n_exhausted;
+	/* Number of reconfigurations where the buffers were kept */
+	uint32_t n_reused;
+	/* Time in µs that it takes to allocate a buffer */
+	struct histogram alloc_latency;
+};
+
 struct wv_buffer_pool {
+	LIST_ENTRY(wv_buffer_pool) link;
 	struct nvnc_buffer_pool* nvnc_pool;
 	struct wv_buffer_list list;
 	struct wv_buffer_config config;
 #ifdef ENABLE_SCREENCOPY_DMABUF
 	struct wv_gbm_device* gbm;
 #endif
+
+	/* Number of buffers to allocate up front when the pool is reconfigured */
+	unsigned n_warmup;
+	/* Maximum number of live buffers or 0 for no limit */
+	unsigned max_buffers;
+	bool is_exhausted;
+
+	struct damage_ring damage;
+
+	struct wv_buffer_pool_stats stats;
 };
 
 enum wv_buffer_type wv_buffer_get_available_types(void);
 
+void wv_buffer_set_shm_hugepages(bool enable);
+
 void wv_buffer_damage_rect(struct wv_buffer* self, int x, int y, int width,
 		int height);
 void wv_buffer_damage_whole(struct wv_buffer* self);
@@ -121,6 +169,13 @@ void wv_buffer_pool_destroy(struct wv_buffer_pool* pool);
 bool wv_buffer_pool_reconfig(struct wv_buffer_pool* pool,
 		const struct wv_buffer_config* config);
 struct wv_buffer* wv_buffer_pool_acquire(struct wv_buffer_pool* pool);
+bool wv_buffer_pool_is_exhausted(const struct wv_buffer_pool* pool);
+
+void wv_buffer_pool_set_default_limits(unsigned n_warmup,
+		unsigned max_buffers);
+
+struct wv_buffer_pool* wv_buffer_pool_first(void);
+struct wv_buffer_pool* wv_buffer_pool_next(struct wv_buffer_pool* pool);
 
-void wv_buffer_pool_damage_all(struct wv_buffer_pool* pool,
-		struct pixman_region16* region);
+void wv_buffer_pool_commit_damage(struct wv_buffer_pool* pool,
+		struct wv_buffer* buffer);
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* The capture scheduler learns the commit cadence of an output from the
+ * presentation timestamps that come with each captured frame, and uses it to
+ * place the next capture request just after the next expected commit, while
+ * still honouring the rate limit.
+ *
+ * All times are in microseconds on CLOCK_MONOTONIC.
+ */
+struct capture_scheduler {
+	uint64_t last_start;
+	uint64_t last_pts;
+	uint64_t interval;
+};
+
+void capture_scheduler_init(struct capture_scheduler* self);
+void capture_scheduler_reset(struct capture_scheduler* self);
+
+void capture_scheduler_on_start(struct capture_scheduler* self, uint64_t now);
+void capture_scheduler_on_present(struct capture_scheduler* self,
+		uint64_t pts);
+
+uint64_t capture_scheduler_get_interval(const struct capture_scheduler* self);
+int32_t capture_scheduler_get_delay(const struct capture_scheduler* self,
+		double rate_limit, uint64_t now);
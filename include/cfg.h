@@ -37,6 +37,20 @@
 	X(string, xkb_variant) \
 	X(string, xkb_options) \
 	X(bool, use_relative_paths) \
+	X(uint, capture_queue_depth) \
+	X(uint, buffer_pool_warmup) \
+	X(uint, buffer_pool_limit) \
+	X(bool, enable_hugepages) \
+	X(uint, damage_tile_size) \
+	X(uint, damage_merge_overhead) \
+	X(uint, damage_max_rects) \
+	X(bool, desktop_frame_group) \
+	X(string, change_detection) \
+	X(uint, change_detection_threads) \
+	X(string, change_detection_cpus) \
+	X(bool, input_latency_probe) \
+	X(string, metrics_socket) \
+	X(uint, metrics_port) \
 
 struct cfg {
 	char* directory;
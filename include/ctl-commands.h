@@ -32,6 +32,7 @@ enum cmd_type {
 	CMD_OUTPUT_SET,
 	CMD_VERSION,
 	CMD_WAYVNC_EXIT,
+	CMD_PERF_STATS,
 	CMD_UNKNOWN,
 };
 #define CMD_LIST_LEN CMD_UNKNOWN
@@ -43,6 +44,7 @@ enum event_type {
 	EVT_DETACHED,
 	EVT_OUTPUT_ADDED,
 	EVT_OUTPUT_REMOVED,
+	EVT_PERF_STATS,
 	EVT_UNKNOWN,
 };
 #define EVT_LIST_LEN EVT_UNKNOWN
@@ -24,6 +24,7 @@
 
 struct ctl;
 struct cmd_response;
+struct histogram;
 
 struct ctl_server_client;
 
@@ -46,6 +47,18 @@ struct ctl_server_output {
 	char power[8];
 };
 
+struct wv_buffer_pool_stats;
+
+struct ctl_server_latency {
+	const char* name;
+	const struct histogram* histogram;
+};
+
+struct ctl_server_counter {
+	const char* name;
+	uint64_t value;
+};
+
 struct ctl_server_actions {
 	void* userdata;
 	struct cmd_response* (*on_attach)(struct ctl*, const char* display,
@@ -71,6 +84,19 @@ struct ctl_server_actions {
 	// Receiver will free(outputs) when done.
 	int (*get_output_list)(struct ctl*,
 			struct ctl_server_output** outputs);
+
+	/* Same as above, but the histograms are not copied. Returns -1 if the
+	 * array could not be allocated.
+	 */
+	int (*get_latency_stats)(struct ctl*,
+			struct ctl_server_latency** stats);
+
+	// Same as get_latency_stats
+	int (*get_buffer_pool_stats)(struct ctl*,
+			struct wv_buffer_pool_stats** stats);
+
+	// Same as get_latency_stats
+	int (*get_counters)(struct ctl*, struct ctl_server_counter** counters);
 };
 
 struct ctl* ctl_server_new(const char* socket_path,
@@ -96,3 +122,8 @@ void ctl_server_event_detached(struct ctl*);
 
 void ctl_server_event_output_added(struct ctl*, const char* name);
 void ctl_server_event_output_removed(struct ctl*, const char* name);
+
+void ctl_server_event_perf_stats(struct ctl*,
+		const struct ctl_server_latency* stats, int n_stats,
+		const struct wv_buffer_pool_stats* pools, int n_pools,
+		const struct ctl_server_counter* counters, int n_counters);
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct nvnc_frame;
+
+#define CURSOR_CACHE_SIZE 8
+
+/* Cursor images that have been seen recently, so that switching back and
+ * forth between a few cursor shapes doesn't require new copies. Images are
+ * identified by a hash of their content along with their size, format and
+ * hotspot.
+ */
+struct cursor_cache_entry {
+	struct nvnc_frame* frame;
+	uint64_t hash;
+	int width, height;
+	uint32_t format;
+	int x_hotspot, y_hotspot;
+	uint64_t last_used;
+};
+
+struct cursor_cache_stats {
+	uint64_t n_unchanged;
+	uint64_t n_hits;
+	uint64_t n_misses;
+};
+
+struct cursor_cache {
+	struct cursor_cache_entry entries[CURSOR_CACHE_SIZE];
+
+	// The entry that was last looked up, or NULL
+	struct cursor_cache_entry* current;
+	uint64_t clock;
+
+	struct cursor_cache_stats stats;
+};
+
+enum cursor_cache_result {
+	CURSOR_CACHE_UNCHANGED = 0,
+	CURSOR_CACHE_HIT,
+	CURSOR_CACHE_MISS,
+	CURSOR_CACHE_ERROR,
+};
+
+void cursor_cache_init(struct cursor_cache* self);
+void cursor_cache_deinit(struct cursor_cache* self);
+
+/* Forget the current cursor, so that the next lookup is never reported as
+ * unchanged.
+ */
+void cursor_cache_reset(struct cursor_cache* self);
+
+struct cursor_image {
+	const void* pixels;
+	int width, height, stride;
+	int bytes_per_pixel;
+	uint32_t format;
+	int x_hotspot, y_hotspot;
+};
+
+/* Look up a cursor image and make it the current one. New images are copied
+ * into the cache, replacing the least recently used entry. If is_damaged is
+ * false and the size, format and hotspot match the current cursor, the
+ * image is assumed to be unchanged without hashing it.
+ *
+ * Unless an error is returned, frame points to the cached image.
+ */
+enum cursor_cache_result cursor_cache_lookup(struct cursor_cache* self,
+		const struct cursor_image* image, bool is_damaged,
+		struct nvnc_frame** frame);
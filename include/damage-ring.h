@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pixman.h>
+
+#define DAMAGE_RING_SIZE 16
+
+/* A bounded history of frame damage. Every frame that is captured gets a
+ * sequence number and its damage is stored in the ring. A buffer that
+ * remembers the sequence number at which its contents were last updated can
+ * then find out which regions it is missing without having to be told about
+ * each frame as it happens.
+ */
+struct damage_ring {
+	struct pixman_region16 regions[DAMAGE_RING_SIZE];
+	uint64_t seq;
+};
+
+void damage_ring_init(struct damage_ring* self);
+void damage_ring_deinit(struct damage_ring* self);
+
+// Returns the sequence number that follows this damage
+uint64_t damage_ring_push(struct damage_ring* self,
+		struct pixman_region16* damage);
+
+/* Accumulates all damage since seq into dst. Returns false if some of that
+ * damage has already been dropped from the ring, in which case dst is left
+ * unchanged and the caller should assume that everything is damaged.
+ */
+bool damage_ring_collect(const struct damage_ring* self, uint64_t seq,
+		struct pixman_region16* dst);
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pixman.h>
+
+/* Compositors often report damage as many small rectangles. Each of them
+ * costs something further down the pipeline, so this reduces the number of
+ * rectangles at the cost of marking some undamaged pixels as damaged.
+ *
+ * All stages are disabled when their respective parameter is 0.
+ */
+struct damage_simplify_config {
+	/* Expand rectangles to the edges of this grid */
+	uint32_t tile_size;
+	/* Merge two rectangles if their bounding box is no more than this many
+	 * percent larger than the rectangles themselves.
+	 */
+	uint32_t max_overhead;
+	/* Keep merging the rectangles that add the least area until no more
+	 * than this many remain.
+	 */
+	uint32_t max_rects;
+};
+
+static inline bool damage_simplify_is_enabled(
+		const struct damage_simplify_config* config)
+{
+	return config->tile_size || config->max_overhead || config->max_rects;
+}
+
+void damage_simplify(struct pixman_region16* dst, struct pixman_region16* src,
+		const struct damage_simplify_config* config, int width,
+		int height);
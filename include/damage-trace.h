@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <pixman.h>
+
+#define DAMAGE_TRACE_VERSION 1
+
+/* A damage trace is a binary log of the frames that a compositor delivered,
+ * so that realistic workloads can be replayed offline.
+ *
+ * The file begins with the magic "WVDT" followed by a 32 bit version. After
+ * that come the frames, each of which consists of:
+ *  - capture, presentation and completion times: 3 x 64 bits
+ *  - width and height: 2 x 16 bits
+ *  - DRM fourcc format: 32 bits
+ *  - source that the frame was captured from: 32 bits
+ *  - number of damage rectangles: 16 bits
+ *  - rectangles as x, y, width and height: n x 4 x 16 bits
+ *
+ * Damage with more rectangles than fit in the count is recorded as its extents.
+ *
+ * Integers are little endian and times are in µs on CLOCK_MONOTONIC. A time
+ * that is not known is 0.
+ */
+struct damage_trace_frame {
+	uint64_t capture_time;
+	uint64_t present_time;
+	uint64_t done_time;
+	uint16_t width, height;
+	uint32_t format;
+	/* Frames from the same output have the same source. 0 if there is only
+	 * one source.
+	 */
+	uint32_t source;
+	struct pixman_region16* damage;
+};
+
+struct damage_trace;
+
+struct damage_trace* damage_trace_create(const char* path);
+struct damage_trace* damage_trace_open(const char* path);
+int damage_trace_close(struct damage_trace* self);
+
+int damage_trace_write(struct damage_trace* self,
+		const struct damage_trace_frame* frame);
+
+/* The damage of the frame must point to an initialised region. Returns 1 if a
+ * frame was read, 0 at the end of the trace and -1 on error.
+ */
+int damage_trace_read(struct damage_trace* self,
+		struct damage_trace_frame* frame);
+
+// Starts reading again from the first frame
+int damage_trace_rewind(struct damage_trace* self);
@@ -24,6 +24,7 @@
 
 struct desktop_output;
 struct desktop_capture;
+struct aml_timer;
 
 struct desktop_output {
 	LIST_ENTRY(desktop_output) link;
@@ -33,6 +34,17 @@ struct desktop_output {
 	struct observer geometry_change_observer;
 	struct screencopy* sc;
 	struct screencopy* cursor_sc;
+
+	bool is_capturing;
+	/* Set when the output had no damage in the last frame group. Idle
+	 * outputs are not waited for, because their capture only completes
+	 * once something changes.
+	 */
+	bool is_idle;
+	/* Captured frame that is being held back until the rest of the frame
+	 * group is done.
+	 */
+	struct wv_buffer* pending_frame;
 };
 
 LIST_HEAD(desktop_output_list, desktop_output);
@@ -53,9 +65,18 @@ struct desktop_capture {
 	struct desktop* desktop;
 	struct wl_seat* seat;
 	bool render_cursor;
+
+	bool group_frames;
+	struct aml_timer* group_timer;
 };
 
 struct desktop* desktop_from_image_source(const struct image_source* source);
 
 struct desktop* desktop_new(struct wl_list* output_list);
 void desktop_destroy(struct desktop* self);
+
+/* When enabled, frames from all outputs are delivered together, so that
+ * clients always see a consistent desktop. Outputs that take too long are
+ * left out of the group.
+ */
+void desktop_capture_set_frame_grouping(struct screencopy* sc, bool enable);
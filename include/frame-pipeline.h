@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "damage-simplify.h"
+#include "tile-hash.h"
+#include "sys/queue.h"
+
+struct aml_timer;
+struct nvnc_display;
+struct pixman_region16;
+struct worker_pool;
+struct wv_buffer;
+struct frame_pipeline;
+
+#define MAX_CHANGE_DETECTION_CPUS 64
+
+enum change_detection {
+	CHANGE_DETECTION_AUTO = 0,
+	CHANGE_DETECTION_ON,
+	CHANGE_DETECTION_OFF,
+};
+
+enum frame_pipeline_latency {
+	FRAME_PIPELINE_LATENCY_PROCESS = 0,
+	FRAME_PIPELINE_LATENCY_RATE_LIMIT,
+	FRAME_PIPELINE_LATENCY_CHANGE_DETECTION,
+	FRAME_PIPELINE_LATENCY_TILE_HASH_STRIPE,
+};
+
+struct frame_pipeline_stats {
+	uint64_t n_sent;
+	// Frames that were replaced by a newer frame before they were sent
+	uint64_t n_coalesced;
+	// Frames that were handed back because nothing changed
+	uint64_t n_dropped;
+};
+
+struct frame_pipeline_display {
+	LIST_ENTRY(frame_pipeline_display) link;
+	struct frame_pipeline* pipeline;
+	struct nvnc_display* nvnc_display;
+
+	struct wv_buffer* next_frame;
+	uint64_t next_frame_time;
+
+	/* Each display is rate limited on its own so that outputs that commit
+	 * out of phase don't delay each other.
+	 */
+	struct aml_timer* rate_limiter;
+	uint64_t last_send_time;
+	uint64_t rate_limit_start_time;
+
+	/* Change detection is active while tile_hash.hashes is set */
+	struct tile_hash tile_hash;
+	int n_whole_damage_frames;
+};
+
+LIST_HEAD(frame_pipeline_display_list, frame_pipeline_display);
+
+/* Captured frames that are waiting for change detection to finish on an
+ * earlier frame. Frames are processed in the order that they were captured.
+ */
+struct pending_frame {
+	TAILQ_ENTRY(pending_frame) link;
+	struct frame_pipeline_display* display;
+	struct wv_buffer* buffer;
+};
+
+TAILQ_HEAD(pending_frame_queue, pending_frame);
+
+struct change_detection_job {
+	struct frame_pipeline* pipeline;
+	struct frame_pipeline_display* display;
+	struct wv_buffer* buffer;
+	int rows_per_stripe;
+	uint64_t start_time;
+};
+
+/* Takes captured frames through change detection, coalescing and rate limiting
+ * and feeds them to neatvnc displays.
+ */
+struct frame_pipeline {
+	int max_rate;
+	struct damage_simplify_config damage_simplify;
+	enum change_detection change_detection;
+	// 0 picks a number based on the number of CPUs
+	int n_change_detection_threads;
+	int change_detection_cpus[MAX_CHANGE_DETECTION_CPUS];
+	int n_change_detection_cpus;
+
+	struct frame_pipeline_stats stats;
+
+	// Called when the next frame should be captured
+	void (*start_capture)(struct frame_pipeline*);
+
+	/* Returns true if a client of the display is ready for a new frame.
+	 * Every client is assumed to keep up if this is not set.
+	 */
+	bool (*has_ready_client)(const struct frame_pipeline_display*);
+
+	/* Fills in the damage of a frame that is about to be fed, in the
+	 * coordinates of the frame that clients see. The damage of the buffer
+	 * is copied as is if this is not set.
+	 */
+	void (*get_damage)(struct frame_pipeline_display*, struct wv_buffer*,
+			struct pixman_region16* damage);
+
+	// Called after a frame has been fed, with the damage that was fed
+	void (*on_feed)(struct frame_pipeline_display*, struct wv_buffer*,
+			struct pixman_region16* damage);
+
+	void (*record_latency)(struct frame_pipeline*,
+			enum frame_pipeline_latency, uint64_t value);
+
+	void* userdata;
+
+	struct frame_pipeline_display_list displays;
+
+	// Created on first use
+	struct worker_pool* worker_pool;
+	bool no_worker_pool;
+	struct change_detection_job change_detection_job;
+	struct pending_frame_queue pending_frames;
+};
+
+void frame_pipeline_init(struct frame_pipeline* self);
+void frame_pipeline_deinit(struct frame_pipeline* self);
+
+int frame_pipeline_display_init(struct frame_pipeline_display* self,
+		struct frame_pipeline* pipeline,
+		struct nvnc_display* nvnc_display);
+void frame_pipeline_display_deinit(struct frame_pipeline_display* self);
+
+// Releases every frame of the display that has not been fed yet
+void frame_pipeline_display_reset(struct frame_pipeline_display* self);
+
+// Takes ownership of the buffer
+void frame_pipeline_submit(struct frame_pipeline* self,
+		struct frame_pipeline_display* display, struct wv_buffer* buffer);
+
+/* Sends frames that were held back for the clients. Call this when a client
+ * becomes ready for a new frame.
+ */
+void frame_pipeline_schedule(struct frame_pipeline* self);
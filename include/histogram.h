@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* A log-linear histogram in the style of HdrHistogram. Each power of two is
+ * split into 16 linear sub-buckets, which keeps the relative error of reported
+ * values under 6.25 %. Values are clamped to 32 bits, which is a bit over an
+ * hour when recording microseconds.
+ */
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_N_BUCKETS ((32 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+struct histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint32_t min;
+	uint32_t max;
+	uint32_t buckets[HISTOGRAM_N_BUCKETS];
+};
+
+void histogram_reset(struct histogram* self);
+void histogram_record(struct histogram* self, uint64_t value);
+
+uint32_t histogram_mean(const struct histogram* self);
+uint32_t histogram_percentile(const struct histogram* self, double percentile);
+
+/* Number of recorded values that are known to be no greater than value. Values
+ * that share a bucket with value are left out unless value is the upper bound
+ * of that bucket.
+ */
+uint64_t histogram_count_le(const struct histogram* self, uint64_t value);
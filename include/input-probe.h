@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pixman.h>
+
+#define INPUT_PROBE_SIZE 64
+
+// Events that have not shown up in a frame by then are given up on
+#define INPUT_PROBE_TIMEOUT_US 1000000
+
+/* Pointer events only count as visible when the damage of a frame comes
+ * within this many pixels of the pointer location.
+ */
+#define INPUT_PROBE_POINTER_RADIUS 16
+
+enum input_probe_kind {
+	INPUT_PROBE_POINTER = 0,
+	INPUT_PROBE_KEY,
+};
+
+struct input_probe_event {
+	uint64_t time;
+	enum input_probe_kind kind;
+	/* Pointer location relative to the whole framebuffer that clients see,
+	 * from 0 to 1
+	 */
+	double x, y;
+};
+
+struct input_probe_stats {
+	uint64_t n_matched;
+	// Events that no frame matched before the timeout
+	uint64_t n_expired;
+	// Events that were pushed out by newer events
+	uint64_t n_dropped;
+};
+
+/* Measures the time from input events until the first frame that may contain
+ * their effect is handed over to the VNC server. Pointer events are matched by
+ * frames whose damage covers the pointer location, key events by any frame
+ * that has damage.
+ */
+struct input_probe {
+	struct input_probe_event events[INPUT_PROBE_SIZE];
+	int n_events;
+	struct input_probe_stats stats;
+};
+
+typedef void (*input_probe_match_fn)(const struct input_probe_event* event,
+		uint64_t latency, void* userdata);
+
+/* Maps a pointer location from the framebuffer onto the frame, both from 0 to
+ * 1. Returns false if the location is not on the frame.
+ */
+typedef bool (*input_probe_map_fn)(double* x, double* y, void* userdata);
+
+void input_probe_init(struct input_probe* self);
+
+void input_probe_mark(struct input_probe* self, enum input_probe_kind kind,
+		double x, double y, uint64_t time);
+
+/* Matches pending events against a frame that is about to be fed. Only events
+ * that happened before the capture of the frame was started can be visible in
+ * it. A capture time of 0 means that it is unknown. map_point may be NULL if
+ * the frame covers the whole framebuffer.
+ */
+void input_probe_match(struct input_probe* self,
+		struct pixman_region16* damage, int width, int height,
+		uint64_t capture_time, uint64_t now, input_probe_map_fn map_point,
+		input_probe_match_fn on_match, void* userdata);
@@ -1,35 +0,0 @@
-/*
- * Copyright (c) 2020 Andri Yngvason
- *
- * Permission to use, copy, modify, and/or distribute this software for any
- * purpose with or without fee is hereby granted, provided that the above
- * copyright notice and this permission notice appear in all copies.
- *
- * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
- * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
- * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
- * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
- * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
- * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
- * PERFORMANCE OF THIS SOFTWARE.
- */
-
-#pragma once
-
-#include <unistd.h>
-#include <stdint.h>
-#include <stdbool.h>
-
-struct intset {
-	size_t cap;
-	size_t len;
-	int32_t* storage;
-};
-
-int intset_init(struct intset* self, size_t cap);
-void intset_destroy(struct intset* self);
-
-int intset_set(struct intset* self, int32_t value);
-void intset_clear(struct intset* self, int32_t value);
-
-bool intset_is_set(const struct intset* self, int32_t value);
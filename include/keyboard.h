@@ -21,24 +21,22 @@
 #include <stdbool.h>
 #include <neatvnc.h>
 
-#include "intset.h"
+#include "keyset.h"
 
 struct zwp_virtual_keyboard_v1;
-struct table_entry;
+struct keyboard_keymap;
 struct nvnc;
 
 struct keyboard {
 	struct zwp_virtual_keyboard_v1* virtual_keyboard;
 
-	struct xkb_context* context;
-	struct xkb_keymap* keymap;
+	/* Compiled keymap and lookup table, shared between all keyboards that
+	 * use the same rule names.
+	 */
+	struct keyboard_keymap* map;
 	struct xkb_state* state;
 
-	size_t lookup_table_size;
-	size_t lookup_table_length;
-	struct table_entry* lookup_table;
-
-	struct intset key_state;
+	struct keyset key_state;
 
 	int last_sent_group;
 };
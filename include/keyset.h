@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* A fixed size set of pressed keys, indexed by XKB key code. Evdev defines key
+ * codes up to 0x2ff and XKB codes are offset by 8 from those, so 1024 bits
+ * cover every key that a client can send.
+ */
+#define KEYSET_MAX_CODE 1024
+#define KEYSET_N_WORDS (KEYSET_MAX_CODE / 64)
+
+struct keyset {
+	uint64_t words[KEYSET_N_WORDS];
+};
+
+void keyset_init(struct keyset* self);
+
+/* Returns false if the code is out of range */
+bool keyset_set(struct keyset* self, uint32_t code);
+void keyset_clear(struct keyset* self, uint32_t code);
+bool keyset_is_set(const struct keyset* self, uint32_t code);
+
+bool keyset_is_empty(const struct keyset* self);
+int keyset_count(const struct keyset* self);
+
+/* Returns the lowest code in the set that is at least start, or -1 if there
+ * is none.
+ */
+int keyset_next(const struct keyset* self, uint32_t start);
+
+#define keyset_for_each(self, code) \
+	for (int code = keyset_next(self, 0); code >= 0; \
+			code = keyset_next(self, code + 1))
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct histogram;
+struct metrics_server;
+
+// Keeps scrapes from piling up; the oldest connection is dropped first
+#define METRICS_MAX_CLIENTS 8
+
+/* Text in the Prometheus exposition format. Labels are passed preformatted,
+ * e.g. `stage="capture"`, or as NULL.
+ */
+struct metrics_writer {
+	char* data;
+	size_t len;
+	size_t cap;
+	// Set if an allocation failed; the text is incomplete
+	int error;
+};
+
+void metrics_writer_init(struct metrics_writer* self);
+void metrics_writer_destroy(struct metrics_writer* self);
+
+void metrics_write_family(struct metrics_writer* self, const char* name,
+		const char* type, const char* help);
+void metrics_write_uint(struct metrics_writer* self, const char* name,
+		const char* labels, uint64_t value);
+void metrics_write_double(struct metrics_writer* self, const char* name,
+		const char* labels, double value);
+
+/* Writes the buckets, sum and count of a histogram of microseconds. They are
+ * exported in seconds, which is what Prometheus expects for durations.
+ */
+void metrics_write_histogram(struct metrics_writer* self, const char* name,
+		const char* labels, const struct histogram* histogram);
+
+typedef void (*metrics_collect_fn)(struct metrics_writer* writer,
+		void* userdata);
+
+/* Serves the text from the collect function over HTTP. The function is called
+ * once for each request from the main loop and should only read counters that
+ * are already being kept.
+ */
+struct metrics_server* metrics_server_new_unix(const char* path,
+		metrics_collect_fn collect, void* userdata);
+struct metrics_server* metrics_server_new_tcp(uint16_t port,
+		metrics_collect_fn collect, void* userdata);
+void metrics_server_destroy(struct metrics_server* self);
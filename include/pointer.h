@@ -17,10 +17,19 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <neatvnc.h>
 #include "wlr-virtual-pointer-unstable-v1.h"
 
 struct image_source;
+struct aml_idle;
+
+struct pointer_stats {
+	/* Pointer events received from VNC clients */
+	uint64_t n_received;
+	/* Pointer frames sent to the compositor */
+	uint64_t n_forwarded;
+};
 
 struct pointer {
 	struct nvnc* vnc;
@@ -28,8 +37,17 @@ struct pointer {
 
 	enum nvnc_button_mask current_mask;
 
-	uint32_t current_x;
-	uint32_t current_y;
+	double current_x;
+	double current_y;
+
+	/* Motion is held back until the event loop goes idle so that a burst
+	 * of motion events results in a single motion request.
+	 */
+	struct aml_idle* motion_idle;
+	bool has_pending_motion;
+	uint32_t pending_time;
+
+	struct pointer_stats* stats;
 };
 
 int pointer_init(struct pointer* self);
@@ -35,6 +35,14 @@ enum screencopy_capabilitites {
 	SCREENCOPY_CAP_TRANSFORM = 1 << 1,
 };
 
+struct screencopy_cursor_stats {
+	uint64_t n_frames;
+	// Frames that the compositor completed without any damage
+	uint64_t n_undamaged_frames;
+	// Captures that were started from the rate limiting timer
+	uint64_t n_timer_wakeups;
+};
+
 typedef void (*screencopy_done_fn)(enum screencopy_result,
 		struct wv_buffer* buffer, struct image_source* source,
 		void* userdata);
@@ -55,11 +63,19 @@ struct screencopy {
 	double rate_limit;
 	bool enable_linux_dmabuf;
 
+	/* Maximum number of captures in flight at once. Only wlr-screencopy
+	 * supports more than one.
+	 */
+	int queue_depth;
+
 	screencopy_done_fn on_done;
 	void (*cursor_enter)(void* userdata);
 	void (*cursor_leave)(void* userdata);
 	void (*cursor_hotspot)(int x, int y, void* userdata);
 
+	// Optional, only used by cursor captures
+	struct screencopy_cursor_stats* cursor_stats;
+
 	double (*rate_format)(const void* userdata, enum wv_buffer_type type,
 			uint32_t format, uint64_t modifier);
 
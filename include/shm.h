@@ -19,3 +19,18 @@
 #include <unistd.h>
 
 int shm_alloc_fd(size_t size);
+
+/* Allocate a read-only file holding a copy of data. Writes to the file are
+ * sealed where supported, so the same fd can safely be handed to multiple
+ * consumers.
+ */
+int shm_alloc_sealed_fd(const void* data, size_t size);
+
+/* Allocate memory backed by explicit huge pages. The size is rounded up to a
+ * multiple of the huge page size. Note that if no huge pages are available,
+ * this will not fail until the memory is mapped.
+ */
+int shm_alloc_hugetlb_fd(size_t* size);
+
+// Ask for transparent huge pages for a mapping
+void shm_advise_hugepages(void* addr, size_t size);
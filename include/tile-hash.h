@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct pixman_region16;
+
+#define TILE_HASH_SIZE 64
+
+enum tile_hash_state {
+	TILE_HASH_SKIP = 0,
+	TILE_HASH_CHECK,
+	TILE_HASH_UNCHANGED,
+	TILE_HASH_CHANGED,
+};
+
+/* Finds out which parts of a frame have actually changed, for compositors
+ * that report more damage than there is. A hash of each tile is kept from one
+ * frame to the next, and only the tiles that fall within the reported damage
+ * are hashed again.
+ *
+ * Processing a frame consists of three steps:
+ *  1. tile_hash_begin() marks the tiles that need to be checked.
+ *  2. tile_hash_update() hashes a range of tile rows. Disjoint ranges may be
+ *     processed concurrently.
+ *  3. tile_hash_end() replaces the damage with the tiles that changed.
+ */
+struct tile_hash {
+	int width, height;
+	int n_cols, n_rows;
+
+	/* Set once every tile has a hash from a previous frame */
+	bool is_valid;
+
+	uint64_t* hashes;
+	uint8_t* states;
+};
+
+int tile_hash_init(struct tile_hash* self, int width, int height);
+void tile_hash_deinit(struct tile_hash* self);
+
+void tile_hash_begin(struct tile_hash* self,
+		struct pixman_region16* damage);
+void tile_hash_update(struct tile_hash* self, const void* pixels, int stride,
+		int bytes_per_pixel, int row_begin, int row_end);
+void tile_hash_end(struct tile_hash* self, struct pixman_region16* damage);
+
+// Runs all of the above on the calling thread
+void tile_hash_apply(struct tile_hash* self, const void* pixels, int stride,
+		int bytes_per_pixel, struct pixman_region16* damage);
+
+// Hashes row_size bytes of each of the given rows
+uint64_t tile_hash_pixels(const void* pixels, int stride, size_t row_size,
+		int height);
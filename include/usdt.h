@@ -18,14 +18,55 @@
 
 #include "config.h"
 
+/* Static probes in the "wayvnc" provider. Arguments are only ever appended,
+ * so scripts that read a prefix of them keep working.
+ *
+ * Capture:
+ *   screencopy_start(capture, n_frames)
+ *   screencopy_damage(capture, x, y, width, height)
+ *   screencopy_ready(capture, present_time, buffer, damage_area)
+ *   screencopy_failed(capture, reason)
+ *   cursor_capture_start(capture)
+ *   cursor_capture_ready(capture, buffer, damage_area)
+ *   cursor_capture_failed(capture, reason)
+ *   desktop_group_add(capture, output, buffer)
+ *   desktop_group_timeout(capture)
+ *   desktop_group_flush(capture)
+ *
+ * Frame path:
+ *   frame_drop(buffer)
+ *   frame_coalesce(display, buffer, next_frame)
+ *   rate_limit_wait(display, next_frame, time_left)
+ *   rate_limit_done(display, next_frame)
+ *   change_detection_start(display, buffer)
+ *   change_detection_done(display, buffer, damage_area)
+ *   frame_feed(display, buffer, present_time, damage_area)
+ *
+ * Buffers:
+ *   buffer_alloc(pool, buffer, size)
+ *   buffer_pool_exhausted(pool, n_allocated)
+ *   buffer_acquire(pool, buffer, n_in_use)
+ *   buffer_release(pool, buffer, n_in_use)
+ *
+ * Input and control:
+ *   pointer_inject(pointer, button_mask)
+ *   keyboard_inject(keyboard, keycode, is_pressed)
+ *   input_probe_event(kind, time)
+ *   input_to_frame(kind, time, latency)
+ *   ctl_command_start(client, type)
+ *   ctl_command_done(client, type, code)
+ *
+ * Times are in microseconds from gettime_us().
+ */
+
 #ifdef HAVE_USDT
 #include <sys/sdt.h>
 #else
-#define DTRACE_PROBE(...)
-#define DTRACE_PROBE1(...)
-#define DTRACE_PROBE2(...)
-#define DTRACE_PROBE3(...)
-#define DTRACE_PROBE4(...)
-#define DTRACE_PROBE5(...)
-#define DTRACE_PROBE6(...)
+#define DTRACE_PROBE(...) do {} while (0)
+#define DTRACE_PROBE1(...) do {} while (0)
+#define DTRACE_PROBE2(...) do {} while (0)
+#define DTRACE_PROBE3(...) do {} while (0)
+#define DTRACE_PROBE4(...) do {} while (0)
+#define DTRACE_PROBE5(...) do {} while (0)
+#define DTRACE_PROBE6(...) do {} while (0)
 #endif
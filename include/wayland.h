@@ -19,6 +19,7 @@
 #include "observer.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 // TODO: Remove this once wl_list is replaced with queue.h
 #include <wayland-client-core.h>
 
@@ -66,12 +67,24 @@ enum wayland_flags {
 	WAYLAND_FLAG_ENABLE_TRANSIENT_SEAT = 1 << 2,
 };
 
+struct wayland_flush_stats {
+	/* Flushes that sent data */
+	uint64_t n_flushes;
+	uint64_t n_bytes;
+	/* Flushes that could not complete because the socket was full */
+	uint64_t n_blocked;
+};
+
 struct wayland {
 	bool is_initialising;
 	enum wayland_flags flags;
 
 	struct aml_handler* wl_handler;
 	struct wl_display* display;
+
+	/* Set while waiting for the socket to become writable */
+	bool is_flush_blocked;
+	struct wayland_flush_stats flush_stats;
 	struct wl_registry* registry;
 
 	struct wl_list outputs;
@@ -91,3 +104,9 @@ struct wayland {
 
 struct wayland* wayland_connect(const char* display, enum wayland_flags flags);
 void wayland_destroy(struct wayland* self);
+
+/* Send all requests that have been queued up. This should be called once per
+ * main loop iteration, so that requests from the same iteration are submitted
+ * together.
+ */
+void wayland_flush(struct wayland* self);
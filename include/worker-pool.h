@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct worker_pool;
+
+/* Called on a worker thread for each stripe of a job. Stripes are handed out
+ * in order, but may complete in any order.
+ */
+typedef void (*worker_pool_stripe_fn)(void* userdata, int stripe);
+
+/* Called on the main loop once all stripes of a job have been processed.
+ * stripe_times holds the time in µs that each stripe took to process.
+ */
+typedef void (*worker_pool_done_fn)(void* userdata,
+		const uint64_t* stripe_times, int n_stripes);
+
+/* Create a pool of n_threads threads. If n_cpus > 0, the threads are pinned
+ * to the given CPUs in a round-robin fashion.
+ */
+struct worker_pool* worker_pool_create(int n_threads, const int* cpus,
+		int n_cpus);
+void worker_pool_destroy(struct worker_pool* self);
+
+int worker_pool_get_n_threads(const struct worker_pool* self);
+
+/* Only one job can be running at a time */
+bool worker_pool_is_busy(const struct worker_pool* self);
+int worker_pool_run(struct worker_pool* self, int n_stripes,
+		worker_pool_stripe_fn stripe_fn, worker_pool_done_fn done_fn,
+		void* userdata);
+
+/* Block until all stripes of the running job have been processed. The done
+ * callback is still called from the main loop afterwards.
+ */
+void worker_pool_wait(struct worker_pool* self);
@@ -21,6 +21,7 @@
 #include <assert.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/param.h>
 #include <libdrm/drm_fourcc.h>
 #include <wayland-client.h>
 #include <pixman.h>
@@ -36,6 +37,8 @@
 #include "util.h"
 #include "strlcpy.h"
 #include "wayland.h"
+#include "time-util.h"
+#include "usdt.h"
 
 #ifdef ENABLE_SCREENCOPY_DMABUF
 #include <gbm.h>
@@ -49,16 +52,48 @@
 #endif // HAVE_LINUX_DMA_HEAP
 #endif // ENABLE_SCREENCOPY_DMABUF
 
+/* Neat VNC holds on to the last frame that it encoded and we need at least one
+ * buffer to capture into, along with one that may be in transit, so limiting
+ * the pool any further than this would stall capturing.
+ */
+#define MIN_POOL_BUFFERS 3
+#define MAX_WARMUP_BUFFERS 8
+
 extern struct wayland* wayland;
 
+LIST_HEAD(wv_buffer_pool_list, wv_buffer_pool);
+
+static struct wv_buffer_pool_list pool_list = LIST_HEAD_INITIALIZER(pool_list);
+static unsigned default_n_warmup = 0;
+static unsigned default_max_buffers = 0;
+static bool use_shm_hugepages = false;
+
 static void wv_buffer__handle_cleanup(void* userdata);
 
+static bool has_modifier(const uint64_t* modifiers, int n_modifiers,
+		uint64_t modifier)
+{
+	for (int i = 0; i < n_modifiers; ++i)
+		if (modifiers[i] == modifier)
+			return true;
+	return false;
+}
+
+// The order of modifiers does not matter to the allocator
 static bool modifiers_match(const uint64_t* a, int a_len, const uint64_t* b,
 		int b_len)
 {
 	if (a_len != b_len)
 		return false;
-	return a_len == 0 || memcmp(a, b, a_len) == 0;
+
+	if (a_len == 0 || memcmp(a, b, a_len * sizeof(*a)) == 0)
+		return true;
+
+	for (int i = 0; i < a_len; ++i)
+		if (!has_modifier(b, b_len, a[i]))
+			return false;
+
+	return true;
 }
 
 static bool buffer_configs_match(const struct wv_buffer_config* a,
@@ -77,6 +112,43 @@ static bool buffer_configs_match(const struct wv_buffer_config* a,
 			b->n_modifiers);
 }
 
+/* Buffers that were allocated for the old config can still be used with the
+ * new config if the memory layout is the same. SHM buffers only need a new
+ * wl_buffer if the format changes and DMA-BUFs can be kept as long as the
+ * allocated modifier is still allowed.
+ */
+static bool buffer_configs_compatible(const struct wv_buffer_config* old,
+		const struct wv_buffer_config* new)
+{
+	if (old->type != new->type || old->width != new->width ||
+			old->height != new->height)
+		return false;
+
+	switch (new->type) {
+	case WV_BUFFER_SHM:
+		return old->stride == new->stride &&
+			pixel_size_from_fourcc(old->format) ==
+			pixel_size_from_fourcc(new->format);
+#ifdef ENABLE_SCREENCOPY_DMABUF
+	case WV_BUFFER_DMABUF:;
+		if (old->format != new->format || old->node != new->node)
+			return false;
+
+		// Implicit modifiers can't be compared with explicit ones
+		if ((old->n_modifiers == 0) != (new->n_modifiers == 0))
+			return false;
+
+		for (int i = 0; i < old->n_modifiers; ++i)
+			if (!has_modifier(new->modifiers, new->n_modifiers,
+						old->modifiers[i]))
+				return false;
+		return true;
+#endif
+	case WV_BUFFER_UNSPEC:;
+	}
+	return false;
+}
+
 static void copy_buffer_config(struct wv_buffer_config* dst,
 		const struct wv_buffer_config* src)
 {
@@ -118,6 +190,55 @@ static void wv_buffer_handle_wayland_destroyed(struct observer* observer,
 	if (self->wl_buffer)
 		wl_buffer_destroy(self->wl_buffer);
 	self->wl_buffer = NULL;
+	if (self->shm_pool)
+		wl_shm_pool_destroy(self->shm_pool);
+	self->shm_pool = NULL;
+}
+
+void wv_buffer_set_shm_hugepages(bool enable)
+{
+	use_shm_hugepages = enable;
+}
+
+/* Explicit huge pages are tried first because they're guaranteed to be huge
+ * if the allocation succeeds. Otherwise, we fall back to regular memory and
+ * ask for transparent huge pages, which the kernel may or may not provide.
+ */
+static int wv_buffer_map_shm(struct wv_buffer* self)
+{
+	if (use_shm_hugepages) {
+		size_t size = self->size;
+		int fd = shm_alloc_hugetlb_fd(&size);
+		if (fd >= 0) {
+			void* pixels = mmap(NULL, size, PROT_READ | PROT_WRITE,
+					MAP_SHARED, fd, 0);
+			if (pixels != MAP_FAILED) {
+				self->pixels = pixels;
+				self->size = size;
+				return fd;
+			}
+			close(fd);
+		}
+
+		nvnc_trace("Explicit huge pages unavailable, falling back to transparent huge pages");
+	}
+
+	int fd = shm_alloc_fd(self->size);
+	if (fd < 0)
+		return -1;
+
+	self->pixels = mmap(NULL, self->size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if (self->pixels == MAP_FAILED) {
+		self->pixels = NULL;
+		close(fd);
+		return -1;
+	}
+
+	if (use_shm_hugepages)
+		shm_advise_hugepages(self->pixels, self->size);
+
+	return fd;
 }
 
 static struct wv_buffer* wv_buffer_create_shm(
@@ -137,23 +258,16 @@ static struct wv_buffer* wv_buffer_create_shm(
 	self->format = config->format;
 
 	self->size = config->height * config->stride;
-	int fd = shm_alloc_fd(self->size);
+	int fd = wv_buffer_map_shm(self);
 	if (fd < 0)
 		goto failure;
 
-	self->pixels = mmap(NULL, self->size, PROT_READ | PROT_WRITE,
-			MAP_SHARED, fd, 0);
-	if (!self->pixels)
-		goto mmap_failure;
-
-	struct wl_shm_pool* pool = wl_shm_create_pool(wayland->wl_shm, fd,
-			self->size);
-	if (!pool)
+	self->shm_pool = wl_shm_create_pool(wayland->wl_shm, fd, self->size);
+	if (!self->shm_pool)
 		goto pool_failure;
 
-	self->wl_buffer = wl_shm_pool_create_buffer(pool, 0, config->width,
-			config->height, config->stride, wl_fmt);
-	wl_shm_pool_destroy(pool);
+	self->wl_buffer = wl_shm_pool_create_buffer(self->shm_pool, 0,
+			config->width, config->height, config->stride, wl_fmt);
 	if (!self->wl_buffer)
 		goto shm_failure;
 
@@ -180,8 +294,9 @@ static struct wv_buffer* wv_buffer_create_shm(
 nvnc_buffer_failure:
 	wl_buffer_destroy(self->wl_buffer);
 shm_failure:
+	wl_shm_pool_destroy(self->shm_pool);
 pool_failure:
-mmap_failure:
+	munmap(self->pixels, self->size);
 	close(fd);
 failure:
 	free(self);
@@ -423,6 +538,8 @@ static struct wv_buffer* wv_buffer_create(const struct wv_buffer_config* config)
 
 static void wv_buffer_destroy_shm(struct wv_buffer* self)
 {
+	if (self->shm_pool)
+		wl_shm_pool_destroy(self->shm_pool);
 	munmap(self->pixels, self->size);
 	free(self);
 }
@@ -442,6 +559,14 @@ static void wv_buffer_destroy(struct wv_buffer* self)
 	if (self->link.le_next || self->link.le_prev)
 		LIST_REMOVE(self, link);
 
+	if (self->pool) {
+		struct wv_buffer_pool_stats* stats = &self->pool->stats;
+		stats->n_allocated--;
+		stats->n_bytes -= self->size;
+		if (self->nvnc_frame)
+			stats->n_in_use--;
+	}
+
 	pixman_region_fini(&self->buffer_damage);
 	pixman_region_fini(&self->frame_damage);
 
@@ -495,6 +620,15 @@ struct wv_buffer_pool* wv_buffer_pool_create(
 		return NULL;
 
 	LIST_INIT(&self->list);
+	LIST_INSERT_HEAD(&pool_list, self, link);
+	damage_ring_init(&self->damage);
+
+	self->n_warmup = MIN(default_n_warmup, MAX_WARMUP_BUFFERS);
+	self->max_buffers = default_max_buffers;
+	if (self->max_buffers && self->max_buffers < MIN_POOL_BUFFERS)
+		self->max_buffers = MIN_POOL_BUFFERS;
+
+	histogram_reset(&self->stats.alloc_latency);
 
 	if (config)
 		wv_buffer_pool_reconfig(self, config);
@@ -508,7 +642,10 @@ void wv_buffer_pool_destroy(struct wv_buffer_pool* pool)
 		struct wv_buffer* buffer = LIST_FIRST(&pool->list);
 		LIST_REMOVE(buffer, link);
 		memset(&buffer->link, 0, sizeof(buffer->link));
+		buffer->pool = NULL;
 	}
+	LIST_REMOVE(pool, link);
+	damage_ring_deinit(&pool->damage);
 	nvnc_buffer_pool_unref(pool->nvnc_pool);
 	free(pool->config.modifiers);
 #ifdef ENABLE_SCREENCOPY_DMABUF
@@ -618,6 +755,20 @@ static struct nvnc_buffer* wv_buffer_pool__alloc(
 		struct nvnc_buffer_pool* nvnc_pool)
 {
 	struct wv_buffer_pool* pool = nvnc_buffer_pool_get_userdata(nvnc_pool);
+	struct wv_buffer_pool_stats* stats = &pool->stats;
+
+	if (pool->max_buffers && stats->n_allocated >= pool->max_buffers) {
+		if (!pool->is_exhausted)
+			nvnc_log(NVNC_LOG_DEBUG, "Buffer pool exhausted: %"PRIu32" buffers in use",
+					stats->n_allocated);
+		pool->is_exhausted = true;
+		stats->n_exhausted++;
+		DTRACE_PROBE2(wayvnc, buffer_pool_exhausted, pool,
+				stats->n_allocated);
+		return NULL;
+	}
+
+	uint64_t start_time = gettime_us();
 #ifdef ENABLE_SCREENCOPY_DMABUF
 	struct wv_buffer* buffer = wv_buffer_create(&pool->config, pool->gbm);
 #else
@@ -626,16 +777,53 @@ static struct nvnc_buffer* wv_buffer_pool__alloc(
 	if (!buffer)
 		return NULL;
 
+	histogram_record(&stats->alloc_latency, gettime_us() - start_time);
+
 	LIST_INSERT_HEAD(&pool->list, buffer, link);
+	buffer->pool = pool;
+	buffer->damage_seq = pool->damage.seq;
+	stats->n_allocated++;
+	stats->n_bytes += buffer->size;
+	DTRACE_PROBE3(wayvnc, buffer_alloc, pool, buffer, buffer->size);
 	return buffer->buffer;
 }
 
+static void wv_buffer_pool_warm_up(struct wv_buffer_pool* pool)
+{
+	struct nvnc_buffer* buffers[MAX_WARMUP_BUFFERS];
+	unsigned n = 0;
+
+	uint64_t start_time = gettime_us();
+
+	for (; n < pool->n_warmup; ++n) {
+		buffers[n] = nvnc_buffer_pool_acquire(pool->nvnc_pool);
+		if (!buffers[n])
+			break;
+	}
+
+	// Unreferencing them puts them back into the pool
+	for (unsigned i = 0; i < n; ++i)
+		nvnc_buffer_unref(buffers[i]);
+
+	nvnc_log(NVNC_LOG_DEBUG, "Pre-allocated %u buffers in %"PRIu64" µs", n,
+			gettime_us() - start_time);
+}
+
 bool wv_buffer_pool_reconfig(struct wv_buffer_pool* pool,
 		const struct wv_buffer_config* config)
 {
 	if (buffer_configs_match(&pool->config, config))
 		return true;
 
+	if (pool->nvnc_pool &&
+			buffer_configs_compatible(&pool->config, config)) {
+		nvnc_log(NVNC_LOG_DEBUG, "Reconfiguring buffer pool, keeping buffers");
+		copy_buffer_config(&pool->config, config);
+		pool->stats.format = config->format;
+		pool->stats.n_reused++;
+		return true;
+	}
+
 	nvnc_log(NVNC_LOG_DEBUG, "Reconfiguring buffer pool");
 
 	nvnc_buffer_pool_unref(pool->nvnc_pool);
@@ -648,11 +836,43 @@ bool wv_buffer_pool_reconfig(struct wv_buffer_pool* pool,
 
 	copy_buffer_config(&pool->config, config);
 
+	pool->is_exhausted = false;
+	pool->stats.type = config->type;
+	pool->stats.width = config->width;
+	pool->stats.height = config->height;
+	pool->stats.format = config->format;
+
 #ifdef ENABLE_SCREENCOPY_DMABUF
-	return reconfig_render_node(pool, config, old_node);
-#else
-	return true;
+	if (!reconfig_render_node(pool, config, old_node))
+		return false;
 #endif
+
+	if (pool->n_warmup)
+		wv_buffer_pool_warm_up(pool);
+
+	return true;
+}
+
+static bool wv_buffer_recycle_shm(struct wv_buffer* self,
+		const struct wv_buffer_config* config)
+{
+	if (!self->shm_pool)
+		return false;
+
+	struct wl_buffer* wl_buffer = wl_shm_pool_create_buffer(self->shm_pool,
+			0, config->width, config->height, config->stride,
+			fourcc_to_wl_shm(config->format));
+	if (!wl_buffer)
+		return false;
+
+	wl_buffer_destroy(self->wl_buffer);
+	self->wl_buffer = wl_buffer;
+	self->format = config->format;
+
+	// Whatever the buffer contains is meaningless in the new format
+	pixman_region_union_rect(&self->buffer_damage, &self->buffer_damage,
+			0, 0, self->width, self->height);
+	return true;
 }
 
 struct wv_buffer* wv_buffer_pool_acquire(struct wv_buffer_pool* pool)
@@ -661,11 +881,34 @@ struct wv_buffer* wv_buffer_pool_acquire(struct wv_buffer_pool* pool)
 	if (!nvnc_buffer)
 		return NULL;
 
+	pool->is_exhausted = false;
+	pool->stats.n_in_use++;
+
 	struct wv_buffer* buffer = nvnc_buffer_get_userdata(nvnc_buffer);
 	assert(buffer);
 
 	struct wv_buffer_config* config = &pool->config;
 
+	/* Buffers that were kept through a reconfiguration get updated when
+	 * they're taken out of the pool because others may still be using
+	 * them until then.
+	 */
+	if (buffer->format != config->format) {
+		assert(buffer->type == WV_BUFFER_SHM);
+		if (!wv_buffer_recycle_shm(buffer, config)) {
+			nvnc_buffer_unref(nvnc_buffer);
+			pool->stats.n_in_use--;
+			return NULL;
+		}
+	}
+
+	if (!damage_ring_collect(&pool->damage, buffer->damage_seq,
+				&buffer->buffer_damage))
+		pixman_region_union_rect(&buffer->buffer_damage,
+				&buffer->buffer_damage, 0, 0, buffer->width,
+				buffer->height);
+	buffer->damage_seq = pool->damage.seq;
+
 	int bpp = pixel_size_from_fourcc(config->format);
 	assert(bpp > 0);
 
@@ -677,6 +920,8 @@ struct wv_buffer* wv_buffer_pool_acquire(struct wv_buffer_pool* pool)
 	// Ownership is passed over to nvnc_frame
 	nvnc_buffer_unref(nvnc_buffer);
 
+	DTRACE_PROBE3(wayvnc, buffer_acquire, pool, buffer,
+			pool->stats.n_in_use);
 	return buffer;
 }
 
@@ -687,14 +932,43 @@ void wv_buffer_release(struct wv_buffer* self)
 	pixman_region_clear(&self->frame_damage);
 	struct nvnc_frame* fb = self->nvnc_frame;
 	self->nvnc_frame = NULL;
+	if (fb && self->pool) {
+		self->pool->stats.n_in_use--;
+		DTRACE_PROBE3(wayvnc, buffer_release, self->pool, self,
+				self->pool->stats.n_in_use);
+	}
 	nvnc_frame_unref(fb);
 }
 
-void wv_buffer_pool_damage_all(struct wv_buffer_pool* self,
-		struct pixman_region16* region)
+bool wv_buffer_pool_is_exhausted(const struct wv_buffer_pool* pool)
+{
+	return pool->is_exhausted;
+}
+
+void wv_buffer_pool_set_default_limits(unsigned n_warmup,
+		unsigned max_buffers)
+{
+	default_n_warmup = n_warmup;
+	default_max_buffers = max_buffers;
+}
+
+struct wv_buffer_pool* wv_buffer_pool_first(void)
+{
+	return LIST_FIRST(&pool_list);
+}
+
+struct wv_buffer_pool* wv_buffer_pool_next(struct wv_buffer_pool* pool)
+{
+	return LIST_NEXT(pool, link);
+}
+
+/* Records the frame damage of a buffer that has just been captured into. Other
+ * buffers pick it up from the damage ring when they are acquired.
+ */
+void wv_buffer_pool_commit_damage(struct wv_buffer_pool* self,
+		struct wv_buffer* buffer)
 {
-	struct wv_buffer* buffer;
-	LIST_FOREACH(buffer, &self->list, link)
-		pixman_region_union(&buffer->buffer_damage,
-				&buffer->buffer_damage, region);
+	buffer->damage_seq = damage_ring_push(&self->damage,
+			&buffer->frame_damage);
+	pixman_region_clear(&buffer->buffer_damage);
 }
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "capture-scheduler.h"
+
+/* Frames that arrive further apart than this are not used to estimate the
+ * commit interval. The output was most likely idle in between.
+ */
+#define MAX_INTERVAL_US 1000000
+
+/* If the last presentation timestamp is older than this, its phase is no
+ * longer trusted and we just fall back to the rate limit.
+ */
+#define MAX_PTS_AGE_US 1000000
+
+/* How long after the expected commit a capture should be requested. */
+#define COMMIT_SLACK_US 1000
+
+void capture_scheduler_init(struct capture_scheduler* self)
+{
+	memset(self, 0, sizeof(*self));
+}
+
+void capture_scheduler_reset(struct capture_scheduler* self)
+{
+	self->last_pts = 0;
+	self->interval = 0;
+}
+
+void capture_scheduler_on_start(struct capture_scheduler* self, uint64_t now)
+{
+	self->last_start = now;
+}
+
+void capture_scheduler_on_present(struct capture_scheduler* self,
+		uint64_t pts)
+{
+	uint64_t last_pts = self->last_pts;
+
+	if (pts <= last_pts)
+		return;
+
+	self->last_pts = pts;
+
+	if (last_pts == 0)
+		return;
+
+	uint64_t delta = pts - last_pts;
+	if (delta > MAX_INTERVAL_US)
+		return;
+
+	if (self->interval == 0) {
+		self->interval = delta;
+		return;
+	}
+
+	/* When only damaged frames are captured, consecutive timestamps are
+	 * usually a whole number of commits apart, so the sample is divided by
+	 * the number of commits that it most likely spans.
+	 */
+	uint64_t n_commits = (delta + self->interval / 2) / self->interval;
+	if (n_commits > 1)
+		delta /= n_commits;
+
+	/* Exponential moving average with a weight of 1/8 for the new sample */
+	self->interval = (self->interval * 7 + delta) / 8;
+}
+
+uint64_t capture_scheduler_get_interval(const struct capture_scheduler* self)
+{
+	return self->interval;
+}
+
+int32_t capture_scheduler_get_delay(const struct capture_scheduler* self,
+		double rate_limit, uint64_t now)
+{
+	uint64_t period = rate_limit > 0 ? 1.0e6 / rate_limit : 0;
+	uint64_t earliest = self->last_start + period;
+	if (earliest < now)
+		earliest = now;
+
+	if (self->interval == 0 || self->last_pts == 0 ||
+			self->last_pts > now ||
+			now - self->last_pts > MAX_PTS_AGE_US)
+		return earliest - now;
+
+	uint64_t since_commit = earliest - self->last_pts;
+	uint64_t n_commits = (since_commit + self->interval - 1) / self->interval;
+	uint64_t target = self->last_pts + n_commits * self->interval
+		+ COMMIT_SLACK_US;
+
+	return target - now;
+}
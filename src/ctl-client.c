@@ -390,6 +390,64 @@ static void pretty_output_list(json_t* data)
 	}
 }
 
+static void pretty_histogram(const char* name, json_t* value)
+{
+	json_int_t count = 0, min = 0, mean = 0, p50 = 0, p90 = 0, p99 = 0,
+		   p999 = 0, max = 0;
+
+	json_unpack(value, "{s:I, s:I, s:I, s:I, s:I, s:I, s:I, s:I}",
+			"count", &count, "min", &min, "mean", &mean,
+			"p50", &p50, "p90", &p90, "p99", &p99,
+			"p99.9", &p999, "max", &max);
+	printf("%-14s %8" JSON_INTEGER_FORMAT " %8" JSON_INTEGER_FORMAT
+			" %8" JSON_INTEGER_FORMAT " %8" JSON_INTEGER_FORMAT
+			" %8" JSON_INTEGER_FORMAT " %8" JSON_INTEGER_FORMAT
+			" %8" JSON_INTEGER_FORMAT " %8" JSON_INTEGER_FORMAT
+			"\n", name, count, min, mean, p50, p90, p99, p999,
+			max);
+}
+
+static void pretty_perf_stats(json_t* data)
+{
+	printf("%-14s %8s %8s %8s %8s %8s %8s %8s %8s\n", "latency (us)",
+			"count", "min", "mean", "p50", "p90", "p99", "p99.9",
+			"max");
+
+	const char* key;
+	json_t* value;
+	json_object_foreach(json_object_get(data, "latency"), key, value)
+		pretty_histogram(key, value);
+
+	size_t i;
+	json_array_foreach(json_object_get(data, "buffer-pools"), i, value) {
+		const char* type = "?";
+		const char* format = "?";
+		int width = 0, height = 0, allocated = 0, in_use = 0,
+		    exhausted = 0;
+		json_int_t bytes = 0;
+		json_t* alloc_latency = NULL;
+
+		json_unpack(value, "{s:s, s:i, s:i, s:s, s:i, s:i, s:I, s:i, s:o}",
+				"type", &type, "width", &width,
+				"height", &height, "format", &format,
+				"allocated", &allocated, "in-use", &in_use,
+				"bytes", &bytes, "exhausted", &exhausted,
+				"alloc-latency", &alloc_latency);
+		printf("\nbuffer pool %zu: %s %dx%d %s, %d allocated, %d in use, %.1f MiB, exhausted %d times\n",
+				i, type, width, height, format, allocated,
+				in_use, bytes / 1048576.0, exhausted);
+		if (alloc_latency)
+			pretty_histogram("  alloc (us)", alloc_latency);
+	}
+
+	json_t* counters = json_object_get(data, "counters");
+	if (json_object_size(counters) > 0)
+		printf("\n");
+	json_object_foreach(counters, key, value)
+		printf("%-32s %" JSON_INTEGER_FORMAT "\n", key,
+				json_integer_value(value));
+}
+
 static void pretty_print(json_t* data,
 		struct jsonipc_request* request)
 {
@@ -404,6 +462,9 @@ static void pretty_print(json_t* data,
 	case CMD_OUTPUT_LIST:
 		pretty_output_list(data);
 		break;
+	case CMD_PERF_STATS:
+		pretty_perf_stats(data);
+		break;
 	case CMD_ATTACH:
 	case CMD_DETACH:
 	case CMD_CLIENT_DISCONNECT:
@@ -101,6 +101,10 @@ struct cmd_info ctl_command_list[] = {
 		"Disconnect all clients and shut down wayvnc",
 		{{}},
 	},
+	[CMD_PERF_STATS] = { "perf-stats",
+		"Return latency percentiles in microseconds since wayvnc was started",
+		{{}},
+	},
 };
 
 #define CLIENT_EVENT_PARAMS(including) \
@@ -154,6 +158,15 @@ struct cmd_info ctl_event_list[] = {
 			{}
 		}
 	},
+	[EVT_PERF_STATS] = {"perf-stats",
+		"Sent every second while VNC clients are connected, with latency percentiles in microseconds for the last second",
+		{
+			{ "latency", "Percentiles for capture, process, input, rate-limit, change-detection, tile-hash-stripe and input-to-frame", "<object>" },
+			{ "buffer-pools", "Frame buffer pool statistics", "<array>" },
+			{ "counters", "Event counters since start", "<object>" },
+			{}
+		}
+	},
 };
 
 enum cmd_type ctl_command_parse_name(const char* name)
@@ -37,6 +37,9 @@
 #include "util.h"
 #include "strlcpy.h"
 #include "image-source.h"
+#include "histogram.h"
+#include "buffer.h"
+#include "usdt.h"
 
 #define FAILED_TO(action) \
 	nvnc_log(NVNC_LOG_ERROR, "Failed to " action ": %m");
@@ -267,6 +270,7 @@ static struct cmd* parse_command(struct jsonipc_request* ipc,
 	case CMD_OUTPUT_LIST:
 	case CMD_OUTPUT_CYCLE:
 	case CMD_WAYVNC_EXIT:
+	case CMD_PERF_STATS:
 		cmd = calloc(1, sizeof(*cmd));
 		break;
 	case CMD_UNKNOWN:
@@ -488,6 +492,107 @@ static struct cmd_response* generate_output_list(struct ctl* self)
 	return response;
 }
 
+static json_t* pack_histogram(const struct histogram* hist)
+{
+	return json_pack("{s:I, s:I, s:I, s:I, s:I, s:I, s:I, s:I}",
+			"count", (json_int_t)hist->count,
+			"min", (json_int_t)hist->min,
+			"mean", (json_int_t)histogram_mean(hist),
+			"p50", (json_int_t)histogram_percentile(hist, 50),
+			"p90", (json_int_t)histogram_percentile(hist, 90),
+			"p99", (json_int_t)histogram_percentile(hist, 99),
+			"p99.9", (json_int_t)histogram_percentile(hist, 99.9),
+			"max", (json_int_t)hist->max);
+}
+
+static const char* buffer_type_name(enum wv_buffer_type type)
+{
+	switch (type) {
+	case WV_BUFFER_SHM:
+		return "shm";
+#ifdef ENABLE_SCREENCOPY_DMABUF
+	case WV_BUFFER_DMABUF:
+		return "dmabuf";
+#endif
+	case WV_BUFFER_UNSPEC:;
+	}
+	return "unspec";
+}
+
+static json_t* pack_perf_stats(const struct ctl_server_latency* stats,
+		int n_stats, const struct wv_buffer_pool_stats* pools,
+		int n_pools, const struct ctl_server_counter* counters,
+		int n_counters)
+{
+	json_t* latency = json_object();
+	for (int i = 0; i < n_stats; ++i)
+		json_object_set_new(latency, stats[i].name,
+				pack_histogram(stats[i].histogram));
+
+	json_t* buffer_pools = json_array();
+	for (int i = 0; i < n_pools; ++i) {
+		const struct wv_buffer_pool_stats* pool = &pools[i];
+		char format[5] = {};
+		for (int j = 0; j < 4; ++j)
+			format[j] = (pool->format >> (j * 8)) & 0xff;
+
+		json_array_append_new(buffer_pools, json_pack(
+				"{s:s, s:i, s:i, s:s, s:i, s:i, s:I, s:i, s:i, s:o}",
+				"type", buffer_type_name(pool->type),
+				"width", pool->width,
+				"height", pool->height,
+				"format", format,
+				"allocated", pool->n_allocated,
+				"in-use", pool->n_in_use,
+				"bytes", (json_int_t)pool->n_bytes,
+				"exhausted", pool->n_exhausted,
+				"reused", pool->n_reused,
+				"alloc-latency",
+				pack_histogram(&pool->alloc_latency)));
+	}
+
+	json_t* counter_obj = json_object();
+	for (int i = 0; i < n_counters; ++i)
+		json_object_set_new(counter_obj, counters[i].name,
+				json_integer(counters[i].value));
+
+	return json_pack("{s:o, s:o, s:o}", "latency", latency,
+			"buffer-pools", buffer_pools, "counters", counter_obj);
+}
+
+static struct cmd_response* generate_perf_stats(struct ctl* self)
+{
+	struct cmd_response* response = NULL;
+	struct ctl_server_latency* stats = NULL;
+	struct wv_buffer_pool_stats* pools = NULL;
+	struct ctl_server_counter* counters = NULL;
+
+	int n_stats = self->actions.get_latency_stats(self, &stats);
+	if (n_stats < 0)
+		goto failure;
+
+	int n_pools = self->actions.get_buffer_pool_stats(self, &pools);
+	if (n_pools < 0)
+		goto failure;
+
+	int n_counters = self->actions.get_counters(self, &counters);
+	if (n_counters < 0)
+		goto failure;
+
+	response = cmd_ok();
+	response->data = pack_perf_stats(stats, n_stats, pools, n_pools,
+			counters, n_counters);
+	goto out;
+
+failure:
+	response = cmd_failed("Out of memory");
+out:
+	free(counters);
+	free(pools);
+	free(stats);
+	return response;
+}
+
 static struct cmd_response* ctl_server_dispatch_cmd(struct ctl* self,
 		struct ctl_client* client, struct cmd* cmd)
 {
@@ -546,6 +651,9 @@ static struct cmd_response* ctl_server_dispatch_cmd(struct ctl* self,
 	case CMD_OUTPUT_CYCLE:
 		response = self->actions.on_output_cycle(self, OUTPUT_CYCLE_FORWARD);
 		break;
+	case CMD_PERF_STATS:
+		response = generate_perf_stats(self);
+		break;
 	case CMD_UNKNOWN:
 		break;
 	}
@@ -732,8 +840,11 @@ static void recv_ready(struct ctl_client* client)
 		// TODO: Enqueue the command (and request ID) to be
 		// handled by the main loop instead of doing the
 		// dispatch here
+		DTRACE_PROBE2(wayvnc, ctl_command_start, client, cmd->type);
 		struct cmd_response* response =
 			ctl_server_dispatch_cmd(server, client, cmd);
+		DTRACE_PROBE3(wayvnc, ctl_command_done, client, cmd->type,
+				response ? response->code : -1);
 		if (!response)
 			goto no_response;
 		client_enqueue_response(client, response, request->id);
@@ -1067,3 +1178,13 @@ void ctl_server_event_output_removed(struct ctl* self, const char* name)
 	ctl_server_enqueue_event(self, EVT_OUTPUT_REMOVED,
 			json_pack("{s:s}", "name", name));
 }
+
+void ctl_server_event_perf_stats(struct ctl* self,
+		const struct ctl_server_latency* stats, int n_stats,
+		const struct wv_buffer_pool_stats* pools, int n_pools,
+		const struct ctl_server_counter* counters, int n_counters)
+{
+	ctl_server_enqueue_event(self, EVT_PERF_STATS,
+			pack_perf_stats(stats, n_stats, pools, n_pools,
+				counters, n_counters));
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cursor-cache.h"
+#include "tile-hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <neatvnc.h>
+
+void cursor_cache_init(struct cursor_cache* self)
+{
+	memset(self, 0, sizeof(*self));
+}
+
+void cursor_cache_deinit(struct cursor_cache* self)
+{
+	for (int i = 0; i < CURSOR_CACHE_SIZE; ++i)
+		if (self->entries[i].frame)
+			nvnc_frame_unref(self->entries[i].frame);
+	cursor_cache_init(self);
+}
+
+void cursor_cache_reset(struct cursor_cache* self)
+{
+	self->current = NULL;
+}
+
+static bool entry_matches(const struct cursor_cache_entry* entry,
+		const struct cursor_image* image)
+{
+	return entry->frame && entry->width == image->width &&
+		entry->height == image->height &&
+		entry->format == image->format &&
+		entry->x_hotspot == image->x_hotspot &&
+		entry->y_hotspot == image->y_hotspot;
+}
+
+static struct cursor_cache_entry* cursor_cache_find(struct cursor_cache* self,
+		uint64_t hash, const struct cursor_image* image)
+{
+	for (int i = 0; i < CURSOR_CACHE_SIZE; ++i) {
+		struct cursor_cache_entry* entry = &self->entries[i];
+		if (entry->hash == hash && entry_matches(entry, image))
+			return entry;
+	}
+	return NULL;
+}
+
+static struct cursor_cache_entry* cursor_cache_evict(
+		struct cursor_cache* self)
+{
+	struct cursor_cache_entry* lru = &self->entries[0];
+
+	for (int i = 0; i < CURSOR_CACHE_SIZE; ++i) {
+		struct cursor_cache_entry* entry = &self->entries[i];
+		if (!entry->frame)
+			return entry;
+		if (entry->last_used < lru->last_used)
+			lru = entry;
+	}
+
+	nvnc_frame_unref(lru->frame);
+	lru->frame = NULL;
+	return lru;
+}
+
+static struct nvnc_frame* copy_image(const struct cursor_image* image)
+{
+	struct nvnc_frame* frame = nvnc_frame_new(image->width, image->height,
+			image->format, image->width);
+	if (!frame)
+		return NULL;
+
+	size_t row_size = (size_t)image->width * image->bytes_per_pixel;
+	uint8_t* dst = nvnc_frame_get_addr(frame);
+	const uint8_t* src = image->pixels;
+
+	for (int y = 0; y < image->height; ++y)
+		memcpy(dst + y * row_size, src + (size_t)y * image->stride,
+				row_size);
+
+	return frame;
+}
+
+enum cursor_cache_result cursor_cache_lookup(struct cursor_cache* self,
+		const struct cursor_image* image, bool is_damaged,
+		struct nvnc_frame** frame)
+{
+	struct cursor_cache_entry* current = self->current;
+
+	if (!is_damaged && current && entry_matches(current, image)) {
+		current->last_used = ++self->clock;
+		self->stats.n_unchanged++;
+		*frame = current->frame;
+		return CURSOR_CACHE_UNCHANGED;
+	}
+
+	uint64_t hash = tile_hash_pixels(image->pixels, image->stride,
+			(size_t)image->width * image->bytes_per_pixel,
+			image->height);
+
+	struct cursor_cache_entry* entry = cursor_cache_find(self, hash, image);
+	if (entry) {
+		enum cursor_cache_result result = CURSOR_CACHE_HIT;
+		if (entry == current) {
+			result = CURSOR_CACHE_UNCHANGED;
+			self->stats.n_unchanged++;
+		} else {
+			self->stats.n_hits++;
+		}
+
+		entry->last_used = ++self->clock;
+		self->current = entry;
+		*frame = entry->frame;
+		return result;
+	}
+
+	self->stats.n_misses++;
+
+	entry = cursor_cache_evict(self);
+	if (entry == current)
+		self->current = NULL;
+
+	entry->frame = copy_image(image);
+	if (!entry->frame)
+		return CURSOR_CACHE_ERROR;
+
+	entry->hash = hash;
+	entry->width = image->width;
+	entry->height = image->height;
+	entry->format = image->format;
+	entry->x_hotspot = image->x_hotspot;
+	entry->y_hotspot = image->y_hotspot;
+	entry->last_used = ++self->clock;
+
+	self->current = entry;
+	*frame = entry->frame;
+	return CURSOR_CACHE_MISS;
+}
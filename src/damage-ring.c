@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "damage-ring.h"
+
+#include <pixman.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+void damage_ring_init(struct damage_ring* self)
+{
+	for (int i = 0; i < DAMAGE_RING_SIZE; ++i)
+		pixman_region_init(&self->regions[i]);
+	self->seq = 0;
+}
+
+void damage_ring_deinit(struct damage_ring* self)
+{
+	for (int i = 0; i < DAMAGE_RING_SIZE; ++i)
+		pixman_region_fini(&self->regions[i]);
+}
+
+uint64_t damage_ring_push(struct damage_ring* self,
+		struct pixman_region16* damage)
+{
+	struct pixman_region16* slot =
+		&self->regions[self->seq % DAMAGE_RING_SIZE];
+	pixman_region_copy(slot, damage);
+	return ++self->seq;
+}
+
+bool damage_ring_collect(const struct damage_ring* self, uint64_t seq,
+		struct pixman_region16* dst)
+{
+	if (seq > self->seq || self->seq - seq > DAMAGE_RING_SIZE)
+		return false;
+
+	for (uint64_t i = seq; i < self->seq; ++i) {
+		// pixman does not take const regions
+		struct pixman_region16* region = (struct pixman_region16*)
+			&self->regions[i % DAMAGE_RING_SIZE];
+		pixman_region_union(dst, dst, region);
+	}
+
+	return true;
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "damage-simplify.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pixman.h>
+
+// Only look this far ahead for rectangles to merge with
+#define MERGE_WINDOW 8
+
+// Beyond this, merging is too slow to be worth it
+#define MAX_MERGE_RECTS 1024
+
+#define MAX_CAP_ROUNDS 3
+
+struct damage_box {
+	pixman_box16_t box;
+	/* The area that is actually damaged within the box */
+	uint64_t area;
+};
+
+static inline int min_int(int a, int b)
+{
+	return a < b ? a : b;
+}
+
+static inline int max_int(int a, int b)
+{
+	return a > b ? a : b;
+}
+
+static uint64_t box_area(const pixman_box16_t* box)
+{
+	return (uint64_t)(box->x2 - box->x1) * (uint64_t)(box->y2 - box->y1);
+}
+
+static pixman_box16_t box_union(const pixman_box16_t* a,
+		const pixman_box16_t* b)
+{
+	return (pixman_box16_t){
+		.x1 = min_int(a->x1, b->x1),
+		.y1 = min_int(a->y1, b->y1),
+		.x2 = max_int(a->x2, b->x2),
+		.y2 = max_int(a->y2, b->y2),
+	};
+}
+
+static void snap_to_tiles(struct pixman_region16* dst,
+		struct pixman_region16* src, int tile_size, int width,
+		int height)
+{
+	int n_rects = 0;
+	pixman_box16_t* rects = pixman_region_rectangles(src, &n_rects);
+
+	struct pixman_region16 result;
+	pixman_region_init(&result);
+
+	for (int i = 0; i < n_rects; ++i) {
+		int x1 = rects[i].x1 / tile_size * tile_size;
+		int y1 = rects[i].y1 / tile_size * tile_size;
+		int x2 = (rects[i].x2 + tile_size - 1) / tile_size * tile_size;
+		int y2 = (rects[i].y2 + tile_size - 1) / tile_size * tile_size;
+
+		pixman_region_union_rect(&result, &result, x1, y1,
+				min_int(x2, width) - x1,
+				min_int(y2, height) - y1);
+	}
+
+	pixman_region_copy(dst, &result);
+	pixman_region_fini(&result);
+}
+
+// The order is kept so that neighbours stay close to each other
+static void remove_box(struct damage_box* boxes, int* n, int index)
+{
+	memmove(&boxes[index], &boxes[index + 1],
+			(*n - index - 1) * sizeof(*boxes));
+	--*n;
+}
+
+static int64_t merge_cost(const struct damage_box* a,
+		const struct damage_box* b)
+{
+	pixman_box16_t box = box_union(&a->box, &b->box);
+	int64_t cost = (int64_t)box_area(&box) - (int64_t)box_area(&a->box) -
+		(int64_t)box_area(&b->box);
+	// Overlapping boxes can make this negative
+	return cost < 0 ? 0 : cost;
+}
+
+/* Neighbouring rectangles in pixman's y-x banded order are the most likely to
+ * be mergeable, so only a small window is searched for each rectangle.
+ */
+static void merge_by_overhead(struct damage_box* boxes, int* n,
+		uint32_t max_overhead)
+{
+	bool merged;
+	do {
+		merged = false;
+		for (int i = 0; i < *n; ++i) {
+			int end = min_int(*n, i + 1 + MERGE_WINDOW);
+			for (int j = i + 1; j < end; ++j) {
+				pixman_box16_t box = box_union(&boxes[i].box,
+						&boxes[j].box);
+				uint64_t area = boxes[i].area + boxes[j].area;
+				if (box_area(&box) * 100 > area * (100 + max_overhead))
+					continue;
+
+				boxes[i].box = box;
+				boxes[i].area = area;
+				remove_box(boxes, n, j);
+				end = min_int(*n, i + 1 + MERGE_WINDOW);
+				merged = true;
+				--j;
+			}
+		}
+	} while (merged);
+}
+
+static void merge_to_count(struct damage_box* boxes, int* n, int max_rects)
+{
+	while (*n > max_rects) {
+		int best_i = 0, best_j = 1;
+		int64_t best_cost = INT64_MAX;
+
+		for (int i = 0; i < *n; ++i) {
+			int end = min_int(*n, i + 1 + MERGE_WINDOW);
+			for (int j = i + 1; j < end; ++j) {
+				int64_t cost = merge_cost(&boxes[i], &boxes[j]);
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_i = i;
+					best_j = j;
+				}
+			}
+		}
+
+		boxes[best_i].box = box_union(&boxes[best_i].box,
+				&boxes[best_j].box);
+		boxes[best_i].area += boxes[best_j].area;
+		remove_box(boxes, n, best_j);
+	}
+}
+
+static void set_region_from_boxes(struct pixman_region16* dst,
+		struct damage_box* boxes, int n)
+{
+	pixman_region_clear(dst);
+	for (int i = 0; i < n; ++i)
+		pixman_region_union_rect(dst, dst, boxes[i].box.x1,
+				boxes[i].box.y1,
+				boxes[i].box.x2 - boxes[i].box.x1,
+				boxes[i].box.y2 - boxes[i].box.y1);
+}
+
+void damage_simplify(struct pixman_region16* dst, struct pixman_region16* src,
+		const struct damage_simplify_config* config, int width,
+		int height)
+{
+	if (config->tile_size)
+		snap_to_tiles(dst, src, config->tile_size, width, height);
+	else if (dst != src)
+		pixman_region_copy(dst, src);
+
+	if (!config->max_overhead && !config->max_rects)
+		return;
+
+	for (int round = 0; round < MAX_CAP_ROUNDS; ++round) {
+		int n = 0;
+		pixman_box16_t* rects = pixman_region_rectangles(dst, &n);
+		if (n <= 1)
+			return;
+
+		bool over_cap = config->max_rects && (uint32_t)n > config->max_rects;
+		if (round > 0 && !over_cap)
+			return;
+
+		if (n > MAX_MERGE_RECTS)
+			break;
+
+		struct damage_box* boxes = malloc(n * sizeof(*boxes));
+		if (!boxes) {
+			// The extents always cover the damage
+			pixman_box16_t extents = *pixman_region_extents(dst);
+			pixman_region_reset(dst, &extents);
+			return;
+		}
+
+		for (int i = 0; i < n; ++i) {
+			boxes[i].box = rects[i];
+			boxes[i].area = box_area(&rects[i]);
+		}
+
+		int n_boxes = n;
+		if (config->max_overhead)
+			merge_by_overhead(boxes, &n_boxes, config->max_overhead);
+		if (config->max_rects)
+			merge_to_count(boxes, &n_boxes, config->max_rects);
+
+		/* pixman splits overlapping boxes into bands again, so this
+		 * may end up with more rectangles than were asked for.
+		 */
+		set_region_from_boxes(dst, boxes, n_boxes);
+		free(boxes);
+	}
+
+	if (config->max_rects &&
+			(uint32_t)pixman_region_n_rects(dst) > config->max_rects) {
+		pixman_box16_t extents = *pixman_region_extents(dst);
+		pixman_region_reset(dst, &extents);
+	}
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "damage-trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pixman.h>
+
+#define MAGIC "WVDT"
+#define HEADER_SIZE 8
+#define FRAME_HEADER_SIZE 38
+#define RECT_SIZE 8
+
+struct damage_trace {
+	FILE* file;
+};
+
+static void put_u16(uint8_t* dst, uint16_t value)
+{
+	dst[0] = value;
+	dst[1] = value >> 8;
+}
+
+static void put_u32(uint8_t* dst, uint32_t value)
+{
+	put_u16(dst, value);
+	put_u16(dst + 2, value >> 16);
+}
+
+static void put_u64(uint8_t* dst, uint64_t value)
+{
+	put_u32(dst, value);
+	put_u32(dst + 4, value >> 32);
+}
+
+static uint16_t get_u16(const uint8_t* src)
+{
+	return src[0] | src[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t* src)
+{
+	return get_u16(src) | (uint32_t)get_u16(src + 2) << 16;
+}
+
+static uint64_t get_u64(const uint8_t* src)
+{
+	return get_u32(src) | (uint64_t)get_u32(src + 4) << 32;
+}
+
+struct damage_trace* damage_trace_create(const char* path)
+{
+	struct damage_trace* self = calloc(1, sizeof(*self));
+	if (!self)
+		return NULL;
+
+	self->file = fopen(path, "wb");
+	if (!self->file)
+		goto failure;
+
+	uint8_t header[HEADER_SIZE];
+	memcpy(header, MAGIC, 4);
+	put_u32(header + 4, DAMAGE_TRACE_VERSION);
+
+	if (fwrite(header, sizeof(header), 1, self->file) != 1) {
+		fclose(self->file);
+		goto failure;
+	}
+
+	return self;
+
+failure:
+	free(self);
+	return NULL;
+}
+
+static int read_header(struct damage_trace* self)
+{
+	uint8_t header[HEADER_SIZE];
+	if (fread(header, sizeof(header), 1, self->file) != 1)
+		return -1;
+
+	if (memcmp(header, MAGIC, 4) != 0 ||
+			get_u32(header + 4) != DAMAGE_TRACE_VERSION)
+		return -1;
+
+	return 0;
+}
+
+struct damage_trace* damage_trace_open(const char* path)
+{
+	struct damage_trace* self = calloc(1, sizeof(*self));
+	if (!self)
+		return NULL;
+
+	self->file = fopen(path, "rb");
+	if (!self->file)
+		goto failure;
+
+	if (read_header(self) < 0) {
+		fclose(self->file);
+		goto failure;
+	}
+
+	return self;
+
+failure:
+	free(self);
+	return NULL;
+}
+
+int damage_trace_close(struct damage_trace* self)
+{
+	if (!self)
+		return 0;
+
+	int rc = fclose(self->file) == 0 ? 0 : -1;
+	free(self);
+	return rc;
+}
+
+int damage_trace_write(struct damage_trace* self,
+		const struct damage_trace_frame* frame)
+{
+	int n_rects = 0;
+	pixman_box16_t* rects = pixman_region_rectangles(frame->damage,
+			&n_rects);
+
+	// The extents cover damage with more rectangles than can be recorded
+	pixman_box16_t extents;
+	if (n_rects > UINT16_MAX) {
+		extents = *pixman_region_extents(frame->damage);
+		rects = &extents;
+		n_rects = 1;
+	}
+
+	uint8_t header[FRAME_HEADER_SIZE];
+	put_u64(header, frame->capture_time);
+	put_u64(header + 8, frame->present_time);
+	put_u64(header + 16, frame->done_time);
+	put_u16(header + 24, frame->width);
+	put_u16(header + 26, frame->height);
+	put_u32(header + 28, frame->format);
+	put_u32(header + 32, frame->source);
+	put_u16(header + 36, n_rects);
+
+	if (fwrite(header, sizeof(header), 1, self->file) != 1)
+		return -1;
+
+	for (int i = 0; i < n_rects; ++i) {
+		uint8_t rect[RECT_SIZE];
+		put_u16(rect, rects[i].x1);
+		put_u16(rect + 2, rects[i].y1);
+		put_u16(rect + 4, rects[i].x2 - rects[i].x1);
+		put_u16(rect + 6, rects[i].y2 - rects[i].y1);
+
+		if (fwrite(rect, sizeof(rect), 1, self->file) != 1)
+			return -1;
+	}
+
+	return 0;
+}
+
+int damage_trace_read(struct damage_trace* self,
+		struct damage_trace_frame* frame)
+{
+	uint8_t header[FRAME_HEADER_SIZE];
+	size_t n = fread(header, 1, sizeof(header), self->file);
+	if (n == 0 && feof(self->file))
+		return 0;
+	if (n != sizeof(header))
+		return -1;
+
+	frame->capture_time = get_u64(header);
+	frame->present_time = get_u64(header + 8);
+	frame->done_time = get_u64(header + 16);
+	frame->width = get_u16(header + 24);
+	frame->height = get_u16(header + 26);
+	frame->format = get_u32(header + 28);
+	frame->source = get_u32(header + 32);
+	int n_rects = get_u16(header + 36);
+
+	pixman_region_clear(frame->damage);
+
+	for (int i = 0; i < n_rects; ++i) {
+		uint8_t rect[RECT_SIZE];
+		if (fread(rect, sizeof(rect), 1, self->file) != 1)
+			return -1;
+
+		pixman_region_union_rect(frame->damage, frame->damage,
+				get_u16(rect), get_u16(rect + 2),
+				get_u16(rect + 4), get_u16(rect + 6));
+	}
+
+	return 1;
+}
+
+int damage_trace_rewind(struct damage_trace* self)
+{
+	if (fseek(self->file, 0, SEEK_SET) < 0)
+		return -1;
+	return read_header(self);
+}
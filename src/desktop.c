@@ -17,6 +17,8 @@
 #include "desktop.h"
 #include "output.h"
 #include "wayland.h"
+#include "buffer.h"
+#include "usdt.h"
 
 #include <assert.h>
 #include <math.h>
@@ -24,6 +26,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <neatvnc.h>
+#include <aml.h>
+#include <pixman.h>
 
 static void desktop_capture_handle_done(enum screencopy_result result,
 		struct wv_buffer* buffer, struct image_source* source,
@@ -251,6 +255,7 @@ static struct desktop_output *desktop_output_create(struct output* output,
 
 static void desktop_output_destroy(struct desktop_output* self)
 {
+	wv_buffer_release(self->pending_frame);
 	screencopy_destroy(self->sc);
 	screencopy_destroy(self->cursor_sc);
 	observer_deinit(&self->power_change_observer);
@@ -358,15 +363,105 @@ struct desktop* desktop_new(struct wl_list* output_list)
 
 struct screencopy_impl desktop_capture_impl;
 
+static struct desktop_output* desktop_output_find_by_source(
+		struct desktop* desktop, const struct image_source* source)
+{
+	struct desktop_output* output;
+	LIST_FOREACH(output, &desktop->outputs, link)
+		if (&output->output->image_source == source)
+			return output;
+	return NULL;
+}
+
+static void desktop_capture_flush_group(struct desktop_capture* self)
+{
+	aml_stop(aml_get_default(), self->group_timer);
+	DTRACE_PROBE1(wayvnc, desktop_group_flush, self);
+
+	struct desktop_output* output;
+	LIST_FOREACH(output, &self->desktop->outputs, link) {
+		struct wv_buffer* buffer = output->pending_frame;
+		output->is_idle = !buffer ||
+			!pixman_region_not_empty(&buffer->frame_damage);
+		if (!buffer)
+			continue;
+
+		output->pending_frame = NULL;
+		self->base.on_done(SCREENCOPY_DONE, buffer,
+				&output->output->image_source,
+				self->base.userdata);
+	}
+}
+
+static bool desktop_capture_is_group_complete(struct desktop_capture* self)
+{
+	struct desktop_output* output;
+	LIST_FOREACH(output, &self->desktop->outputs, link)
+		if (output->is_capturing && !output->is_idle)
+			return false;
+	return true;
+}
+
+static void desktop_capture_handle_group_timeout(struct aml_timer* timer)
+{
+	struct desktop_capture* self = aml_get_userdata(timer);
+	nvnc_trace("Frame group timed out");
+	DTRACE_PROBE1(wayvnc, desktop_group_timeout, self);
+	desktop_capture_flush_group(self);
+}
+
+static void desktop_capture_add_to_group(struct desktop_capture* self,
+		struct desktop_output* output, struct wv_buffer* buffer)
+{
+	if (output->pending_frame) {
+		pixman_region_union(&buffer->frame_damage, &buffer->frame_damage,
+				&output->pending_frame->frame_damage);
+		wv_buffer_release(output->pending_frame);
+	}
+	output->pending_frame = buffer;
+	DTRACE_PROBE3(wayvnc, desktop_group_add, self, output, buffer);
+
+	if (desktop_capture_is_group_complete(self)) {
+		desktop_capture_flush_group(self);
+		return;
+	}
+
+	if (aml_is_started(aml_get_default(), self->group_timer))
+		return;
+
+	// Other outputs get half a frame interval to catch up
+	double rate_limit = self->base.rate_limit > 0 ?
+		self->base.rate_limit : 30;
+	aml_set_duration(self->group_timer, 500000.0 / rate_limit);
+	aml_start(aml_get_default(), self->group_timer);
+}
+
 static void desktop_capture_handle_done(enum screencopy_result result,
 		struct wv_buffer* buffer, struct image_source* source,
 		void* userdata)
 {
 	struct desktop_capture* self = userdata;
+	struct desktop* desktop = self->desktop;
+
+	struct desktop_output* output = NULL;
+	if (desktop && self == desktop->capture)
+		output = desktop_output_find_by_source(desktop, source);
+
+	if (output)
+		output->is_capturing = false;
+
+	if (output && self->group_frames && result == SCREENCOPY_DONE) {
+		desktop_capture_add_to_group(self, output, buffer);
+		return;
+	}
 
 	// TODO: Maybe extra handling is needed for failures here?
 
 	self->base.on_done(result, buffer, source, self->base.userdata);
+
+	if (output && self->group_frames &&
+			desktop_capture_is_group_complete(self))
+		desktop_capture_flush_group(self);
 }
 
 static double desktop_capture_rate_format(const void* userdata,
@@ -390,8 +485,16 @@ static struct screencopy* desktop_capture_create(struct image_source* source,
 
 	self->base.impl = &desktop_capture_impl;
 	self->base.rate_limit = 30;
+	self->base.queue_depth = 1;
 	self->render_cursor = render_cursor;
 
+	self->group_timer = aml_timer_new(0,
+			desktop_capture_handle_group_timeout, self, NULL);
+	if (!self->group_timer) {
+		free(self);
+		return NULL;
+	}
+
 	struct desktop* desktop = desktop_from_image_source(source);
 	self->desktop = desktop;
 
@@ -424,6 +527,7 @@ static struct screencopy* desktop_capture_create_cursor(
 
 	self->base.impl = &desktop_capture_impl;
 	self->base.rate_limit = 30;
+	self->base.queue_depth = 1;
 
 	struct desktop* desktop = desktop_from_image_source(source);
 	self->desktop = desktop;
@@ -465,6 +569,11 @@ static void desktop_capture_destroy(struct screencopy* base)
 {
 	struct desktop_capture* self = (struct desktop_capture*)base;
 
+	if (self->group_timer) {
+		aml_stop(aml_get_default(), self->group_timer);
+		aml_unref(self->group_timer);
+	}
+
 	struct desktop* desktop = self->desktop;
 	if (desktop && desktop->capture == self) {
 		desktop->capture = NULL;
@@ -473,6 +582,9 @@ static void desktop_capture_destroy(struct screencopy* base)
 		LIST_FOREACH(desktop_output, &desktop->outputs, link) {
 			screencopy_destroy(desktop_output->sc);
 			desktop_output->sc = NULL;
+			wv_buffer_release(desktop_output->pending_frame);
+			desktop_output->pending_frame = NULL;
+			desktop_output->is_capturing = false;
 		}
 	}
 
@@ -506,13 +618,23 @@ static int desktop_capture_start(struct screencopy* base, bool immediate)
 			sc = desktop_output->cursor_sc;
 		}
 
+		/* An output that is waiting for the rest of its group gets
+		 * restarted when the group is delivered.
+		 */
+		if (self == desktop->capture && desktop_output->pending_frame)
+			continue;
+
 		sc->rate_limit = base->rate_limit;
 		sc->enable_linux_dmabuf = base->enable_linux_dmabuf;
+		sc->queue_depth = base->queue_depth;
 
 		int rc = screencopy_start(sc, immediate);
 		if (rc != 0) {
 			return -1;
 		}
+
+		if (self == desktop->capture)
+			desktop_output->is_capturing = true;
 	}
 
 	return 0;
@@ -535,7 +657,23 @@ static void desktop_capture_stop(struct screencopy* base)
 			sc = desktop_output->cursor_sc;
 		}
 		screencopy_stop(sc);
+
+		if (self == desktop->capture) {
+			wv_buffer_release(desktop_output->pending_frame);
+			desktop_output->pending_frame = NULL;
+			desktop_output->is_capturing = false;
+		}
 	}
+
+	if (self->group_timer)
+		aml_stop(aml_get_default(), self->group_timer);
+}
+
+void desktop_capture_set_frame_grouping(struct screencopy* base, bool enable)
+{
+	assert(base->impl == &desktop_capture_impl);
+	struct desktop_capture* self = (struct desktop_capture*)base;
+	self->group_frames = enable;
 }
 
 static enum screencopy_capabilitites desktop_capture_get_caps(
@@ -42,6 +42,7 @@
 #include "image-source.h"
 #include "output.h"
 #include "toplevel.h"
+#include "capture-scheduler.h"
 
 struct format_entry {
 	double score;
@@ -68,6 +69,7 @@ struct ext_image_copy_capture {
 	bool have_constraints;
 	bool should_start;
 	bool is_cursor_session;
+	bool last_frame_damaged;
 	uint32_t frame_count;
 
 	uint32_t width, height;
@@ -80,7 +82,7 @@ struct ext_image_copy_capture {
 
 	struct { int x, y; } hotspot;
 
-	uint64_t last_time;
+	struct capture_scheduler scheduler;
 	struct aml_timer* timer;
 };
 
@@ -207,12 +209,26 @@ static void ext_image_copy_capture_schedule_capture(
 	config_buffers(self);
 
 	self->buffer = wv_buffer_pool_acquire(self->pool);
+	if (!self->buffer && wv_buffer_pool_is_exhausted(self->pool)) {
+		/* Other buffers are still held by clients, so we try again
+		 * after a while instead of failing.
+		 */
+		nvnc_trace("Buffer pool exhausted, deferring %scapture",
+				self->is_cursor_session ? "cursor " : "");
+		aml_set_duration(self->timer,
+				1000000.0 / MAX(self->parent.rate_limit, 1.0));
+		aml_start(aml_get_default(), self->timer);
+		return;
+	}
 	if (!self->buffer) {
 		self->parent.on_done(SCREENCOPY_FATAL, NULL, self->image_source,
 				self->parent.userdata);
 		return;
 	}
 
+	// The compositor might not send a presentation time
+	self->buffer->present_time = 0;
+
 	self->frame = ext_image_copy_capture_session_v1_create_frame(self->session);
 	assert(self->frame);
 
@@ -237,6 +253,11 @@ static void ext_image_copy_capture_schedule_capture(
 
 	ext_image_copy_capture_frame_v1_capture(self->frame);
 
+	if (self->is_cursor_session)
+		DTRACE_PROBE1(wayvnc, cursor_capture_start, self);
+	else
+		DTRACE_PROBE2(wayvnc, screencopy_start, self, 1);
+
 #ifndef NDEBUG
 	float damage_area = calculate_region_area(&self->buffer->buffer_damage);
 	float pixel_area = self->buffer->width * self->buffer->height;
@@ -245,7 +266,7 @@ static void ext_image_copy_capture_schedule_capture(
 			100.0 * damage_area / pixel_area);
 #endif
 
-	self->last_time = now;
+	capture_scheduler_on_start(&self->scheduler, now);
 }
 
 static void ext_image_copy_capture_schedule_from_timer(struct aml_timer* timer)
@@ -253,6 +274,8 @@ static void ext_image_copy_capture_schedule_from_timer(struct aml_timer* timer)
 	struct ext_image_copy_capture* self = aml_get_userdata(timer);
 	assert(self);
 	uint64_t now = gettime_us();
+	if (self->parent.cursor_stats)
+		self->parent.cursor_stats->n_timer_wakeups++;
 	ext_image_copy_capture_schedule_capture(self, now);
 }
 
@@ -543,16 +566,33 @@ static void frame_handle_ready(void *data,
 
 	assert(self->buffer);
 
-	wv_buffer_pool_damage_all(self->pool, &self->buffer->frame_damage);
-	pixman_region_clear(&self->buffer->buffer_damage);
+	wv_buffer_pool_commit_damage(self->pool, self->buffer);
 
 	struct wv_buffer* buffer = self->buffer;
 	self->buffer = NULL;
 
 	buffer->x_hotspot = self->hotspot.x;
 	buffer->y_hotspot = self->hotspot.y;
+	buffer->capture_time = self->scheduler.last_start;
 
 	self->frame_count++;
+	self->last_frame_damaged =
+		pixman_region_not_empty(&buffer->frame_damage);
+
+	if (self->is_cursor_session)
+		DTRACE_PROBE3(wayvnc, cursor_capture_ready, self, buffer,
+				calculate_region_area(&buffer->frame_damage));
+	else
+		DTRACE_PROBE4(wayvnc, screencopy_ready, self,
+				buffer->present_time, buffer,
+				calculate_region_area(&buffer->frame_damage));
+
+	struct screencopy_cursor_stats* stats = self->parent.cursor_stats;
+	if (stats) {
+		stats->n_frames++;
+		if (!self->last_frame_damaged)
+			stats->n_undamaged_frames++;
+	}
 
 	self->parent.on_done(SCREENCOPY_DONE, buffer, self->image_source,
 			self->parent.userdata);
@@ -570,6 +610,11 @@ static void frame_handle_failed(void *data,
 
 	nvnc_log(NVNC_LOG_DEBUG, "Failed!\n");
 
+	if (self->is_cursor_session)
+		DTRACE_PROBE2(wayvnc, cursor_capture_failed, self, reason);
+	else
+		DTRACE_PROBE2(wayvnc, screencopy_failed, self, reason);
+
 	assert(self->buffer);
 
 	wv_buffer_release(self->buffer);
@@ -591,6 +636,9 @@ static void frame_handle_damage(void *data,
 	struct ext_image_copy_capture* self = data;
 
 	nvnc_trace("Got frame damage: %dx%d", width, height);
+	if (!self->is_cursor_session)
+		DTRACE_PROBE5(wayvnc, screencopy_damage, self, x, y, width,
+				height);
 	wv_buffer_damage_rect(self->buffer, x, y, width, height);
 }
 
@@ -604,6 +652,9 @@ static void frame_handle_presentation_time(void *data,
 	uint64_t pts = sec * UINT64_C(1000000) + (uint64_t)nsec / UINT64_C(1000);
 	nvnc_trace("Setting buffer pts: %" PRIu64, pts);
 	nvnc_frame_set_pts(self->buffer->nvnc_frame, pts);
+	self->buffer->present_time = pts;
+
+	capture_scheduler_on_present(&self->scheduler, pts);
 }
 
 static struct ext_image_copy_capture_session_v1_listener session_listener = {
@@ -642,7 +693,10 @@ static void cursor_handle_leave(void* data,
 static void cursor_handle_position(void* data,
 		struct ext_image_copy_capture_cursor_session_v1* cursor, int x, int y)
 {
-	// Don't care
+	/* The position is not a reason to capture. It is the image that
+	 * matters, and the compositor tells us when it changes by completing
+	 * the frame that is waiting for damage.
+	 */
 }
 
 static void cursor_handle_hotspot(void* data,
@@ -656,6 +710,15 @@ static void cursor_handle_hotspot(void* data,
 		self->parent.cursor_hotspot(x, y, self->parent.userdata);
 
 	nvnc_trace("Got hotspot at %d, %d", x, y);
+
+	/* A new hotspot usually comes with a new cursor image, so a capture
+	 * that is being held back by the rate limiter is started right away.
+	 */
+	if (!self->frame && self->have_constraints &&
+			aml_is_started(aml_get_default(), self->timer)) {
+		aml_stop(aml_get_default(), self->timer);
+		ext_image_copy_capture_schedule_capture(self, gettime_us());
+	}
 }
 
 static struct ext_image_copy_capture_cursor_session_v1_listener cursor_listener = {
@@ -685,11 +748,22 @@ static int ext_image_copy_capture_start(struct screencopy* ptr, bool immediate)
 	}
 
 	uint64_t now = gettime_us();
-	double dt = (now - self->last_time) * 1.0e-6;
-	int32_t time_left = (1.0 / ptr->rate_limit - dt) * 1.0e6;
+
+	/* The compositor holds on to a cursor frame until the cursor image
+	 * changes, so there is nothing to gain from delaying the next one.
+	 * Only frames that came back without damage are rate limited, in case
+	 * the compositor also completes frames when the cursor just moves.
+	 */
+	if (self->is_cursor_session && self->last_frame_damaged) {
+		aml_stop(aml_get_default(), self->timer);
+		ext_image_copy_capture_schedule_capture(self, now);
+		return 0;
+	}
+	int32_t time_left = capture_scheduler_get_delay(&self->scheduler,
+			ptr->rate_limit, now);
 
 	if (time_left > 0) {
-		nvnc_trace("Scheduling %scapture after %"PRIu64" µs",
+		nvnc_trace("Scheduling %scapture after %"PRId32" µs",
 				self->is_cursor_session ? "cursor " : "",
 				time_left);
 		aml_set_duration(self->timer, time_left);
@@ -709,6 +783,9 @@ static void ext_image_copy_capture_stop(struct screencopy* base)
 
 	ext_image_copy_capture_deinit_session(self);
 	self->frame_count = 0;
+	self->last_frame_damaged = false;
+
+	capture_scheduler_reset(&self->scheduler);
 }
 
 static struct screencopy* ext_image_copy_capture_create(
@@ -720,10 +797,13 @@ static struct screencopy* ext_image_copy_capture_create(
 
 	self->parent.impl = &ext_image_copy_capture_impl;
 	self->parent.rate_limit = 30;
+	self->parent.queue_depth = 1;
 
 	self->image_source = source;
 	self->render_cursors = render_cursor;
 
+	capture_scheduler_init(&self->scheduler);
+
 	self->timer = aml_timer_new(0,
 			ext_image_copy_capture_schedule_from_timer, self, NULL);
 	assert(self->timer);
@@ -748,10 +828,13 @@ static struct screencopy* ext_image_copy_capture_create_cursor(
 
 	self->parent.impl = &ext_image_copy_capture_impl;
 	self->parent.rate_limit = 30;
+	self->parent.queue_depth = 1;
 
 	self->image_source = source;
 	self->wl_seat = seat;
 
+	capture_scheduler_init(&self->scheduler);
+
 	self->timer = aml_timer_new(0,
 			ext_image_copy_capture_schedule_from_timer, self, NULL);
 	self->is_cursor_session = true;
@@ -0,0 +1,539 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <aml.h>
+#include <neatvnc.h>
+#include <pixman.h>
+
+#include "frame-pipeline.h"
+#include "buffer.h"
+#include "pixels.h"
+#include "time-util.h"
+#include "worker-pool.h"
+#include "usdt.h"
+
+/* If no client is ready for a new frame within this time, the frame is sent
+ * anyway, so that a client that never asks for updates can't stall capturing.
+ */
+#define FRAME_PACING_TIMEOUT_US 500000
+
+/* With change_detection=auto, tile hashing is turned on for a display once the
+ * compositor has reported whole-frame damage for this many frames in a row.
+ */
+#define CHANGE_DETECTION_AUTO_FRAMES 30
+
+#define DEFAULT_CHANGE_DETECTION_THREADS 4
+
+static void frame_pipeline_process_frame(struct frame_pipeline* self,
+		struct frame_pipeline_display* display, struct wv_buffer* buffer);
+static void frame_pipeline_process_pending_frames(struct frame_pipeline* self);
+
+static void record_latency(struct frame_pipeline* self,
+		enum frame_pipeline_latency type, uint64_t value)
+{
+	if (self->record_latency)
+		self->record_latency(self, type, value);
+}
+
+static void start_capture(struct frame_pipeline* self)
+{
+	if (self->start_capture)
+		self->start_capture(self);
+}
+
+/* Frames without damage have nothing for neatvnc to encode, so they are
+ * handed straight back to the buffer pool. The first frame on a display is
+ * always fed, so that there is something to show to clients.
+ */
+static bool frame_pipeline_display_should_drop(
+		const struct frame_pipeline_display* display,
+		struct pixman_region16* damage)
+{
+	return display->last_send_time != 0 &&
+		!pixman_region_not_empty(damage);
+}
+
+static void frame_pipeline_drop_frame(struct frame_pipeline* self,
+		struct wv_buffer* buffer)
+{
+	nvnc_trace("Dropping frame without damage: %p", buffer);
+	DTRACE_PROBE1(wayvnc, frame_drop, buffer);
+	self->stats.n_dropped++;
+	wv_buffer_release(buffer);
+}
+
+static void frame_pipeline_display_send_next_frame(
+		struct frame_pipeline_display* display, uint64_t now)
+{
+	struct frame_pipeline* self = display->pipeline;
+	struct wv_buffer* buffer = display->next_frame;
+	display->next_frame = NULL;
+
+	if (!buffer)
+		return;
+
+	struct pixman_region16 damage;
+	pixman_region_init(&damage);
+
+	if (self->get_damage)
+		self->get_damage(display, buffer, &damage);
+	else
+		pixman_region_copy(&damage, &buffer->frame_damage);
+
+	pixman_region_intersect_rect(&damage, &damage, 0, 0, buffer->width,
+			buffer->height);
+
+	if (damage_simplify_is_enabled(&self->damage_simplify))
+		damage_simplify(&damage, &damage, &self->damage_simplify,
+				buffer->width, buffer->height);
+
+	if (frame_pipeline_display_should_drop(display, &damage)) {
+		pixman_region_fini(&damage);
+		start_capture(self);
+		frame_pipeline_drop_frame(self, buffer);
+		return;
+	}
+
+	nvnc_frame_set_damage(buffer->nvnc_frame, &damage);
+
+	DTRACE_PROBE4(wayvnc, frame_feed, display, buffer, buffer->present_time,
+			calculate_region_area(&damage));
+	nvnc_display_feed_frame(display->nvnc_display, buffer->nvnc_frame);
+	self->stats.n_sent++;
+
+	if (self->on_feed)
+		self->on_feed(display, buffer, &damage);
+	pixman_region_fini(&damage);
+
+	record_latency(self, FRAME_PIPELINE_LATENCY_PROCESS,
+			now - display->next_frame_time);
+
+	start_capture(self);
+
+	wv_buffer_release(buffer);
+
+	display->last_send_time = now;
+}
+
+static bool frame_pipeline_display_has_ready_client(
+		const struct frame_pipeline_display* display)
+{
+	const struct frame_pipeline* self = display->pipeline;
+	return !self->has_ready_client || self->has_ready_client(display);
+}
+
+static void frame_pipeline_display_schedule_next_frame(
+		struct frame_pipeline_display* display)
+{
+	struct frame_pipeline* self = display->pipeline;
+	uint64_t now = gettime_us();
+	double dt = (now - display->last_send_time) * 1.0e-6;
+
+	double min_interval = frame_pipeline_display_has_ready_client(display) ?
+		1.0 / self->max_rate : FRAME_PACING_TIMEOUT_US * 1.0e-6;
+	int32_t time_left = (min_interval - dt) * 1.0e6;
+
+	aml_stop(aml_get_default(), display->rate_limiter);
+
+	if (time_left > 0) {
+		DTRACE_PROBE3(wayvnc, rate_limit_wait, display,
+				display->next_frame, time_left);
+		display->rate_limit_start_time = now;
+		aml_set_duration(display->rate_limiter, time_left);
+		aml_start(aml_get_default(), display->rate_limiter);
+	} else {
+		record_latency(self, FRAME_PIPELINE_LATENCY_RATE_LIMIT, 0);
+		frame_pipeline_display_send_next_frame(display, now);
+	}
+}
+
+void frame_pipeline_schedule(struct frame_pipeline* self)
+{
+	struct frame_pipeline_display* display;
+	LIST_FOREACH(display, &self->displays, link)
+		if (display->next_frame)
+			frame_pipeline_display_schedule_next_frame(display);
+}
+
+static void on_rate_limit_timeout(struct aml_timer* timer)
+{
+	struct frame_pipeline_display* display = aml_get_userdata(timer);
+	uint64_t now = gettime_us();
+	DTRACE_PROBE2(wayvnc, rate_limit_done, display, display->next_frame);
+	record_latency(display->pipeline, FRAME_PIPELINE_LATENCY_RATE_LIMIT,
+			now - display->rate_limit_start_time);
+	frame_pipeline_display_send_next_frame(display, now);
+}
+
+static bool is_damage_whole(struct pixman_region16* damage, int width,
+		int height)
+{
+	pixman_box16_t* extents = pixman_region_extents(damage);
+	return pixman_region_n_rects(damage) == 1 &&
+		extents->x1 <= 0 && extents->y1 <= 0 &&
+		extents->x2 >= width && extents->y2 >= height;
+}
+
+static bool frame_pipeline_display_wants_change_detection(
+		struct frame_pipeline_display* display,
+		struct wv_buffer* buffer)
+{
+	if (buffer->type != WV_BUFFER_SHM)
+		return false;
+
+	switch (display->pipeline->change_detection) {
+	case CHANGE_DETECTION_ON:
+		return true;
+	case CHANGE_DETECTION_OFF:
+		return false;
+	case CHANGE_DETECTION_AUTO:
+		break;
+	}
+
+	if (!is_damage_whole(&buffer->frame_damage, buffer->width,
+				buffer->height)) {
+		display->n_whole_damage_frames = 0;
+		return false;
+	}
+
+	if (display->n_whole_damage_frames < CHANGE_DETECTION_AUTO_FRAMES)
+		display->n_whole_damage_frames++;
+
+	return display->n_whole_damage_frames >= CHANGE_DETECTION_AUTO_FRAMES;
+}
+
+static struct worker_pool* frame_pipeline_get_worker_pool(
+		struct frame_pipeline* self)
+{
+	if (self->worker_pool || self->no_worker_pool)
+		return self->worker_pool;
+
+	int n_threads = self->n_change_detection_threads;
+	if (n_threads == 0) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		// There is nothing to gain from worker threads on a single CPU
+		if (n_cpus <= 1) {
+			self->no_worker_pool = true;
+			return NULL;
+		}
+		n_threads = MIN(n_cpus, DEFAULT_CHANGE_DETECTION_THREADS);
+	}
+
+	self->worker_pool = worker_pool_create(n_threads,
+			self->change_detection_cpus,
+			self->n_change_detection_cpus);
+	if (!self->worker_pool) {
+		self->no_worker_pool = true;
+		return NULL;
+	}
+
+	nvnc_log(NVNC_LOG_DEBUG, "Hashing tiles on %d worker threads",
+			n_threads);
+	return self->worker_pool;
+}
+
+static bool frame_pipeline_is_detecting_changes(struct frame_pipeline* self)
+{
+	return self->worker_pool && worker_pool_is_busy(self->worker_pool);
+}
+
+/* Returns true if the damage of the frame should be checked for tiles that
+ * didn't actually change.
+ */
+static bool frame_pipeline_display_prepare_change_detection(
+		struct frame_pipeline_display* display,
+		struct wv_buffer* buffer)
+{
+	struct tile_hash* tile_hash = &display->tile_hash;
+
+	if (!frame_pipeline_display_wants_change_detection(display, buffer)) {
+		if (tile_hash->hashes) {
+			nvnc_log(NVNC_LOG_DEBUG, "Disabling change detection");
+			tile_hash_deinit(tile_hash);
+		}
+		return false;
+	}
+
+	if (tile_hash->hashes && (tile_hash->width != buffer->width ||
+				tile_hash->height != buffer->height))
+		tile_hash_deinit(tile_hash);
+
+	if (!tile_hash->hashes) {
+		nvnc_log(NVNC_LOG_DEBUG, "Enabling change detection");
+		if (tile_hash_init(tile_hash, buffer->width,
+					buffer->height) < 0)
+			return false;
+	}
+
+	return true;
+}
+
+static void on_change_detection_stripe(void* userdata, int stripe)
+{
+	struct change_detection_job* job = userdata;
+	struct wv_buffer* buffer = job->buffer;
+	struct tile_hash* tile_hash = &job->display->tile_hash;
+
+	int row_begin = stripe * job->rows_per_stripe;
+	int row_end = MIN(row_begin + job->rows_per_stripe, tile_hash->n_rows);
+
+	tile_hash_update(tile_hash, buffer->pixels, buffer->stride,
+			pixel_size_from_fourcc(buffer->format), row_begin,
+			row_end);
+}
+
+static void on_change_detection_done(void* userdata,
+		const uint64_t* stripe_times, int n_stripes)
+{
+	struct change_detection_job* job = userdata;
+	struct frame_pipeline* self = job->pipeline;
+	struct frame_pipeline_display* display = job->display;
+	struct wv_buffer* buffer = job->buffer;
+
+	job->display = NULL;
+	job->buffer = NULL;
+
+	for (int i = 0; i < n_stripes; ++i)
+		record_latency(self, FRAME_PIPELINE_LATENCY_TILE_HASH_STRIPE,
+				stripe_times[i]);
+
+	// The display is gone if it was reset while the job was running
+	if (display) {
+		tile_hash_end(&display->tile_hash, &buffer->frame_damage);
+		DTRACE_PROBE3(wayvnc, change_detection_done, display, buffer,
+				calculate_region_area(&buffer->frame_damage));
+		record_latency(self, FRAME_PIPELINE_LATENCY_CHANGE_DETECTION,
+				gettime_us() - job->start_time);
+		frame_pipeline_process_frame(self, display, buffer);
+	}
+
+	frame_pipeline_process_pending_frames(self);
+}
+
+/* Narrow down the reported damage to the tiles that actually changed. Returns
+ * false if the frame has been handed over to the worker pool, in which case it
+ * is processed once the job is done.
+ */
+static bool frame_pipeline_detect_changes(struct frame_pipeline* self,
+		struct frame_pipeline_display* display, struct wv_buffer* buffer)
+{
+	if (!frame_pipeline_display_prepare_change_detection(display, buffer))
+		return true;
+
+	struct tile_hash* tile_hash = &display->tile_hash;
+	struct worker_pool* pool = frame_pipeline_get_worker_pool(self);
+	uint64_t start_time = gettime_us();
+
+	DTRACE_PROBE2(wayvnc, change_detection_start, display, buffer);
+	tile_hash_begin(tile_hash, &buffer->frame_damage);
+
+	if (pool) {
+		// A couple of stripes per thread evens out the load
+		int n_stripes = MIN(tile_hash->n_rows,
+				worker_pool_get_n_threads(pool) * 2);
+		int rows_per_stripe = (tile_hash->n_rows + n_stripes - 1) /
+			n_stripes;
+		n_stripes = (tile_hash->n_rows + rows_per_stripe - 1) /
+			rows_per_stripe;
+
+		struct change_detection_job* job = &self->change_detection_job;
+		job->pipeline = self;
+		job->display = display;
+		job->buffer = buffer;
+		job->rows_per_stripe = rows_per_stripe;
+		job->start_time = start_time;
+
+		if (worker_pool_run(pool, n_stripes, on_change_detection_stripe,
+					on_change_detection_done, job) == 0)
+			return false;
+
+		job->display = NULL;
+		job->buffer = NULL;
+	}
+
+	tile_hash_update(tile_hash, buffer->pixels, buffer->stride,
+			pixel_size_from_fourcc(buffer->format), 0,
+			tile_hash->n_rows);
+	tile_hash_end(tile_hash, &buffer->frame_damage);
+	DTRACE_PROBE3(wayvnc, change_detection_done, display, buffer,
+			calculate_region_area(&buffer->frame_damage));
+	record_latency(self, FRAME_PIPELINE_LATENCY_CHANGE_DETECTION,
+			gettime_us() - start_time);
+	return true;
+}
+
+static void frame_pipeline_process_frame(struct frame_pipeline* self,
+		struct frame_pipeline_display* display, struct wv_buffer* buffer)
+{
+	nvnc_trace("Processing buffer: %p", buffer);
+
+	uint64_t now = gettime_us();
+
+	if (frame_pipeline_display_should_drop(display, &buffer->frame_damage)) {
+		// A pending frame restarts capturing once it has been sent
+		if (!display->next_frame)
+			start_capture(self);
+		frame_pipeline_drop_frame(self, buffer);
+		return;
+	}
+
+	bool have_pending_frame = false;
+	if (display->next_frame) {
+		pixman_region_union(&buffer->frame_damage,
+				&buffer->frame_damage,
+				&display->next_frame->frame_damage);
+		DTRACE_PROBE3(wayvnc, frame_coalesce, display, buffer,
+				display->next_frame);
+		wv_buffer_release(display->next_frame);
+		self->stats.n_coalesced++;
+		have_pending_frame = true;
+	}
+	display->next_frame = buffer;
+	display->next_frame_time = now;
+
+	if (have_pending_frame)
+		return;
+
+	frame_pipeline_display_schedule_next_frame(display);
+}
+
+static void frame_pipeline_handle_frame(struct frame_pipeline* self,
+		struct frame_pipeline_display* display, struct wv_buffer* buffer)
+{
+	if (frame_pipeline_detect_changes(self, display, buffer))
+		frame_pipeline_process_frame(self, display, buffer);
+}
+
+static void frame_pipeline_process_pending_frames(struct frame_pipeline* self)
+{
+	while (!frame_pipeline_is_detecting_changes(self) &&
+			!TAILQ_EMPTY(&self->pending_frames)) {
+		struct pending_frame* frame = TAILQ_FIRST(&self->pending_frames);
+		TAILQ_REMOVE(&self->pending_frames, frame, link);
+		frame_pipeline_handle_frame(self, frame->display,
+				frame->buffer);
+		free(frame);
+	}
+}
+
+static void frame_pipeline_queue_frame(struct frame_pipeline* self,
+		struct frame_pipeline_display* display, struct wv_buffer* buffer)
+{
+	struct pending_frame* frame = calloc(1, sizeof(*frame));
+	if (!frame) {
+		nvnc_log(NVNC_LOG_ERROR, "OOM");
+		wv_buffer_release(buffer);
+		return;
+	}
+
+	frame->display = display;
+	frame->buffer = buffer;
+	TAILQ_INSERT_TAIL(&self->pending_frames, frame, link);
+}
+
+void frame_pipeline_submit(struct frame_pipeline* self,
+		struct frame_pipeline_display* display, struct wv_buffer* buffer)
+{
+	// Frames are processed in order
+	if (frame_pipeline_is_detecting_changes(self) ||
+			!TAILQ_EMPTY(&self->pending_frames))
+		frame_pipeline_queue_frame(self, display, buffer);
+	else
+		frame_pipeline_handle_frame(self, display, buffer);
+}
+
+void frame_pipeline_init(struct frame_pipeline* self)
+{
+	LIST_INIT(&self->displays);
+	TAILQ_INIT(&self->pending_frames);
+}
+
+void frame_pipeline_deinit(struct frame_pipeline* self)
+{
+	while (!LIST_EMPTY(&self->displays))
+		frame_pipeline_display_deinit(LIST_FIRST(&self->displays));
+
+	worker_pool_destroy(self->worker_pool);
+	self->worker_pool = NULL;
+}
+
+int frame_pipeline_display_init(struct frame_pipeline_display* self,
+		struct frame_pipeline* pipeline,
+		struct nvnc_display* nvnc_display)
+{
+	self->rate_limiter = aml_timer_new(0, on_rate_limit_timeout, self,
+			NULL);
+	if (!self->rate_limiter)
+		return -1;
+
+	self->pipeline = pipeline;
+	self->nvnc_display = nvnc_display;
+	LIST_INSERT_HEAD(&pipeline->displays, self, link);
+	return 0;
+}
+
+void frame_pipeline_display_reset(struct frame_pipeline_display* self)
+{
+	struct frame_pipeline* pipeline = self->pipeline;
+	if (!pipeline)
+		return;
+
+	struct change_detection_job* job = &pipeline->change_detection_job;
+	if (job->display == self) {
+		// The done callback picks up from here
+		worker_pool_wait(pipeline->worker_pool);
+		wv_buffer_release(job->buffer);
+		job->display = NULL;
+		job->buffer = NULL;
+
+		// The hashes are from a frame that was never sent
+		tile_hash_deinit(&self->tile_hash);
+	}
+
+	struct pending_frame* frame;
+	struct pending_frame* tmp;
+	TAILQ_FOREACH_SAFE(frame, &pipeline->pending_frames, link, tmp) {
+		if (frame->display != self)
+			continue;
+
+		TAILQ_REMOVE(&pipeline->pending_frames, frame, link);
+		wv_buffer_release(frame->buffer);
+		free(frame);
+	}
+
+	aml_stop(aml_get_default(), self->rate_limiter);
+
+	if (self->next_frame) {
+		wv_buffer_release(self->next_frame);
+		self->next_frame = NULL;
+	}
+}
+
+void frame_pipeline_display_deinit(struct frame_pipeline_display* self)
+{
+	if (!self->pipeline)
+		return;
+
+	frame_pipeline_display_reset(self);
+	LIST_REMOVE(self, link);
+	aml_unref(self->rate_limiter);
+	self->rate_limiter = NULL;
+	tile_hash_deinit(&self->tile_hash);
+	self->pipeline = NULL;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+#define SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define SUB_MASK (SUB_COUNT - 1)
+
+static int bucket_index(uint32_t value)
+{
+	if (value < 2 * SUB_COUNT)
+		return value;
+
+	int exponent = 31 - __builtin_clz(value);
+	int shift = exponent - HISTOGRAM_SUB_BITS;
+	return ((shift + 1) << HISTOGRAM_SUB_BITS) + ((value >> shift) & SUB_MASK);
+}
+
+static uint32_t bucket_upper_bound(int index)
+{
+	if (index < 2 * SUB_COUNT)
+		return index;
+
+	int shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+	uint64_t lower = (uint64_t)(SUB_COUNT + (index & SUB_MASK)) << shift;
+	uint64_t upper = lower + (UINT64_C(1) << shift) - 1;
+	return upper > UINT32_MAX ? UINT32_MAX : upper;
+}
+
+void histogram_reset(struct histogram* self)
+{
+	memset(self, 0, sizeof(*self));
+}
+
+void histogram_record(struct histogram* self, uint64_t value)
+{
+	uint32_t clamped = value > UINT32_MAX ? UINT32_MAX : value;
+
+	if (self->count == 0 || clamped < self->min)
+		self->min = clamped;
+	if (clamped > self->max)
+		self->max = clamped;
+
+	self->count++;
+	self->sum += clamped;
+	self->buckets[bucket_index(clamped)]++;
+}
+
+uint32_t histogram_mean(const struct histogram* self)
+{
+	return self->count ? self->sum / self->count : 0;
+}
+
+uint32_t histogram_percentile(const struct histogram* self, double percentile)
+{
+	if (self->count == 0)
+		return 0;
+
+	uint64_t target = percentile * self->count / 100.0 + 0.5;
+	if (target < 1)
+		target = 1;
+	if (target > self->count)
+		target = self->count;
+
+	uint64_t sum = 0;
+	for (int i = 0; i < HISTOGRAM_N_BUCKETS; ++i) {
+		sum += self->buckets[i];
+		if (sum < target)
+			continue;
+
+		uint32_t value = bucket_upper_bound(i);
+		if (value > self->max)
+			value = self->max;
+		if (value < self->min)
+			value = self->min;
+		return value;
+	}
+
+	return self->max;
+}
+
+uint64_t histogram_count_le(const struct histogram* self, uint64_t value)
+{
+	if (value >= UINT32_MAX)
+		return self->count;
+
+	uint64_t sum = 0;
+	for (int i = 0; i < HISTOGRAM_N_BUCKETS; ++i) {
+		if (bucket_upper_bound(i) > value)
+			break;
+		sum += self->buckets[i];
+	}
+	return sum;
+}
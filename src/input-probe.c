@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "input-probe.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pixman.h>
+
+void input_probe_init(struct input_probe* self)
+{
+	memset(self, 0, sizeof(*self));
+}
+
+// Events are kept in the order in which they happened
+static void expire_events(struct input_probe* self, uint64_t now)
+{
+	int n = 0;
+	while (n < self->n_events &&
+			now - self->events[n].time > INPUT_PROBE_TIMEOUT_US)
+		++n;
+
+	if (n == 0)
+		return;
+
+	memmove(self->events, self->events + n,
+			(self->n_events - n) * sizeof(*self->events));
+	self->n_events -= n;
+	self->stats.n_expired += n;
+}
+
+void input_probe_mark(struct input_probe* self, enum input_probe_kind kind,
+		double x, double y, uint64_t time)
+{
+	expire_events(self, time);
+
+	if (self->n_events == INPUT_PROBE_SIZE) {
+		memmove(self->events, self->events + 1,
+				(INPUT_PROBE_SIZE - 1) * sizeof(*self->events));
+		self->n_events--;
+		self->stats.n_dropped++;
+	}
+
+	self->events[self->n_events++] = (struct input_probe_event){
+		.time = time,
+		.kind = kind,
+		.x = x,
+		.y = y,
+	};
+}
+
+static bool is_visible(const struct input_probe_event* event,
+		struct pixman_region16* damage, int width, int height,
+		input_probe_map_fn map_point, void* userdata)
+{
+	if (event->kind == INPUT_PROBE_KEY)
+		return true;
+
+	double px = event->x;
+	double py = event->y;
+	if (map_point && !map_point(&px, &py, userdata))
+		return false;
+
+	int x = px * width;
+	int y = py * height;
+	int r = INPUT_PROBE_POINTER_RADIUS;
+
+	pixman_box16_t box = { x - r, y - r, x + r, y + r };
+	return pixman_region_contains_rectangle(damage, &box) != PIXMAN_REGION_OUT;
+}
+
+void input_probe_match(struct input_probe* self,
+		struct pixman_region16* damage, int width, int height,
+		uint64_t capture_time, uint64_t now, input_probe_map_fn map_point,
+		input_probe_match_fn on_match, void* userdata)
+{
+	expire_events(self, now);
+
+	if (!pixman_region_not_empty(damage))
+		return;
+
+	int n = 0;
+	for (int i = 0; i < self->n_events; ++i) {
+		const struct input_probe_event* event = &self->events[i];
+
+		if (capture_time && event->time > capture_time) {
+			self->events[n++] = *event;
+			continue;
+		}
+
+		if (is_visible(event, damage, width, height, map_point,
+					userdata)) {
+			self->stats.n_matched++;
+			on_match(event, now - event->time, userdata);
+			continue;
+		}
+
+		self->events[n++] = *event;
+	}
+	self->n_events = n;
+}
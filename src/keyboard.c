@@ -18,10 +18,10 @@
  * interface.
  */
 
-#include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <wayland-client-protocol.h>
 #include <xkbcommon/xkbcommon-keysyms.h>
@@ -32,7 +32,9 @@
 #include "virtual-keyboard-unstable-v1.h"
 #include "keyboard.h"
 #include "shm.h"
-#include "intset.h"
+#include "keyset.h"
+#include "sys/queue.h"
+#include "usdt.h"
 
 #define MAYBE_UNUSED __attribute__((unused))
 
@@ -43,8 +45,46 @@ struct table_entry {
 	int group;
 };
 
+/* Maps a symbol to the run of entries in the lookup table that produce it */
+struct symbol_slot {
+	xkb_keysym_t symbol;
+	uint32_t index;
+	uint32_t count;
+};
+
+struct keyboard_keymap {
+	LIST_ENTRY(keyboard_keymap) link;
+	int ref;
+
+	/* Key */
+	char* rules;
+	char* model;
+	char* layout;
+	char* variant;
+	char* options;
+
+	struct xkb_context* context;
+	struct xkb_keymap* keymap;
+
+	size_t lookup_table_size;
+	size_t lookup_table_length;
+	struct table_entry* lookup_table;
+
+	/* Open addressing hash table; a slot with count == 0 is empty */
+	size_t symbol_map_mask;
+	struct symbol_slot* symbol_map;
+
+	int fd;
+	size_t fd_size;
+};
+
+LIST_HEAD(keyboard_keymap_list, keyboard_keymap);
+
+static struct keyboard_keymap_list keymap_cache =
+	LIST_HEAD_INITIALIZER(keymap_cache);
+
 struct key_iter_context {
-	struct keyboard* kb;
+	struct keyboard_keymap* map;
 	int group;
 };
 
@@ -53,8 +93,9 @@ struct kb_mods {
 };
 
 static void save_mods(struct keyboard* self, struct kb_mods* mods);
+static void keyboard_release_all(struct keyboard* self);
 
-static void append_entry(struct keyboard* self, xkb_keysym_t symbol,
+static void append_entry(struct keyboard_keymap* self, xkb_keysym_t symbol,
                          xkb_keycode_t code, int level, int group)
 {
 	if (self->lookup_table_size <= self->lookup_table_length) {
@@ -80,7 +121,7 @@ static void append_entry(struct keyboard* self, xkb_keysym_t symbol,
 static void key_iter(struct xkb_keymap* map, xkb_keycode_t code, void* userdata)
 {
 	struct key_iter_context* ctx = userdata;
-	struct keyboard* self = ctx->kb;
+	struct keyboard_keymap* self = ctx->map;
 	int group = ctx->group;
 
 	size_t n_levels = xkb_keymap_num_levels_for_key(map, code, group);
@@ -100,27 +141,79 @@ static int compare_symbols(const void* a, const void* b)
 	const struct table_entry* x = a;
 	const struct table_entry* y = b;
 
-	if (x->group != y->group)
-		return x->group < y->group ? -1 : 1;
-
 	if (x->symbol != y->symbol)
 		return x->symbol < y->symbol ? -1 : 1;
 
+	if (x->group != y->group)
+		return x->group < y->group ? -1 : 1;
+
 	return x->code < y->code ? -1 : x->code > y->code;
 }
 
-static int compare_symbols2(const void* a, const void* b)
+static inline size_t symbol_hash(xkb_keysym_t symbol)
 {
-	const struct table_entry* x = a;
-	const struct table_entry* y = b;
+	uint32_t h = symbol * 2654435761u;
+	return h ^ (h >> 16);
+}
 
-	if (x->group != y->group)
-		return x->group < y->group ? -1 : 1;
+static void symbol_map_insert(struct keyboard_keymap* self,
+		xkb_keysym_t symbol, uint32_t index, uint32_t count)
+{
+	size_t i = symbol_hash(symbol) & self->symbol_map_mask;
+	while (self->symbol_map[i].count != 0)
+		i = (i + 1) & self->symbol_map_mask;
 
-	return x->symbol < y->symbol ? -1 : x->symbol > y->symbol;
+	self->symbol_map[i].symbol = symbol;
+	self->symbol_map[i].index = index;
+	self->symbol_map[i].count = count;
 }
 
-static int create_lookup_table(struct keyboard* self)
+static const struct symbol_slot* symbol_map_find(
+		const struct keyboard_keymap* self, xkb_keysym_t symbol)
+{
+	size_t i = symbol_hash(symbol) & self->symbol_map_mask;
+	while (self->symbol_map[i].count != 0) {
+		if (self->symbol_map[i].symbol == symbol)
+			return &self->symbol_map[i];
+		i = (i + 1) & self->symbol_map_mask;
+	}
+	return NULL;
+}
+
+static int create_symbol_map(struct keyboard_keymap* self)
+{
+	size_t n_symbols = 0;
+	for (size_t i = 0; i < self->lookup_table_length; ++i)
+		if (i == 0 || self->lookup_table[i].symbol !=
+				self->lookup_table[i - 1].symbol)
+			n_symbols++;
+
+	// Keep the load factor at or below 0.5 so that probe chains are short
+	size_t size = 16;
+	while (size < n_symbols * 2)
+		size *= 2;
+
+	self->symbol_map = calloc(size, sizeof(*self->symbol_map));
+	if (!self->symbol_map)
+		return -1;
+	self->symbol_map_mask = size - 1;
+
+	size_t start = 0;
+	for (size_t i = 1; i <= self->lookup_table_length; ++i) {
+		if (i < self->lookup_table_length &&
+				self->lookup_table[i].symbol ==
+				self->lookup_table[start].symbol)
+			continue;
+
+		symbol_map_insert(self, self->lookup_table[start].symbol,
+				start, i - start);
+		start = i;
+	}
+
+	return 0;
+}
+
+static int create_lookup_table(struct keyboard_keymap* self)
 {
 	self->lookup_table_length = 0;
 	self->lookup_table_size = 128;
@@ -133,7 +226,7 @@ static int create_lookup_table(struct keyboard* self)
 	int n_groups = xkb_keymap_num_layouts(self->keymap);
 	for (int group = 0; group < n_groups; ++group) {
 		struct key_iter_context ctx = {
-			.kb = self,
+			.map = self,
 			.group = group,
 		};
 
@@ -143,7 +236,7 @@ static int create_lookup_table(struct keyboard* self)
 	qsort(self->lookup_table, self->lookup_table_length,
 	      sizeof(*self->lookup_table), compare_symbols);
 
-	return 0;
+	return create_symbol_map(self);
 }
 
 static char* get_symbol_name(xkb_keysym_t sym, char* dst, size_t size)
@@ -162,13 +255,13 @@ static void keyboard__dump_entry(const struct keyboard* self,
 	get_symbol_name(entry->symbol, sym_name, sizeof(sym_name));
 
 	const char *group_name MAYBE_UNUSED =
-		xkb_keymap_layout_get_name(self->keymap, entry->group);
+		xkb_keymap_layout_get_name(self->map->keymap, entry->group);
 
 	const char* code_name MAYBE_UNUSED =
-		xkb_keymap_key_get_name(self->keymap, entry->code);
+		xkb_keymap_key_get_name(self->map->keymap, entry->code);
 
 	bool is_pressed MAYBE_UNUSED =
-		intset_is_set(&self->key_state, entry->code);
+		keyset_is_set(&self->key_state, entry->code);
 
 	nvnc_log(NVNC_LOG_DEBUG, "group=%s symbol=%s level=%d code=%s %s",
 			group_name, sym_name, entry->level, code_name,
@@ -177,94 +270,164 @@ static void keyboard__dump_entry(const struct keyboard* self,
 
 void keyboard_dump_lookup_table(const struct keyboard* self)
 {
-	for (size_t i = 0; i < self->lookup_table_length; i++)
-		keyboard__dump_entry(self, &self->lookup_table[i]);
+	for (size_t i = 0; i < self->map->lookup_table_length; i++)
+		keyboard__dump_entry(self, &self->map->lookup_table[i]);
 }
 
-int keyboard_init(struct keyboard* self, const struct xkb_rule_names* rule_names)
+static bool name_eq(const char* a, const char* b)
 {
-	self->context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-	if (!self->context)
+	if (!a || !b)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+static char* name_dup(const char* name)
+{
+	return name ? strdup(name) : NULL;
+}
+
+static bool keyboard_keymap_matches(const struct keyboard_keymap* self,
+		const struct xkb_rule_names* names)
+{
+	return name_eq(self->rules, names->rules) &&
+		name_eq(self->model, names->model) &&
+		name_eq(self->layout, names->layout) &&
+		name_eq(self->variant, names->variant) &&
+		name_eq(self->options, names->options);
+}
+
+static int keyboard_keymap_create_fd(struct keyboard_keymap* self)
+{
+	char* keymap_string = xkb_keymap_get_as_string(self->keymap,
+			XKB_KEYMAP_FORMAT_TEXT_V1);
+	if (!keymap_string)
 		return -1;
 
-	if (intset_init(&self->key_state, 0) < 0)
-		goto key_state_failure;
+	self->fd_size = strlen(keymap_string) + 1;
+	self->fd = shm_alloc_sealed_fd(keymap_string, self->fd_size);
+	free(keymap_string);
 
-	self->keymap = xkb_keymap_new_from_names(self->context, rule_names, 0);
-	if (!self->keymap)
-		goto keymap_failure;
+	return self->fd < 0 ? -1 : 0;
+}
 
-	self->state = xkb_state_new(self->keymap);
-	if (!self->state)
-		goto state_failure;
+static void keyboard_keymap_destroy(struct keyboard_keymap* self)
+{
+	if (self->fd >= 0)
+		close(self->fd);
+	free(self->symbol_map);
+	free(self->lookup_table);
+	xkb_keymap_unref(self->keymap);
+	xkb_context_unref(self->context);
+	free(self->options);
+	free(self->variant);
+	free(self->layout);
+	free(self->model);
+	free(self->rules);
+	free(self);
+}
 
-	if (create_lookup_table(self) < 0)
-		goto table_failure;
+static struct keyboard_keymap* keyboard_keymap_create(
+		const struct xkb_rule_names* names)
+{
+	struct keyboard_keymap* self = calloc(1, sizeof(*self));
+	if (!self)
+		return NULL;
 
-//	keyboard_dump_lookup_table(self);
+	self->ref = 1;
+	self->fd = -1;
 
-	char* keymap_string =
-		xkb_keymap_get_as_string(self->keymap,
-		                         XKB_KEYMAP_FORMAT_TEXT_V1);
-	if (!keymap_string)
-		goto keymap_string_failure;
+	self->rules = name_dup(names->rules);
+	self->model = name_dup(names->model);
+	self->layout = name_dup(names->layout);
+	self->variant = name_dup(names->variant);
+	self->options = name_dup(names->options);
 
-	size_t keymap_size = strlen(keymap_string) + 1;
+	self->context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+	if (!self->context)
+		goto failure;
 
-	int keymap_fd = shm_alloc_fd(keymap_size);
-	if (keymap_fd < 0)
-		goto fd_failure;
+	self->keymap = xkb_keymap_new_from_names(self->context, names, 0);
+	if (!self->keymap)
+		goto failure;
 
-	size_t written = 0;
-	while (written < keymap_size) {
-		ssize_t ret = write(keymap_fd, keymap_string + written, keymap_size - written);
-		if (ret == -1 && errno == EINTR)
-			continue;
-		if (ret == -1)
-			goto write_failure;
-		written += ret;
+	if (create_lookup_table(self) < 0)
+		goto failure;
+
+	if (keyboard_keymap_create_fd(self) < 0)
+		goto failure;
+
+	LIST_INSERT_HEAD(&keymap_cache, self, link);
+	return self;
+
+failure:
+	keyboard_keymap_destroy(self);
+	return NULL;
+}
+
+static struct keyboard_keymap* keyboard_keymap_get(
+		const struct xkb_rule_names* names)
+{
+	struct keyboard_keymap* map;
+	LIST_FOREACH(map, &keymap_cache, link) {
+		if (keyboard_keymap_matches(map, names)) {
+			map->ref++;
+			nvnc_trace("Reusing cached keymap (ref: %d)", map->ref);
+			return map;
+		}
 	}
 
-	free(keymap_string);
+	return keyboard_keymap_create(names);
+}
+
+static void keyboard_keymap_unref(struct keyboard_keymap* self)
+{
+	if (!self || --self->ref > 0)
+		return;
+
+	LIST_REMOVE(self, link);
+	keyboard_keymap_destroy(self);
+}
+
+int keyboard_init(struct keyboard* self, const struct xkb_rule_names* rule_names)
+{
+	keyset_init(&self->key_state);
+
+	self->state = NULL;
+	self->map = keyboard_keymap_get(rule_names);
+	if (!self->map)
+		return -1;
+
+	self->state = xkb_state_new(self->map->keymap);
+	if (!self->state)
+		goto state_failure;
+
+//	keyboard_dump_lookup_table(self);
 
 	zwp_virtual_keyboard_v1_keymap(self->virtual_keyboard,
 	                               WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1,
-	                               keymap_fd, keymap_size);
-
-	close(keymap_fd);
+	                               self->map->fd, self->map->fd_size);
 
 	return 0;
 
-write_failure:
-	close(keymap_fd);
-fd_failure:
-	free(keymap_string);
-keymap_string_failure:
-	free(self->lookup_table);
-table_failure:
-	xkb_state_unref(self->state);
 state_failure:
-	xkb_keymap_unref(self->keymap);
-keymap_failure:
-	intset_destroy(&self->key_state);
-key_state_failure:
-	xkb_context_unref(self->context);
+	keyboard_keymap_unref(self->map);
+	self->map = NULL;
 	return -1;
 }
 
 void keyboard_destroy(struct keyboard* self)
 {
+	keyboard_release_all(self);
 	zwp_virtual_keyboard_v1_destroy(self->virtual_keyboard);
-	free(self->lookup_table);
 	xkb_state_unref(self->state);
-	xkb_keymap_unref(self->keymap);
-	intset_destroy(&self->key_state);
-	xkb_context_unref(self->context);
+	self->state = NULL;
+	keyboard_keymap_unref(self->map);
+	self->map = NULL;
 }
 
 static xkb_layout_index_t get_current_layout_group(const struct keyboard* self)
 {
-	int n_groups = xkb_keymap_num_layouts(self->keymap);
+	int n_groups = xkb_keymap_num_layouts(self->map->keymap);
 	assert(n_groups > 0);
 
 	for (int i = 0; i < n_groups; ++i) {
@@ -276,45 +439,38 @@ static xkb_layout_index_t get_current_layout_group(const struct keyboard* self)
 	return -1;
 }
 
-static struct table_entry* keyboard_find_symbol_in_group(const struct keyboard* self,
-                                         xkb_keysym_t symbol, int group)
-{
-	struct table_entry cmp = {
-		.group = group,
-		.symbol = symbol,
-	};
-
-	struct table_entry* entry =
-		bsearch(&cmp, self->lookup_table, self->lookup_table_length,
-		        sizeof(*self->lookup_table), compare_symbols2);
-
-	if (!entry)
-		return NULL;
-
-	while (entry != self->lookup_table && (entry - 1)->symbol == symbol)
-		--entry;
-
-	return entry;
-}
-
+/* Find the first entry for the symbol in the active layout group, or in the
+ * nearest following group where it exists.
+ */
 static struct table_entry* keyboard_find_symbol(struct keyboard* self,
                                          xkb_keysym_t symbol)
 {
-	int n_groups = xkb_keymap_num_layouts(self->keymap);
-	struct table_entry* entry = NULL;
-	int current_group = get_current_layout_group(self);
-	int group = -1;
+	const struct symbol_slot* slot = symbol_map_find(self->map, symbol);
+	if (!slot)
+		return NULL;
 
-	for (int g = 0; g < n_groups; ++g) {
-		group = (current_group + g) % n_groups;
-		entry = keyboard_find_symbol_in_group(self, symbol, group);
-		if (entry)
+	int n_groups = xkb_keymap_num_layouts(self->map->keymap);
+	int current_group = get_current_layout_group(self);
+	struct table_entry* entry = NULL;
+	int best_distance = n_groups;
+
+	for (uint32_t i = 0; i < slot->count; ++i) {
+		struct table_entry* candidate =
+			&self->map->lookup_table[slot->index + i];
+		int distance = (candidate->group - current_group + n_groups)
+			% n_groups;
+		if (distance < best_distance) {
+			best_distance = distance;
+			entry = candidate;
+		}
+		if (distance == 0)
 			break;
 	}
 
-	assert(group >= 0);
+	assert(entry);
+	int group = entry->group;
 
-	if (entry && group != current_group) {
+	if (group != current_group) {
 		nvnc_log(NVNC_LOG_DEBUG, "Keyboard symbol was not found in active layout group; changing to a different one where it was found...");
 		struct kb_mods mods;
 		save_mods(self, &mods);
@@ -364,6 +520,9 @@ static struct table_entry* match_level(struct keyboard* self,
                                        struct table_entry* entry)
 {
 	xkb_keysym_t symbol = entry->symbol;
+	int group = entry->group;
+	const struct table_entry* end =
+		&self->map->lookup_table[self->map->lookup_table_length];
 
 	while (true) {
 		int level;
@@ -374,8 +533,8 @@ static struct table_entry* match_level(struct keyboard* self,
 		if (entry->level == level)
 			return entry;
 
-		if (++entry >= &self->lookup_table[self->lookup_table_length] ||
-		    entry->symbol != symbol)
+		if (++entry >= end || entry->symbol != symbol ||
+				entry->group != group)
 			break;
 	}
 
@@ -408,6 +567,7 @@ static bool keyboard_symbol_is_mod(xkb_keysym_t symbol)
 
 static void send_key(struct keyboard* self, xkb_keycode_t code, bool is_pressed)
 {
+	DTRACE_PROBE3(wayvnc, keyboard_inject, self, code, is_pressed);
 	zwp_virtual_keyboard_v1_key(self->virtual_keyboard, 0, code - 8,
 	                            is_pressed ? WL_KEYBOARD_KEY_STATE_PRESSED
 	                                       : WL_KEYBOARD_KEY_STATE_RELEASED);
@@ -438,7 +598,7 @@ static void send_key_with_level(struct keyboard* self, xkb_keycode_t code,
 	save_mods(self, &save);
 
 	xkb_mod_mask_t mods = 0;
-	xkb_keymap_key_get_mods_for_level(self->keymap, code,
+	xkb_keymap_key_get_mods_for_level(self->map->keymap, code,
 			current_group, level, &mods, 1);
 	xkb_state_update_mask(self->state, mods, 0, 0, 0, 0,
 			current_group);
@@ -456,15 +616,14 @@ static void send_key_with_level(struct keyboard* self, xkb_keycode_t code,
 static bool update_key_state(struct keyboard* self, xkb_keycode_t code,
 		bool is_pressed)
 {
-	bool was_pressed = intset_is_set(&self->key_state, code);
+	bool was_pressed = keyset_is_set(&self->key_state, code);
 	if (was_pressed == is_pressed)
 		return false;
 
 	if (is_pressed)
-		intset_set(&self->key_state, code);
-	else
-		intset_clear(&self->key_state, code);
+		return keyset_set(&self->key_state, code);
 
+	keyset_clear(&self->key_state, code);
 	return true;
 }
 
@@ -513,6 +672,25 @@ void keyboard_feed_code(struct keyboard* self, xkb_keycode_t code,
 	}
 }
 
+/* Release any keys that are still held so that they do not get stuck in the
+ * compositor when the client goes away.
+ */
+static void keyboard_release_all(struct keyboard* self)
+{
+	if (keyset_is_empty(&self->key_state))
+		return;
+
+	nvnc_log(NVNC_LOG_DEBUG, "Releasing %d held key(s)",
+			keyset_count(&self->key_state));
+
+	keyset_for_each(&self->key_state, code) {
+		keyboard_apply_mods(self, code, false);
+		send_key(self, code, false);
+	}
+
+	keyset_init(&self->key_state);
+}
+
 enum nvnc_keyboard_led_state keyboard_get_led_state(
 		const struct keyboard* self)
 {
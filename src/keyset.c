@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "keyset.h"
+
+#include <string.h>
+
+void keyset_init(struct keyset* self)
+{
+	memset(self, 0, sizeof(*self));
+}
+
+bool keyset_set(struct keyset* self, uint32_t code)
+{
+	if (code >= KEYSET_MAX_CODE)
+		return false;
+
+	self->words[code / 64] |= UINT64_C(1) << (code % 64);
+	return true;
+}
+
+void keyset_clear(struct keyset* self, uint32_t code)
+{
+	if (code < KEYSET_MAX_CODE)
+		self->words[code / 64] &= ~(UINT64_C(1) << (code % 64));
+}
+
+bool keyset_is_set(const struct keyset* self, uint32_t code)
+{
+	if (code >= KEYSET_MAX_CODE)
+		return false;
+
+	return (self->words[code / 64] >> (code % 64)) & 1;
+}
+
+bool keyset_is_empty(const struct keyset* self)
+{
+	uint64_t any = 0;
+	for (int i = 0; i < KEYSET_N_WORDS; ++i)
+		any |= self->words[i];
+	return any == 0;
+}
+
+int keyset_count(const struct keyset* self)
+{
+	int count = 0;
+	for (int i = 0; i < KEYSET_N_WORDS; ++i)
+		count += __builtin_popcountll(self->words[i]);
+	return count;
+}
+
+int keyset_next(const struct keyset* self, uint32_t start)
+{
+	if (start >= KEYSET_MAX_CODE)
+		return -1;
+
+	uint32_t index = start / 64;
+	uint64_t word = self->words[index] & (~UINT64_C(0) << (start % 64));
+
+	while (!word) {
+		if (++index >= KEYSET_N_WORDS)
+			return -1;
+		word = self->words[index];
+	}
+
+	return index * 64 + __builtin_ctzll(word);
+}
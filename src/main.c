@@ -60,6 +60,14 @@
 #include "observer.h"
 #include "desktop.h"
 #include "wayland.h"
+#include "histogram.h"
+#include "damage-simplify.h"
+#include "frame-pipeline.h"
+#include "cursor-cache.h"
+#include "damage-trace.h"
+#include "input-probe.h"
+#include "metrics.h"
+#include "sys/queue.h"
 
 #ifdef ENABLE_PAM
 #include "pam_auth.h"
@@ -68,11 +76,36 @@
 #define DEFAULT_ADDRESS "127.0.0.1"
 #define DEFAULT_PORT 5900
 
+#define MAX_CAPTURE_QUEUE_DEPTH 3
+
+#define MAX_COUNTERS 16
+
 #define XSTR(x) STR(x)
 #define STR(x) #x
 
 struct wayvnc_client;
 
+enum latency_type {
+	LATENCY_CAPTURE = 0,
+	LATENCY_PROCESS,
+	LATENCY_INPUT,
+	LATENCY_RATE_LIMIT,
+	LATENCY_CHANGE_DETECTION,
+	LATENCY_TILE_HASH_STRIPE,
+	LATENCY_INPUT_TO_FRAME,
+	LATENCY_COUNT,
+};
+
+static const char* latency_names[LATENCY_COUNT] = {
+	[LATENCY_CAPTURE] = "capture",
+	[LATENCY_PROCESS] = "process",
+	[LATENCY_INPUT] = "input",
+	[LATENCY_RATE_LIMIT] = "rate-limit",
+	[LATENCY_CHANGE_DETECTION] = "change-detection",
+	[LATENCY_TILE_HASH_STRIPE] = "tile-hash-stripe",
+	[LATENCY_INPUT_TO_FRAME] = "input-to-frame",
+};
+
 enum socket_type {
 	SOCKET_TYPE_TCP = 0,
 	SOCKET_TYPE_UNIX,
@@ -84,7 +117,8 @@ struct wayvnc_display {
 	struct wayvnc* wayvnc;
 	struct nvnc_display* nvnc_display;
 	struct image_source* image_source;
-	struct wv_buffer* next_frame;
+	struct frame_pipeline_display pipeline;
+
 	struct observer geometry_change_observer;
 	struct observer destruction_observer;
 	struct {
@@ -122,7 +156,17 @@ struct wayvnc {
 
 	uint32_t damage_area_sum;
 	uint32_t n_frames_captured;
-	uint32_t n_frames_sent;
+
+	struct frame_pipeline frame_pipeline;
+	struct frame_pipeline_stats last_pipeline_stats;
+
+	// Totals since start for the metrics endpoint
+	uint64_t n_frames_captured_total;
+	uint64_t damage_area_total;
+	uint64_t n_key_events;
+
+	struct pointer_stats pointer_stats;
+	struct wayland_flush_stats last_flush_stats;
 
 	bool disable_input;
 	bool use_transient_seat;
@@ -130,10 +174,22 @@ struct wayvnc {
 
 	int nr_clients;
 	struct aml_ticker* performance_ticker;
+	bool show_performance;
+
+	// Latencies in µs since start and since the last performance tick
+	struct histogram latency[LATENCY_COUNT];
+	struct histogram latency_interval[LATENCY_COUNT];
+	uint64_t input_time;
+
+	bool probe_input_latency;
+	struct input_probe input_probe;
 
 	struct aml_timer* capture_retry_timer;
 
+	struct damage_trace* damage_trace;
+
 	struct ctl* ctl;
+	struct metrics_server* metrics;
 
 	bool start_detached;
 	bool overlay_cursor;
@@ -145,9 +201,8 @@ struct wayvnc {
 
 	struct wayvnc_client* cursor_master;
 	struct screencopy* cursor_sc;
-
-	uint64_t last_send_time;
-	struct aml_timer* rate_limiter;
+	struct cursor_cache cursor_cache;
+	struct screencopy_cursor_stats cursor_capture_stats;
 
 	// wayland observers
 	struct observer output_added_observer;
@@ -173,6 +228,14 @@ struct wayvnc_client {
 	struct pointer pointer;
 	struct keyboard keyboard;
 	struct data_control data_control;
+
+	uint64_t n_pointer_events;
+	uint64_t n_key_events;
+
+	/* Frames that were fed to a display after this are still in flight
+	 * for this client.
+	 */
+	uint64_t last_update_request_time;
 };
 
 void wayvnc_exit(struct wayvnc* self);
@@ -198,11 +261,73 @@ static bool configure_cursor_sc(struct wayvnc* self,
 		struct wayvnc_client* client);
 static bool wayvnc_desktop_display_add(struct wayvnc* self,
 		struct image_source* image_source);
+static void stop_performance_ticker(struct wayvnc* self);
 
 struct wayland* wayland = NULL;
 
 extern struct screencopy_impl wlr_screencopy_impl, ext_image_copy_capture_impl;
 
+static void wayvnc_record_latency(struct wayvnc* self,
+		enum latency_type type, uint64_t value)
+{
+	histogram_record(&self->latency[type], value);
+	histogram_record(&self->latency_interval[type], value);
+}
+
+static void wayvnc_mark_input(struct wayvnc* self)
+{
+	if (!self->input_time)
+		self->input_time = gettime_us();
+}
+
+static void wayvnc_probe_input(struct wayvnc* self,
+		enum input_probe_kind kind, double x, double y)
+{
+	if (!self->probe_input_latency)
+		return;
+
+	uint64_t now = gettime_us();
+	DTRACE_PROBE2(wayvnc, input_probe_event, kind, now);
+	input_probe_mark(&self->input_probe, kind, x, y, now);
+}
+
+/* Where a frame that is being matched by the input probe is in the framebuffer
+ * that clients see
+ */
+struct input_probe_frame {
+	struct wayvnc* wayvnc;
+	// From 0 to 1
+	double x, y, width, height;
+	enum wl_output_transform transform;
+};
+
+static bool map_input_probe_point(double* x, double* y, void* userdata)
+{
+	const struct input_probe_frame* frame = userdata;
+
+	struct { double x, y; } p = {
+		(*x - frame->x) / frame->width,
+		(*y - frame->y) / frame->height,
+	};
+	if (p.x < 0.0 || p.x > 1.0 || p.y < 0.0 || p.y > 1.0)
+		return false;
+
+	wv_output_transform_canvas_point(frame->transform, &p.x, &p.y);
+	*x = p.x;
+	*y = p.y;
+	return true;
+}
+
+static void on_input_probe_match(const struct input_probe_event* event,
+		uint64_t latency, void* userdata)
+{
+	const struct input_probe_frame* frame = userdata;
+	struct wayvnc* self = frame->wayvnc;
+	DTRACE_PROBE3(wayvnc, input_to_frame, event->kind, event->time,
+			latency);
+	wayvnc_record_latency(self, LATENCY_INPUT_TO_FRAME, latency);
+}
+
 static void cancel_deferred_detach(struct wayvnc* self)
 {
 	if (!self->deferred_detach)
@@ -295,14 +420,11 @@ static void on_seat_removed(struct observer* observer, void* data)
 
 static void wayvnc_display_detach(struct wayvnc_display* display)
 {
+	frame_pipeline_display_reset(&display->pipeline);
 	nvnc_trace("removing destruction observer");
 	observer_deinit(&display->destruction_observer);
 	nvnc_trace("removing geometry observer");
 	observer_deinit(&display->geometry_change_observer);
-	if (display->next_frame) {
-		wv_buffer_release(display->next_frame);
-		display->next_frame = NULL;
-	}
 	display->image_source = NULL;
 }
 
@@ -360,11 +482,7 @@ static void on_wayland_destroyed(struct observer* observer, void* data)
 		image_source_destroy(self->image_source);
 	self->image_source = NULL;
 
-	if (self->performance_ticker) {
-		aml_stop(aml_get_default(), self->performance_ticker);
-		aml_unref(self->performance_ticker);
-	}
-	self->performance_ticker = NULL;
+	stop_performance_ticker(self);
 
 	if (self->capture_retry_timer) {
 		aml_stop(aml_get_default(), self->capture_retry_timer);
@@ -394,6 +512,7 @@ static int init_wayland(struct wayvnc* self, const char* display)
 		flags |= WAYLAND_FLAG_ENABLE_TOPLEVEL_CAPTURE;
 
 	wayland = wayland_connect(display, flags);
+	memset(&self->last_flush_stats, 0, sizeof(self->last_flush_stats));
 	if (!wayland)
 		return -1;
 
@@ -662,6 +781,9 @@ static void on_pointer_event(struct nvnc_client* client, double x, double y,
 	struct { double x, y; } xf = { x, y };
 	wv_output_transform_canvas_point(transform, &xf.x, &xf.y);
 
+	wv_client->n_pointer_events++;
+	wayvnc_mark_input(wayvnc);
+	wayvnc_probe_input(wayvnc, INPUT_PROBE_POINTER, x, y);
 	pointer_set(&wv_client->pointer, xf.x, xf.y, button_mask);
 }
 
@@ -673,6 +795,10 @@ static void on_key_event(struct nvnc_client* client, uint32_t symbol,
 		return;
 	}
 
+	wv_client->n_key_events++;
+	wv_client->server->n_key_events++;
+	wayvnc_mark_input(wv_client->server);
+	wayvnc_probe_input(wv_client->server, INPUT_PROBE_KEY, 0, 0);
 	keyboard_feed(&wv_client->keyboard, symbol, is_pressed);
 
 	nvnc_client_set_led_state(wv_client->nvnc_client,
@@ -687,6 +813,10 @@ static void on_key_code_event(struct nvnc_client* client, uint32_t code,
 		return;
 	}
 
+	wv_client->n_key_events++;
+	wv_client->server->n_key_events++;
+	wayvnc_mark_input(wv_client->server);
+	wayvnc_probe_input(wv_client->server, INPUT_PROBE_KEY, 0, 0);
 	keyboard_feed_code(&wv_client->keyboard, code + 8, is_pressed);
 
 	nvnc_client_set_led_state(wv_client->nvnc_client,
@@ -704,6 +834,26 @@ static void on_client_cut_text(struct nvnc_client* nvnc_client,
 	}
 }
 
+#ifdef HAVE_NVNC_FB_REQ_FN
+static void on_client_fb_req(struct nvnc_client* nvnc_client,
+		bool is_incremental, uint16_t x, uint16_t y, uint16_t width,
+		uint16_t height)
+{
+	struct wayvnc_client* client = nvnc_client_get_userdata(nvnc_client);
+	if (!client)
+		return;
+
+	/* Clients ask for the next update once they're done with the last
+	 * one, so this is as close as we get to knowing that a frame has been
+	 * encoded and sent.
+	 */
+	client->last_update_request_time = gettime_us();
+
+	struct wayvnc* self = client->server;
+	frame_pipeline_schedule(&self->frame_pipeline);
+}
+#endif
+
 static int count_displays(const struct wayvnc* self)
 {
 	int count = 0;
@@ -913,6 +1063,7 @@ static int wayvnc_display_blank(struct wayvnc* self,
 	nvnc_frame_unref(placeholder_fb);
 
 	nvnc_set_cursor(self->nvnc, NULL, 0, 0, false);
+	cursor_cache_reset(&self->cursor_cache);
 
 	return 0;
 }
@@ -1121,6 +1272,15 @@ static struct wayvnc_display* wayvnc_display_add(struct wayvnc* self,
 
 	nvnc_display_set_userdata(display->nvnc_display, display, NULL);
 
+	if (frame_pipeline_display_init(&display->pipeline,
+				&self->frame_pipeline,
+				display->nvnc_display) < 0) {
+		nvnc_display_unref(display->nvnc_display);
+		LIST_REMOVE(display, link);
+		free(display);
+		return NULL;
+	}
+
 	nvnc_add_display(self->nvnc, display->nvnc_display);
 
 	return display;
@@ -1130,6 +1290,7 @@ static void wayvnc_display_destroy(struct wayvnc_display* display)
 {
 	LIST_REMOVE(display, link);
 	wayvnc_display_detach(display);
+	frame_pipeline_display_deinit(&display->pipeline);
 	if (display->wayvnc && display->wayvnc->nvnc)
 		nvnc_remove_display(display->wayvnc->nvnc, display->nvnc_display);
 	nvnc_display_unref(display->nvnc_display);
@@ -1299,6 +1460,9 @@ static int init_nvnc(struct wayvnc* self)
 
 	nvnc_set_new_client_fn(self->nvnc, on_nvnc_client_new);
 	nvnc_set_cut_text_fn(self->nvnc, on_client_cut_text);
+#ifdef HAVE_NVNC_FB_REQ_FN
+	nvnc_set_fb_req_fn(self->nvnc, on_client_fb_req);
+#endif
 
 	return 0;
 
@@ -1425,102 +1589,154 @@ static void apply_output_transform(const struct wayvnc* self,
 			(enum nvnc_transform)buffer_transform);
 }
 
-static void wayvnc_display_send_next_frame(struct wayvnc* self,
-		struct wayvnc_display* display, uint64_t now)
+static void wayvnc_get_frame_damage(struct frame_pipeline_display* pipeline,
+		struct wv_buffer* buffer, struct pixman_region16* damage)
 {
-	struct wv_buffer* buffer = display->next_frame;
-	display->next_frame = NULL;
-
-	if (!buffer)
-		return;
-
-	struct pixman_region16 damage;
-	pixman_region_init(&damage);
+	struct wayvnc* self = pipeline->pipeline->userdata;
 
 	if (screencopy_get_capabilities(self->screencopy)
 			& SCREENCOPY_CAP_TRANSFORM) {
-		pixman_region_copy(&damage, &buffer->frame_damage);
+		pixman_region_copy(damage, &buffer->frame_damage);
 	} else {
 		// TODO: During desktop capture, use correct transform
-		apply_output_transform(self, buffer, &damage);
+		apply_output_transform(self, buffer, damage);
 	}
+}
 
-	pixman_region_intersect_rect(&damage, &damage, 0, 0, buffer->width,
-			buffer->height);
-
-	nvnc_frame_set_damage(buffer->nvnc_frame, &damage);
-	pixman_region_fini(&damage);
+static void wayvnc_display_get_input_probe_frame(
+		const struct wayvnc_display* display, struct wv_buffer* buffer,
+		struct input_probe_frame* frame)
+{
+	struct wayvnc* self = display->wayvnc;
 
-	nvnc_display_feed_frame(display->nvnc_display, buffer->nvnc_frame);
-	self->n_frames_sent++;
+	*frame = (struct input_probe_frame){
+		.wayvnc = self,
+		.width = 1.0,
+		.height = 1.0,
+	};
 
+	// The damage is in the orientation of the frame before its transform
+	if (screencopy_get_capabilities(self->screencopy)
+			& SCREENCOPY_CAP_TRANSFORM)
+		frame->transform = (enum wl_output_transform)
+			nvnc_frame_get_transform(buffer->nvnc_frame);
+	else
+		frame->transform = image_source_get_transform(
+				self->image_source);
+
+	// See wayvnc_display_set_desktop_geometry()
+	int fb_width, fb_height;
+	if (display->image_source == self->image_source ||
+			!image_source_get_logical_size(self->image_source,
+				&fb_width, &fb_height) ||
+			fb_width <= 0 || fb_height <= 0)
+		return;
 
-	wayvnc_start_capture(self);
+	struct output* output = output_from_image_source(display->image_source);
+	double min_scale = image_source_get_min_scale(self->image_source);
 
-	wv_buffer_release(buffer);
+	int x, y, logical_width, logical_height;
+	output_get_pos(output, &x, &y);
+	output_get_logical_size(output, &logical_width, &logical_height);
 
-	self->last_send_time = now;
+	frame->x = round(x / min_scale) / fb_width;
+	frame->y = round(y / min_scale) / fb_height;
+	frame->width = round(logical_width / min_scale) / fb_width;
+	frame->height = round(logical_height / min_scale) / fb_height;
 }
 
-static void wayvnc_send_next_frame(struct wayvnc* self, uint64_t now)
+static void wayvnc_on_frame_feed(struct frame_pipeline_display* pipeline,
+		struct wv_buffer* buffer, struct pixman_region16* damage)
 {
-	struct wayvnc_display* display;
-	LIST_FOREACH(display, &self->wayvnc_displays, link)
-		wayvnc_display_send_next_frame(self, display, now);
-}
+	struct wayvnc* self = pipeline->pipeline->userdata;
+	struct wayvnc_display* display = wl_container_of(pipeline, display,
+			pipeline);
 
-static void wayvnc_handle_rate_limit_timeout(struct aml_timer* timer)
-{
-	struct wayvnc* self = aml_get_userdata(timer);
-	uint64_t now = gettime_us();
-	wayvnc_send_next_frame(self, now);
+	if (!self->probe_input_latency)
+		return;
+
+	struct input_probe_frame frame;
+	wayvnc_display_get_input_probe_frame(display, buffer, &frame);
+	if (frame.width <= 0 || frame.height <= 0)
+		return;
+
+	input_probe_match(&self->input_probe, damage, buffer->width,
+			buffer->height, buffer->capture_time, gettime_us(),
+			map_input_probe_point, on_input_probe_match, &frame);
 }
 
-static void wayvnc_process_frame(struct wayvnc* self, struct wv_buffer* buffer,
-		struct image_source* source)
+/* A frame is only fed to a display when at least one client has asked for an
+ * update since the last frame was fed to that display. Slower clients get the
+ * damage of the frames that they missed coalesced by neatvnc.
+ */
+static bool wayvnc_has_ready_client(const struct frame_pipeline_display* pipeline)
 {
-	nvnc_trace("Processing buffer: %p", buffer);
+#ifdef HAVE_NVNC_FB_REQ_FN
+	const struct wayvnc* self = pipeline->pipeline->userdata;
+	bool has_clients = false;
 
-	self->n_frames_captured++;
-	self->damage_area_sum += calculate_region_area(&buffer->frame_damage);
+	for (struct nvnc_client* nvnc_client = nvnc_client_first(self->nvnc);
+			nvnc_client;
+			nvnc_client = nvnc_client_next(nvnc_client)) {
+		struct wayvnc_client* client =
+			nvnc_client_get_userdata(nvnc_client);
+		if (!client)
+			continue;
 
-	struct wayvnc_display* display =
-		wayvnc_display_find_by_source(self, source);
-	assert(display);
-	if (!display)
-		return;
+		if (client->last_update_request_time >= pipeline->last_send_time)
+			return true;
 
-	display->last_frame_info.is_set = true;
-	display->last_frame_info.width = buffer->width;
-	display->last_frame_info.height = buffer->height;
+		has_clients = true;
+	}
 
-	if (screencopy_get_capabilities(self->screencopy)
-			& SCREENCOPY_CAP_TRANSFORM)
-		display->last_frame_info.transform =
-			(enum wl_output_transform)nvnc_frame_get_transform(buffer->nvnc_frame);
+	return !has_clients;
+#else
+	/* Without update requests, there is no way to tell when a client is
+	 * done with a frame, so every client is assumed to keep up.
+	 */
+	return true;
+#endif
+}
 
-	bool have_pending_frame = false;
-	if (display->next_frame) {
-		pixman_region_union(&buffer->frame_damage,
-				&buffer->frame_damage,
-				&display->next_frame->frame_damage);
-		wv_buffer_release(display->next_frame);
-		have_pending_frame = true;
-	}
-	display->next_frame = buffer;
+static void wayvnc_start_frame_capture(struct frame_pipeline* pipeline)
+{
+	wayvnc_start_capture(pipeline->userdata);
+}
 
-	if (have_pending_frame)
-		return;
+static void wayvnc_record_frame_latency(struct frame_pipeline* pipeline,
+		enum frame_pipeline_latency type, uint64_t value)
+{
+	static const enum latency_type latency_types[] = {
+		[FRAME_PIPELINE_LATENCY_PROCESS] = LATENCY_PROCESS,
+		[FRAME_PIPELINE_LATENCY_RATE_LIMIT] = LATENCY_RATE_LIMIT,
+		[FRAME_PIPELINE_LATENCY_CHANGE_DETECTION] =
+			LATENCY_CHANGE_DETECTION,
+		[FRAME_PIPELINE_LATENCY_TILE_HASH_STRIPE] =
+			LATENCY_TILE_HASH_STRIPE,
+	};
 
-	uint64_t now = gettime_us();
-	double dt = (now - self->last_send_time) * 1.0e-6;
-	int32_t time_left = (1.0 / self->max_rate - dt) * 1.0e6;
+	wayvnc_record_latency(pipeline->userdata, latency_types[type], value);
+}
 
-	if (time_left > 0) {
-		aml_set_duration(self->rate_limiter, time_left);
-		aml_start(aml_get_default(), self->rate_limiter);
-	} else {
-		wayvnc_send_next_frame(self, now);
+static void wayvnc_record_trace(struct wayvnc* self, struct wv_buffer* buffer,
+		struct image_source* source)
+{
+	struct damage_trace_frame frame = {
+		.capture_time = buffer->capture_time,
+		.present_time = buffer->present_time,
+		.done_time = gettime_us(),
+		.width = buffer->width,
+		.height = buffer->height,
+		.format = buffer->format,
+		.source = image_source_is_output(source) ?
+			output_from_image_source(source)->id : 0,
+		.damage = &buffer->frame_damage,
+	};
+
+	if (damage_trace_write(self->damage_trace, &frame) < 0) {
+		nvnc_log(NVNC_LOG_ERROR, "Failed to write damage trace: %m");
+		damage_trace_close(self->damage_trace);
+		self->damage_trace = NULL;
 	}
 }
 
@@ -1528,6 +1744,8 @@ void on_capture_done(enum screencopy_result result, struct wv_buffer* buffer,
 		struct image_source* source, void* userdata)
 {
 	struct wayvnc* self = userdata;
+	struct wayvnc_display* display;
+	uint32_t area;
 
 	switch (result) {
 	case SCREENCOPY_FATAL:
@@ -1537,7 +1755,35 @@ void on_capture_done(enum screencopy_result result, struct wv_buffer* buffer,
 		wayvnc_restart_capture(self);
 		break;
 	case SCREENCOPY_DONE:
-		wayvnc_process_frame(self, buffer, source);
+		area = calculate_region_area(&buffer->frame_damage);
+		self->n_frames_captured++;
+		self->n_frames_captured_total++;
+		self->damage_area_sum += area;
+		self->damage_area_total += area;
+
+		if (buffer->capture_time)
+			wayvnc_record_latency(self, LATENCY_CAPTURE,
+					gettime_us() - buffer->capture_time);
+
+		if (self->damage_trace)
+			wayvnc_record_trace(self, buffer, source);
+
+		display = wayvnc_display_find_by_source(self, source);
+		assert(display);
+		if (!display)
+			break;
+
+		display->last_frame_info.is_set = true;
+		display->last_frame_info.width = buffer->width;
+		display->last_frame_info.height = buffer->height;
+
+		if (screencopy_get_capabilities(self->screencopy)
+				& SCREENCOPY_CAP_TRANSFORM)
+			display->last_frame_info.transform =
+				(enum wl_output_transform)nvnc_frame_get_transform(buffer->nvnc_frame);
+
+		frame_pipeline_submit(&self->frame_pipeline, &display->pipeline,
+				buffer);
 		break;
 	}
 }
@@ -1556,6 +1802,56 @@ int wayvnc_usage(struct option_parser* parser, FILE* stream, int rc)
 	return rc;
 }
 
+static int parse_change_detection(const char* value,
+		enum change_detection* mode)
+{
+	if (!value || strcmp(value, "auto") == 0)
+		*mode = CHANGE_DETECTION_AUTO;
+	else if (strcmp(value, "on") == 0)
+		*mode = CHANGE_DETECTION_ON;
+	else if (strcmp(value, "off") == 0)
+		*mode = CHANGE_DETECTION_OFF;
+	else
+		return -1;
+	return 0;
+}
+
+/* Parses a comma separated list of CPUs and CPU ranges, e.g. "0,2-3" */
+static int parse_cpu_list(const char* value, int* cpus, int max_cpus)
+{
+	int n = 0;
+	const char* p = value;
+
+	while (*p) {
+		char* end;
+		long first = strtol(p, &end, 10);
+		if (end == p || first < 0)
+			return -1;
+
+		long last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return -1;
+		}
+
+		for (long cpu = first; cpu <= last; ++cpu) {
+			if (n >= max_cpus)
+				return -1;
+			cpus[n++] = cpu;
+		}
+
+		if (*end == ',')
+			end++;
+		else if (*end != '\0')
+			return -1;
+		p = end;
+	}
+
+	return n;
+}
+
 int check_cfg_sanity(struct cfg* cfg)
 {
 	if (cfg->allow_broken_crypto) {
@@ -1590,10 +1886,8 @@ int check_cfg_sanity(struct cfg* cfg)
 	return 0;
 }
 
-static void on_perf_tick(struct aml_ticker* obj)
+static void log_performance(struct wayvnc* self)
 {
-	struct wayvnc* self = aml_get_userdata(obj);
-
 	double total_area = 0;
 	int width, height;
 	if (image_source_get_buffer_size(self->image_source, &width, &height)) {
@@ -1615,12 +1909,337 @@ static void on_perf_tick(struct aml_ticker* obj)
 	double area_avg = (double)self->damage_area_sum / (double)self->n_frames_captured;
 	double relative_area_avg = 100.0 * area_avg / total_area;
 
-	nvnc_log(NVNC_LOG_INFO, "Frames captured: %"PRIu32", frames sent: %"PRIu32" average reported frame damage: %.1f %%",
-			self->n_frames_captured, self->n_frames_sent, relative_area_avg);
+	const struct frame_pipeline_stats* stats = &self->frame_pipeline.stats;
+	const struct frame_pipeline_stats* last = &self->last_pipeline_stats;
+
+	nvnc_log(NVNC_LOG_INFO, "Frames captured: %"PRIu32", frames sent: %"PRIu64", frames coalesced: %"PRIu64", frames dropped: %"PRIu64" average reported frame damage: %.1f %%",
+			self->n_frames_captured, stats->n_sent - last->n_sent,
+			stats->n_coalesced - last->n_coalesced,
+			stats->n_dropped - last->n_dropped,
+			relative_area_avg);
+
+	for (struct wv_buffer_pool* pool = wv_buffer_pool_first(); pool;
+			pool = wv_buffer_pool_next(pool)) {
+		const struct wv_buffer_pool_stats* stats = &pool->stats;
+		nvnc_log(NVNC_LOG_INFO, "Buffer pool %dx%d: %"PRIu32" allocated, %"PRIu32" in use, %.1f MiB, exhausted %"PRIu32" times, p99 allocation time: %"PRIu32" µs",
+				stats->width, stats->height, stats->n_allocated,
+				stats->n_in_use, stats->n_bytes / 1048576.0,
+				stats->n_exhausted,
+				histogram_percentile(&stats->alloc_latency, 99));
+	}
+
+	nvnc_log(NVNC_LOG_INFO, "Pointer events received: %"PRIu64", forwarded: %"PRIu64,
+			self->pointer_stats.n_received,
+			self->pointer_stats.n_forwarded);
+
+	if (wayland) {
+		const struct wayland_flush_stats* now = &wayland->flush_stats;
+		const struct wayland_flush_stats* then = &self->last_flush_stats;
+		uint64_t n_flushes = now->n_flushes - then->n_flushes;
+		uint64_t n_bytes = now->n_bytes - then->n_bytes;
+		nvnc_log(NVNC_LOG_INFO, "Wayland flushes: %"PRIu64", average size: %.0f bytes, blocked: %"PRIu64,
+				n_flushes, n_flushes ? (double)n_bytes / n_flushes : 0,
+				now->n_blocked - then->n_blocked);
+	}
+}
+
+static int get_latency_stats(struct ctl* ctl,
+		struct ctl_server_latency** stats)
+{
+	struct wayvnc* self = ctl_server_userdata(ctl);
+	*stats = calloc(LATENCY_COUNT, sizeof(**stats));
+	if (!*stats)
+		return -1;
+
+	for (int i = 0; i < LATENCY_COUNT; ++i) {
+		(*stats)[i].name = latency_names[i];
+		(*stats)[i].histogram = &self->latency[i];
+	}
+	return LATENCY_COUNT;
+}
+
+static int get_buffer_pool_stats(struct ctl* ctl,
+		struct wv_buffer_pool_stats** stats)
+{
+	int n = 0;
+	struct wv_buffer_pool* pool;
+	for (pool = wv_buffer_pool_first(); pool; pool = wv_buffer_pool_next(pool))
+		++n;
+
+	if (n == 0) {
+		*stats = NULL;
+		return 0;
+	}
+
+	*stats = calloc(n, sizeof(**stats));
+	if (!*stats)
+		return -1;
+
+	int i = 0;
+	for (pool = wv_buffer_pool_first(); pool; pool = wv_buffer_pool_next(pool))
+		memcpy(&(*stats)[i++], &pool->stats, sizeof(pool->stats));
+
+	return n;
+}
+
+static int wayvnc_get_counters(const struct wayvnc* self,
+		struct ctl_server_counter* counters, int max_counters)
+{
+	int n = 0;
+
+#define ADD_COUNTER(counter_name, counter_value) do { \
+	if (n < max_counters) \
+		counters[n++] = (struct ctl_server_counter){ \
+			.name = counter_name, .value = counter_value }; \
+	else \
+		nvnc_log(NVNC_LOG_WARNING, "Too many counters, skipping %s", \
+				counter_name); \
+} while (0)
+
+	ADD_COUNTER("frames-dropped-empty",
+			self->frame_pipeline.stats.n_dropped);
+	ADD_COUNTER("pointer-events-received",
+			self->pointer_stats.n_received);
+	ADD_COUNTER("pointer-events-forwarded",
+			self->pointer_stats.n_forwarded);
+
+	ADD_COUNTER("cursor-unchanged",
+			self->cursor_cache.stats.n_unchanged);
+	ADD_COUNTER("cursor-cache-hits", self->cursor_cache.stats.n_hits);
+	ADD_COUNTER("cursor-cache-misses", self->cursor_cache.stats.n_misses);
+	ADD_COUNTER("cursor-captures", self->cursor_capture_stats.n_frames);
+	ADD_COUNTER("cursor-captures-undamaged",
+			self->cursor_capture_stats.n_undamaged_frames);
+	ADD_COUNTER("cursor-capture-timer-wakeups",
+			self->cursor_capture_stats.n_timer_wakeups);
+
+	if (self->probe_input_latency) {
+		ADD_COUNTER("input-probe-matched",
+				self->input_probe.stats.n_matched);
+		ADD_COUNTER("input-probe-expired",
+				self->input_probe.stats.n_expired);
+		ADD_COUNTER("input-probe-dropped",
+				self->input_probe.stats.n_dropped);
+	}
+
+	if (wayland) {
+		ADD_COUNTER("wayland-flushes", wayland->flush_stats.n_flushes);
+		ADD_COUNTER("wayland-flush-bytes", wayland->flush_stats.n_bytes);
+		ADD_COUNTER("wayland-flush-blocked",
+				wayland->flush_stats.n_blocked);
+	}
+
+#undef ADD_COUNTER
+
+	return n;
+}
+
+static int get_counters(struct ctl* ctl, struct ctl_server_counter** counters)
+{
+	struct wayvnc* self = ctl_server_userdata(ctl);
+	*counters = calloc(MAX_COUNTERS, sizeof(**counters));
+	if (!*counters)
+		return -1;
+
+	return wayvnc_get_counters(self, *counters, MAX_COUNTERS);
+}
+
+static void write_metric(struct metrics_writer* w, const char* name,
+		const char* type, const char* help, uint64_t value)
+{
+	metrics_write_family(w, name, type, help);
+	metrics_write_uint(w, name, NULL, value);
+}
+
+static void wayvnc_collect_metrics(struct metrics_writer* w, void* userdata)
+{
+	struct wayvnc* self = userdata;
+	char labels[64];
+
+	write_metric(w, "wayvnc_frames_captured_total", "counter",
+			"Frames captured from the compositor",
+			self->n_frames_captured_total);
+	write_metric(w, "wayvnc_frames_sent_total", "counter",
+			"Frames handed over to the VNC server",
+			self->frame_pipeline.stats.n_sent);
+	write_metric(w, "wayvnc_frames_coalesced_total", "counter",
+			"Frames replaced by a newer frame before they were sent",
+			self->frame_pipeline.stats.n_coalesced);
+	write_metric(w, "wayvnc_frames_dropped_total", "counter",
+			"Frames dropped because nothing changed",
+			self->frame_pipeline.stats.n_dropped);
+	write_metric(w, "wayvnc_damage_pixels_total", "counter",
+			"Pixels reported as damaged in captured frames",
+			self->damage_area_total);
+
+	metrics_write_family(w, "wayvnc_latency_seconds", "histogram",
+			"Time spent in each stage of the frame and input paths");
+	for (int i = 0; i < LATENCY_COUNT; ++i) {
+		snprintf(labels, sizeof(labels), "stage=\"%s\"",
+				latency_names[i]);
+		metrics_write_histogram(w, "wayvnc_latency_seconds", labels,
+				&self->latency[i]);
+	}
+
+#define WRITE_POOL_METRIC(w, name, type, help, field) do { \
+	metrics_write_family(w, name, type, help); \
+	int i = 0; \
+	for (struct wv_buffer_pool* pool = wv_buffer_pool_first(); pool; \
+			pool = wv_buffer_pool_next(pool), ++i) { \
+		char labels[64]; \
+		snprintf(labels, sizeof(labels), "pool=\"%d\",size=\"%dx%d\"", \
+				i, pool->stats.width, pool->stats.height); \
+		metrics_write_uint(w, name, labels, pool->stats.field); \
+	} \
+} while (0)
+
+	WRITE_POOL_METRIC(w, "wayvnc_buffer_pool_bytes", "gauge",
+			"Memory allocated for frame buffers", n_bytes);
+	WRITE_POOL_METRIC(w, "wayvnc_buffer_pool_buffers", "gauge",
+			"Frame buffers allocated", n_allocated);
+	WRITE_POOL_METRIC(w, "wayvnc_buffer_pool_buffers_in_use", "gauge",
+			"Frame buffers acquired and not yet released", n_in_use);
+	WRITE_POOL_METRIC(w, "wayvnc_buffer_pool_exhausted_total", "counter",
+			"Buffer acquisitions that failed because the pool was full",
+			n_exhausted);
+
+#undef WRITE_POOL_METRIC
+
+	write_metric(w, "wayvnc_clients", "gauge", "Connected VNC clients",
+			self->nr_clients);
+
+	metrics_write_family(w, "wayvnc_input_events_total", "counter",
+			"Input events received from VNC clients");
+	metrics_write_uint(w, "wayvnc_input_events_total", "type=\"pointer\"",
+			self->pointer_stats.n_received);
+	metrics_write_uint(w, "wayvnc_input_events_total", "type=\"key\"",
+			self->n_key_events);
+
+	metrics_write_family(w, "wayvnc_client_input_events_total", "counter",
+			"Input events received from each connected VNC client");
+	for (struct nvnc_client* nvnc_client = nvnc_client_first(self->nvnc);
+			nvnc_client;
+			nvnc_client = nvnc_client_next(nvnc_client)) {
+		struct wayvnc_client* client =
+			nvnc_client_get_userdata(nvnc_client);
+		snprintf(labels, sizeof(labels),
+				"client=\"%u\",type=\"pointer\"", client->id);
+		metrics_write_uint(w, "wayvnc_client_input_events_total",
+				labels, client->n_pointer_events);
+		snprintf(labels, sizeof(labels), "client=\"%u\",type=\"key\"",
+				client->id);
+		metrics_write_uint(w, "wayvnc_client_input_events_total",
+				labels, client->n_key_events);
+	}
+
+	write_metric(w, "wayvnc_pointer_events_forwarded_total", "counter",
+			"Pointer frames sent to the compositor",
+			self->pointer_stats.n_forwarded);
+
+	write_metric(w, "wayvnc_cursor_unchanged_total", "counter",
+			"Captured cursor images that did not change",
+			self->cursor_cache.stats.n_unchanged);
+	write_metric(w, "wayvnc_cursor_cache_hits_total", "counter",
+			"Cursor images that were found in the cursor cache",
+			self->cursor_cache.stats.n_hits);
+	write_metric(w, "wayvnc_cursor_cache_misses_total", "counter",
+			"Cursor images that were not found in the cursor cache",
+			self->cursor_cache.stats.n_misses);
+	write_metric(w, "wayvnc_cursor_captures_total", "counter",
+			"Cursor frames captured from the compositor",
+			self->cursor_capture_stats.n_frames);
+	write_metric(w, "wayvnc_cursor_captures_undamaged_total", "counter",
+			"Cursor frames that the compositor completed without damage",
+			self->cursor_capture_stats.n_undamaged_frames);
+	write_metric(w, "wayvnc_cursor_capture_timer_wakeups_total", "counter",
+			"Cursor captures started from the rate limiting timer",
+			self->cursor_capture_stats.n_timer_wakeups);
+
+	if (self->probe_input_latency) {
+		metrics_write_family(w, "wayvnc_input_probe_events_total",
+				"counter",
+				"Input events tracked by the input latency probe, by outcome");
+		metrics_write_uint(w, "wayvnc_input_probe_events_total",
+				"outcome=\"matched\"",
+				self->input_probe.stats.n_matched);
+		metrics_write_uint(w, "wayvnc_input_probe_events_total",
+				"outcome=\"expired\"",
+				self->input_probe.stats.n_expired);
+		metrics_write_uint(w, "wayvnc_input_probe_events_total",
+				"outcome=\"dropped\"",
+				self->input_probe.stats.n_dropped);
+	}
+
+	if (wayland) {
+		write_metric(w, "wayvnc_wayland_flushes_total", "counter",
+				"Flushes that sent data to the compositor",
+				wayland->flush_stats.n_flushes);
+		write_metric(w, "wayvnc_wayland_flush_bytes_total", "counter",
+				"Bytes sent to the compositor",
+				wayland->flush_stats.n_bytes);
+		write_metric(w, "wayvnc_wayland_flush_blocked_total",
+				"counter",
+				"Flushes that could not complete because the socket was full",
+				wayland->flush_stats.n_blocked);
+	}
+}
+
+static int wayvnc_start_metrics(struct wayvnc* self)
+{
+	if (self->cfg.metrics_socket) {
+		self->metrics = metrics_server_new_unix(self->cfg.metrics_socket,
+				wayvnc_collect_metrics, self);
+	} else if (self->cfg.metrics_port) {
+		if (self->cfg.metrics_port > UINT16_MAX) {
+			nvnc_log(NVNC_LOG_ERROR, "Invalid metrics_port: %u",
+					self->cfg.metrics_port);
+			return -1;
+		}
+		self->metrics = metrics_server_new_tcp(self->cfg.metrics_port,
+				wayvnc_collect_metrics, self);
+	} else {
+		return 0;
+	}
+
+	return self->metrics ? 0 : -1;
+}
+
+static void on_perf_tick(struct aml_ticker* obj)
+{
+	struct wayvnc* self = aml_get_userdata(obj);
+
+	if (self->show_performance)
+		log_performance(self);
+
+	struct ctl_server_latency stats[LATENCY_COUNT];
+	for (int i = 0; i < LATENCY_COUNT; ++i) {
+		stats[i].name = latency_names[i];
+		stats[i].histogram = &self->latency_interval[i];
+	}
+	if (self->ctl) {
+		struct wv_buffer_pool_stats* pools;
+		int n_pools = get_buffer_pool_stats(self->ctl, &pools);
+		if (n_pools < 0) {
+			pools = NULL;
+			n_pools = 0;
+		}
+		struct ctl_server_counter counters[MAX_COUNTERS];
+		int n_counters = wayvnc_get_counters(self, counters,
+				MAX_COUNTERS);
+		ctl_server_event_perf_stats(self->ctl, stats, LATENCY_COUNT,
+				pools, n_pools, counters, n_counters);
+		free(pools);
+	}
+
+	for (int i = 0; i < LATENCY_COUNT; ++i)
+		histogram_reset(&self->latency_interval[i]);
 
 	self->n_frames_captured = 0;
-	self->n_frames_sent = 0;
+	self->last_pipeline_stats = self->frame_pipeline.stats;
 	self->damage_area_sum = 0;
+
+	if (wayland)
+		self->last_flush_stats = wayland->flush_stats;
 }
 
 static void start_performance_ticker(struct wayvnc* self)
@@ -1678,6 +2297,7 @@ static struct wayvnc_client* client_create(struct wayvnc* wayvnc,
 	self->nvnc_client = nvnc_client;
 
 	self->id = next_client_id++;
+	self->last_update_request_time = gettime_us();
 
 	if (!wayvnc->cursor_master)
 		wayvnc->cursor_master = self;
@@ -1699,6 +2319,7 @@ static void client_destroy(void* obj)
 
 	if (self == wayvnc->cursor_master) {
 		nvnc_set_cursor(wayvnc->nvnc, NULL, 0, 0, false);
+		cursor_cache_reset(&wayvnc->cursor_cache);
 		screencopy_stop(wayvnc->cursor_sc);
 		screencopy_destroy(wayvnc->cursor_sc);
 		wayvnc->cursor_sc = NULL;
@@ -1810,6 +2431,7 @@ static void client_init_pointer(struct wayvnc_client* self)
 		output = output_from_image_source(wayvnc->image_source);
 
 	self->pointer.vnc = self->server->nvnc;
+	self->pointer.stats = &wayvnc->pointer_stats;
 
 	if (self->pointer.pointer)
 		pointer_destroy(&self->pointer);
@@ -1929,6 +2551,8 @@ static void client_init_keyboard(struct wayvnc_client* self)
 
 	if (keyboard_init(&self->keyboard, &rule_names) < 0) {
 		nvnc_log(NVNC_LOG_ERROR, "Failed to initialise keyboard");
+		keyboard_destroy(&self->keyboard);
+		self->keyboard.virtual_keyboard = NULL;
 	}
 }
 
@@ -1990,9 +2614,41 @@ void log_image_source(struct wayvnc* self)
 static void wayvnc_process_cursor(struct wayvnc* self, struct wv_buffer* buffer,
 		struct image_source* source)
 {
-	nvnc_log(NVNC_LOG_DEBUG, "Got new cursor");
 	bool is_damaged = pixman_region_not_empty(&buffer->frame_damage);
 
+	struct cursor_image image = {
+		.pixels = buffer->pixels,
+		.width = buffer->width,
+		.height = buffer->height,
+		.stride = buffer->stride,
+		.bytes_per_pixel = pixel_size_from_fourcc(buffer->format),
+		.format = buffer->format,
+		.x_hotspot = buffer->x_hotspot,
+		.y_hotspot = buffer->y_hotspot,
+	};
+
+	struct nvnc_frame* frame = NULL;
+	enum cursor_cache_result result = cursor_cache_lookup(
+			&self->cursor_cache, &image, is_damaged, &frame);
+
+	// New images have been copied into the cache by now
+	wv_buffer_release(buffer);
+
+	switch (result) {
+	case CURSOR_CACHE_UNCHANGED:
+		nvnc_trace("Cursor unchanged");
+		goto done;
+	case CURSOR_CACHE_HIT:
+		nvnc_log(NVNC_LOG_DEBUG, "Got cached cursor");
+		break;
+	case CURSOR_CACHE_MISS:
+		nvnc_log(NVNC_LOG_DEBUG, "Got new cursor");
+		break;
+	case CURSOR_CACHE_ERROR:
+		nvnc_log(NVNC_LOG_ERROR, "Failed to cache cursor");
+		goto done;
+	}
+
 	double h_scale = 1.0;
 	double v_scale = 1.0;
 	image_source_get_scale(source, &h_scale, &v_scale);
@@ -2001,19 +2657,17 @@ static void wayvnc_process_cursor(struct wayvnc* self, struct wv_buffer* buffer,
 	h_scale /= min_scale;
 	v_scale /= min_scale;
 
-	nvnc_frame_set_logical_width(buffer->nvnc_frame,
-			round(h_scale * nvnc_frame_get_width(buffer->nvnc_frame)));
-	nvnc_frame_set_logical_height(buffer->nvnc_frame,
-			round(v_scale * nvnc_frame_get_height(buffer->nvnc_frame)));
+	nvnc_frame_set_logical_width(frame,
+			round(h_scale * nvnc_frame_get_width(frame)));
+	nvnc_frame_set_logical_height(frame,
+			round(v_scale * nvnc_frame_get_height(frame)));
 
-	int x_hotspot = round(h_scale * buffer->x_hotspot);
-	int y_hotspot = round(v_scale * buffer->y_hotspot);
+	int x_hotspot = round(h_scale * image.x_hotspot);
+	int y_hotspot = round(v_scale * image.y_hotspot);
 
-	nvnc_set_cursor(self->nvnc, buffer->nvnc_frame, x_hotspot, y_hotspot,
-			is_damaged);
-
-	wv_buffer_release(buffer);
+	nvnc_set_cursor(self->nvnc, frame, x_hotspot, y_hotspot, true);
 
+done:
 	wayvnc_start_cursor_capture(self, false);
 }
 
@@ -2079,6 +2733,9 @@ static bool configure_cursor_sc(struct wayvnc* self,
 {
 	nvnc_log(NVNC_LOG_DEBUG, "Configuring cursor capturing");
 
+	// The scale may have changed, so the cursor must be sent again
+	cursor_cache_reset(&self->cursor_cache);
+
 	screencopy_stop(self->cursor_sc);
 	screencopy_destroy(self->cursor_sc);
 	self->cursor_sc = NULL;
@@ -2102,7 +2759,9 @@ static bool configure_cursor_sc(struct wayvnc* self,
 	self->cursor_sc->rate_format = rate_cursor_format;
 	self->cursor_sc->userdata = self;
 
-	self->cursor_sc->rate_limit = self->max_rate * 2;
+	// Only applies while the compositor sends cursor frames without damage
+	self->cursor_sc->rate_limit = self->max_rate;
+	self->cursor_sc->cursor_stats = &self->cursor_capture_stats;
 	self->cursor_sc->enable_linux_dmabuf = false;
 
 	nvnc_log(NVNC_LOG_DEBUG, "Configured cursor capturing");
@@ -2125,17 +2784,22 @@ bool configure_screencopy(struct wayvnc* self)
 	self->screencopy->rate_format = rate_output_format;
 	self->screencopy->userdata = self;
 
-	/* Because screencopy (at least the way it's implemented in wlroots),
-	 * does not capture immediately, but rather schedules a frame to be
-	 * captured on next output commit event, if we use the exact rate limit,
-	 * we'll sometimes hit the frame before commit and sometimes after.
-	 *
-	 * This is why we multiply the capture rate limit by 2 here and have a
-	 * secondary rate limiter for frames sent to VNC.
+	/* Screencopy does not capture immediately, but rather on the next
+	 * output commit. The capture scheduler learns the commit cadence from
+	 * presentation timestamps and places each capture just after the
+	 * expected commit, so there is no need to oversample here.
 	 */
-	self->screencopy->rate_limit = self->max_rate * 2;
+	self->screencopy->rate_limit = self->max_rate;
 	self->screencopy->enable_linux_dmabuf = self->enable_gpu_features;
 
+	if (self->cfg.capture_queue_depth)
+		self->screencopy->queue_depth =
+			MIN(self->cfg.capture_queue_depth, MAX_CAPTURE_QUEUE_DEPTH);
+
+	if (image_source_is_desktop(self->image_source))
+		desktop_capture_set_frame_grouping(self->screencopy,
+				self->cfg.desktop_frame_group);
+
 	return true;
 }
 
@@ -2204,6 +2868,7 @@ void switch_to_output(struct wayvnc* self, struct output* output)
 	if (self->nr_clients > 0)
 		wayvnc_start_capture_immediate(self);
 	screencopy_stop(self->cursor_sc);
+	cursor_cache_reset(&self->cursor_cache);
 	if (self->cursor_sc)
 		screencopy_start(self->cursor_sc, true);
 }
@@ -2428,6 +3093,7 @@ int main(int argc, char* argv[])
 	const char* seat_name = NULL;
 	const char* socket_path = NULL;
 	const char* toplevel_id;
+	const char* trace_path = NULL;
 
 	const char* keyboard_options = NULL;
 	char keyboard_options_buffer[256];
@@ -2502,6 +3168,8 @@ int main(int argc, char* argv[])
 		  "Create a websocket." },
 		{ 'x', "external-listener-fd", NULL,
 		  "The address is a pre-bound file descriptor.", },
+		{ 0, "record-trace", "<path>",
+		  "Record the damage of captured frames to a file." },
 		{}
 	};
 
@@ -2543,6 +3211,7 @@ int main(int argc, char* argv[])
 	use_transient_seat = !!option_parser_get_value(&option_parser,
 				"transient-seat");
 	toplevel_id = option_parser_get_value(&option_parser, "toplevel");
+	trace_path = option_parser_get_value(&option_parser, "record-trace");
 	start_detached = !!option_parser_get_value(&option_parser, "detached");
 	self.enable_resizing = !option_parser_get_value(&option_parser,
 			"disable-resizing");
@@ -2551,6 +3220,7 @@ int main(int argc, char* argv[])
 	self.exit_on_disconnect = exit_on_disconnect;
 	self.overlay_cursor = overlay_cursor;
 	self.max_rate = max_rate;
+	self.frame_pipeline.max_rate = max_rate;
 	self.enable_gpu_features = enable_gpu_features;
 	self.use_toplevel = !!toplevel_id;
 	self.selected_seat_name = seat_name;
@@ -2633,6 +3303,60 @@ int main(int argc, char* argv[])
 	if (check_cfg_sanity(&self.cfg) < 0)
 		return 1;
 
+	wv_buffer_pool_set_default_limits(self.cfg.buffer_pool_warmup,
+			self.cfg.buffer_pool_limit);
+	wv_buffer_set_shm_hugepages(self.cfg.enable_hugepages);
+
+	self.frame_pipeline.damage_simplify.tile_size =
+		self.cfg.damage_tile_size;
+	self.frame_pipeline.damage_simplify.max_overhead =
+		self.cfg.damage_merge_overhead;
+	self.frame_pipeline.damage_simplify.max_rects =
+		self.cfg.damage_max_rects;
+
+	if (parse_change_detection(self.cfg.change_detection,
+				&self.frame_pipeline.change_detection) < 0) {
+		nvnc_log(NVNC_LOG_ERROR, "Invalid value for change_detection: \"%s\". Expected auto, on or off",
+				self.cfg.change_detection);
+		return 1;
+	}
+
+	self.frame_pipeline.n_change_detection_threads =
+		self.cfg.change_detection_threads;
+	if (self.cfg.change_detection_cpus) {
+		self.frame_pipeline.n_change_detection_cpus = parse_cpu_list(
+				self.cfg.change_detection_cpus,
+				self.frame_pipeline.change_detection_cpus,
+				MAX_CHANGE_DETECTION_CPUS);
+		if (self.frame_pipeline.n_change_detection_cpus < 0) {
+			nvnc_log(NVNC_LOG_ERROR, "Invalid value for change_detection_cpus: \"%s\"",
+					self.cfg.change_detection_cpus);
+			return 1;
+		}
+	}
+
+	frame_pipeline_init(&self.frame_pipeline);
+	self.frame_pipeline.start_capture = wayvnc_start_frame_capture;
+	self.frame_pipeline.has_ready_client = wayvnc_has_ready_client;
+	self.frame_pipeline.get_damage = wayvnc_get_frame_damage;
+	self.frame_pipeline.on_feed = wayvnc_on_frame_feed;
+	self.frame_pipeline.record_latency = wayvnc_record_frame_latency;
+	self.frame_pipeline.userdata = &self;
+
+	cursor_cache_init(&self.cursor_cache);
+
+	self.probe_input_latency = self.cfg.input_latency_probe;
+	input_probe_init(&self.input_probe);
+
+	if (trace_path) {
+		self.damage_trace = damage_trace_create(trace_path);
+		if (!self.damage_trace) {
+			nvnc_log(NVNC_LOG_ERROR, "Failed to create damage trace \"%s\": %m",
+					trace_path);
+			goto failure;
+		}
+	}
+
 	self.disable_input = disable_input;
 	self.use_transient_seat = use_transient_seat;
 
@@ -2649,11 +3373,6 @@ int main(int argc, char* argv[])
 	if (init_main_loop(&self) < 0)
 		goto failure;
 
-	self.rate_limiter = aml_timer_new(0, wayvnc_handle_rate_limit_timeout,
-			&self, NULL);
-	if (!self.rate_limiter)
-		goto rate_limiter_failure;
-
 	if (output_name) {
 		self.image_source_type = IMAGE_SOURCE_TYPE_OUTPUT;
 		strlcpy(self.image_source_name, output_name,
@@ -2682,9 +3401,16 @@ int main(int argc, char* argv[])
 	if (use_websocket)
 		default_stream_type = NVNC_STREAM_WEBSOCKET;
 
-	if (show_performance)
-		self.performance_ticker = aml_ticker_new(1000000, on_perf_tick,
-				&self, NULL);
+	self.show_performance = show_performance;
+	self.performance_ticker = aml_ticker_new(1000000, on_perf_tick,
+			&self, NULL);
+	if (!self.performance_ticker)
+		goto performance_ticker_failure;
+
+	for (int i = 0; i < LATENCY_COUNT; ++i) {
+		histogram_reset(&self.latency[i]);
+		histogram_reset(&self.latency_interval[i]);
+	}
 
 	const struct ctl_server_actions ctl_actions = {
 		.userdata = &self,
@@ -2698,6 +3424,9 @@ int main(int argc, char* argv[])
 		.get_output_list = get_output_list,
 		.on_disconnect_client = on_disconnect_client,
 		.on_wayvnc_exit = on_wayvnc_exit,
+		.get_latency_stats = get_latency_stats,
+		.get_buffer_pool_stats = get_buffer_pool_stats,
+		.get_counters = get_counters,
 	};
 	self.ctl = ctl_server_new(socket_path, &ctl_actions);
 	if (!self.ctl)
@@ -2706,6 +3435,9 @@ int main(int argc, char* argv[])
 	if (init_nvnc(&self) < 0)
 		goto nvnc_failure;
 
+	if (wayvnc_start_metrics(&self) < 0)
+		goto nvnc_failure;
+
 	wayvnc_display_list_init(&self);
 	blank_screen(&self);
 
@@ -2753,7 +3485,13 @@ int main(int argc, char* argv[])
 
 	while (!self.do_exit) {
 		if (wayland)
-			wl_display_flush(wayland->display);
+			wayland_flush(wayland);
+
+		if (self.input_time) {
+			wayvnc_record_latency(&self, LATENCY_INPUT,
+					gettime_us() - self.input_time);
+			self.input_time = 0;
+		}
 
 		aml_poll(aml, -1);
 		aml_dispatch(aml);
@@ -2765,17 +3503,23 @@ int main(int argc, char* argv[])
 
 	ctl_server_destroy(self.ctl);
 	self.ctl = NULL;
+	metrics_server_destroy(self.metrics);
+	self.metrics = NULL;
 
 	wayvnc_display_list_deinit(&self.wayvnc_displays);
+	frame_pipeline_deinit(&self.frame_pipeline);
 	nvnc_del(self.nvnc);
 	self.nvnc = NULL;
 	wayland_destroy(wayland);
 	wayland = NULL;
 
-	aml_stop(aml, self.rate_limiter);
-	aml_unref(self.rate_limiter);
+	aml_stop(aml, self.performance_ticker);
+	aml_unref(self.performance_ticker);
+
 	aml_unref(aml);
 
+	cursor_cache_deinit(&self.cursor_cache);
+	damage_trace_close(self.damage_trace);
 	cfg_destroy(&self.cfg);
 
 	return 0;
@@ -2783,17 +3527,20 @@ int main(int argc, char* argv[])
 nvnc_failure:
 	ctl_server_destroy(self.ctl);
 	self.ctl = NULL;
+	metrics_server_destroy(self.metrics);
+	self.metrics = NULL;
 	wayvnc_display_list_deinit(&self.wayvnc_displays);
+	frame_pipeline_deinit(&self.frame_pipeline);
 	nvnc_del(self.nvnc);
 	self.nvnc = NULL;
 ctl_server_failure:
+	aml_unref(self.performance_ticker);
+performance_ticker_failure:
 	wayland_detach(&self);
 wayland_failure:
-rate_limiter_failure:
-	aml_stop(aml, self.rate_limiter);
-	aml_unref(self.rate_limiter);
 	aml_unref(aml);
 failure:
+	damage_trace_close(self.damage_trace);
 	cfg_destroy(&self.cfg);
 	return 1;
 }
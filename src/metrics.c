@@ -0,0 +1,497 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <aml.h>
+#include <neatvnc.h>
+
+#include "metrics.h"
+#include "histogram.h"
+#include "strlcpy.h"
+#include "sys/queue.h"
+
+#define REQUEST_MAX 1024
+
+// Upper bounds of the exported latency buckets in µs
+static const uint32_t latency_bounds[] = {
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000,
+	500000, 1000000,
+};
+
+struct metrics_client {
+	struct metrics_server* server;
+	int fd;
+	struct aml_handler* handler;
+	char request[REQUEST_MAX];
+	size_t request_len;
+	struct metrics_writer response;
+	size_t n_sent;
+	TAILQ_ENTRY(metrics_client) link;
+};
+
+TAILQ_HEAD(metrics_client_list, metrics_client);
+
+struct metrics_server {
+	int fd;
+	struct aml_handler* handler;
+	char socket_path[108];
+	metrics_collect_fn collect;
+	void* userdata;
+	struct metrics_client_list clients;
+	int n_clients;
+};
+
+void metrics_writer_init(struct metrics_writer* self)
+{
+	memset(self, 0, sizeof(*self));
+}
+
+void metrics_writer_destroy(struct metrics_writer* self)
+{
+	free(self->data);
+	memset(self, 0, sizeof(*self));
+}
+
+static int metrics_writer_reserve(struct metrics_writer* self, size_t n)
+{
+	if (self->error)
+		return -1;
+
+	if (self->len + n + 1 <= self->cap)
+		return 0;
+
+	size_t cap = self->cap ? self->cap : 4096;
+	while (cap < self->len + n + 1)
+		cap *= 2;
+
+	char* data = realloc(self->data, cap);
+	if (!data) {
+		self->error = 1;
+		return -1;
+	}
+
+	self->data = data;
+	self->cap = cap;
+	return 0;
+}
+
+static void metrics_writer_append(struct metrics_writer* self,
+		const char* data, size_t len)
+{
+	if (metrics_writer_reserve(self, len) < 0)
+		return;
+
+	memcpy(self->data + self->len, data, len);
+	self->len += len;
+	self->data[self->len] = '\0';
+}
+
+static void metrics_writer_printf(struct metrics_writer* self,
+		const char* fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void metrics_writer_printf(struct metrics_writer* self,
+		const char* fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	int n = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+
+	if (n < 0 || metrics_writer_reserve(self, n) < 0)
+		return;
+
+	va_start(args, fmt);
+	vsnprintf(self->data + self->len, n + 1, fmt, args);
+	va_end(args);
+
+	self->len += n;
+}
+
+void metrics_write_family(struct metrics_writer* self, const char* name,
+		const char* type, const char* help)
+{
+	if (help)
+		metrics_writer_printf(self, "# HELP %s %s\n", name, help);
+	metrics_writer_printf(self, "# TYPE %s %s\n", name, type);
+}
+
+void metrics_write_uint(struct metrics_writer* self, const char* name,
+		const char* labels, uint64_t value)
+{
+	if (labels)
+		metrics_writer_printf(self, "%s{%s} %"PRIu64"\n", name, labels,
+				value);
+	else
+		metrics_writer_printf(self, "%s %"PRIu64"\n", name, value);
+}
+
+void metrics_write_double(struct metrics_writer* self, const char* name,
+		const char* labels, double value)
+{
+	if (labels)
+		metrics_writer_printf(self, "%s{%s} %.9g\n", name, labels,
+				value);
+	else
+		metrics_writer_printf(self, "%s %.9g\n", name, value);
+}
+
+void metrics_write_histogram(struct metrics_writer* self, const char* name,
+		const char* labels, const struct histogram* histogram)
+{
+	const char* sep = labels ? "," : "";
+	if (!labels)
+		labels = "";
+
+	int n_bounds = sizeof(latency_bounds) / sizeof(latency_bounds[0]);
+	for (int i = 0; i < n_bounds; ++i)
+		metrics_writer_printf(self, "%s_bucket{%s%sle=\"%g\"} %"PRIu64"\n",
+				name, labels, sep, latency_bounds[i] * 1.0e-6,
+				histogram_count_le(histogram,
+					latency_bounds[i]));
+
+	metrics_writer_printf(self, "%s_bucket{%s%sle=\"+Inf\"} %"PRIu64"\n",
+			name, labels, sep, histogram->count);
+
+	const char* open = labels[0] ? "{" : "";
+	const char* close = labels[0] ? "}" : "";
+	metrics_writer_printf(self, "%s_sum%s%s%s %.6f\n", name, open, labels,
+			close, histogram->sum * 1.0e-6);
+	metrics_writer_printf(self, "%s_count%s%s%s %"PRIu64"\n", name, open,
+			labels, close, histogram->count);
+}
+
+static void client_destroy(struct metrics_client* self)
+{
+	struct metrics_server* server = self->server;
+
+	TAILQ_REMOVE(&server->clients, self, link);
+	server->n_clients--;
+
+	aml_stop(aml_get_default(), self->handler);
+	aml_unref(self->handler);
+	close(self->fd);
+	metrics_writer_destroy(&self->response);
+	free(self);
+}
+
+static void client_send(struct metrics_client* self)
+{
+	while (self->n_sent < self->response.len) {
+		ssize_t n = send(self->fd, self->response.data + self->n_sent,
+				self->response.len - self->n_sent,
+				MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			nvnc_log(NVNC_LOG_DEBUG, "Failed to send metrics: %m");
+			break;
+		}
+		self->n_sent += n;
+	}
+
+	client_destroy(self);
+}
+
+static void client_respond(struct metrics_client* self)
+{
+	struct metrics_server* server = self->server;
+	struct metrics_writer* response = &self->response;
+
+	if (strncmp(self->request, "GET ", 4) != 0) {
+		metrics_writer_printf(response, "HTTP/1.0 405 Method Not Allowed\r\n"
+				"Allow: GET\r\n"
+				"Content-Length: 0\r\n"
+				"Connection: close\r\n\r\n");
+		goto done;
+	}
+
+	struct metrics_writer body;
+	metrics_writer_init(&body);
+	server->collect(&body, server->userdata);
+
+	if (body.error) {
+		metrics_writer_printf(response, "HTTP/1.0 500 Internal Server Error\r\n"
+				"Content-Length: 0\r\n"
+				"Connection: close\r\n\r\n");
+	} else {
+		metrics_writer_printf(response, "HTTP/1.0 200 OK\r\n"
+				"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+				"Content-Length: %zu\r\n"
+				"Connection: close\r\n\r\n", body.len);
+		metrics_writer_append(response, body.data, body.len);
+	}
+
+	metrics_writer_destroy(&body);
+
+done:
+	if (response->error) {
+		client_destroy(self);
+		return;
+	}
+
+	aml_set_event_mask(self->handler, AML_EVENT_WRITE);
+	client_send(self);
+}
+
+static bool is_request_complete(const struct metrics_client* self)
+{
+	return strstr(self->request, "\r\n\r\n") || strstr(self->request, "\n\n")
+		|| self->request_len == REQUEST_MAX - 1;
+}
+
+static void client_receive(struct metrics_client* self)
+{
+	ssize_t n = recv(self->fd, self->request + self->request_len,
+			REQUEST_MAX - 1 - self->request_len, MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+
+	if (n <= 0) {
+		client_destroy(self);
+		return;
+	}
+
+	self->request_len += n;
+	self->request[self->request_len] = '\0';
+
+	if (is_request_complete(self))
+		client_respond(self);
+}
+
+static void on_client_ready(struct aml_handler* handler)
+{
+	struct metrics_client* client = aml_get_userdata(handler);
+	uint32_t events = aml_get_revents(handler);
+
+	if (client->response.len)
+		client_send(client);
+	else if (events & AML_EVENT_READ)
+		client_receive(client);
+}
+
+static void on_connection(struct aml_handler* handler)
+{
+	struct metrics_server* server = aml_get_userdata(handler);
+
+	int fd = accept4(server->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		nvnc_log(NVNC_LOG_DEBUG, "Failed to accept metrics connection: %m");
+		return;
+	}
+
+	if (server->n_clients >= METRICS_MAX_CLIENTS)
+		client_destroy(TAILQ_FIRST(&server->clients));
+
+	struct metrics_client* client = calloc(1, sizeof(*client));
+	if (!client)
+		goto alloc_failure;
+
+	client->server = server;
+	client->fd = fd;
+	metrics_writer_init(&client->response);
+
+	client->handler = aml_handler_new(fd, on_client_ready, client, NULL);
+	if (!client->handler)
+		goto handler_failure;
+
+	if (aml_start(aml_get_default(), client->handler) < 0)
+		goto start_failure;
+
+	TAILQ_INSERT_TAIL(&server->clients, client, link);
+	server->n_clients++;
+	return;
+
+start_failure:
+	aml_unref(client->handler);
+handler_failure:
+	free(client);
+alloc_failure:
+	close(fd);
+}
+
+static struct metrics_server* metrics_server_new(int domain,
+		metrics_collect_fn collect, void* userdata)
+{
+	struct metrics_server* self = calloc(1, sizeof(*self));
+	if (!self)
+		return NULL;
+
+	self->collect = collect;
+	self->userdata = userdata;
+	TAILQ_INIT(&self->clients);
+
+	self->fd = socket(domain, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (self->fd < 0) {
+		nvnc_log(NVNC_LOG_ERROR, "Failed to create metrics socket: %m");
+		free(self);
+		return NULL;
+	}
+
+	return self;
+}
+
+static int metrics_server_start(struct metrics_server* self)
+{
+	if (listen(self->fd, METRICS_MAX_CLIENTS) < 0) {
+		nvnc_log(NVNC_LOG_ERROR, "Failed to listen on metrics socket: %m");
+		return -1;
+	}
+
+	self->handler = aml_handler_new(self->fd, on_connection, self, NULL);
+	if (!self->handler)
+		return -1;
+
+	if (aml_start(aml_get_default(), self->handler) < 0) {
+		aml_unref(self->handler);
+		self->handler = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int cleanup_old_socket(const char* path, struct sockaddr_un* addr)
+{
+	struct stat sb;
+	if (stat(path, &sb) == -1)
+		return 0;
+
+	if (!S_ISSOCK(sb.st_mode)) {
+		nvnc_log(NVNC_LOG_ERROR, "Metrics socket path \"%s\" exists and is not a socket",
+				path);
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	int rc = connect(fd, (struct sockaddr*)addr, sizeof(*addr));
+	close(fd);
+	if (rc == 0) {
+		nvnc_log(NVNC_LOG_ERROR, "Metrics socket \"%s\" is already in use",
+				path);
+		return -1;
+	}
+
+	return unlink(path);
+}
+
+struct metrics_server* metrics_server_new_unix(const char* path,
+		metrics_collect_fn collect, void* userdata)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		nvnc_log(NVNC_LOG_ERROR, "Metrics socket path is too long: %s",
+				path);
+		return NULL;
+	}
+	strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+	struct metrics_server* self = metrics_server_new(AF_UNIX, collect,
+			userdata);
+	if (!self)
+		return NULL;
+
+	if (cleanup_old_socket(path, &addr) < 0)
+		goto failure;
+
+	if (bind(self->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		nvnc_log(NVNC_LOG_ERROR, "Failed to bind metrics socket \"%s\": %m",
+				path);
+		goto failure;
+	}
+	strlcpy(self->socket_path, path, sizeof(self->socket_path));
+
+	if (metrics_server_start(self) < 0)
+		goto failure;
+
+	nvnc_log(NVNC_LOG_INFO, "Serving metrics on %s", path);
+	return self;
+
+failure:
+	metrics_server_destroy(self);
+	return NULL;
+}
+
+struct metrics_server* metrics_server_new_tcp(uint16_t port,
+		metrics_collect_fn collect, void* userdata)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+
+	struct metrics_server* self = metrics_server_new(AF_INET, collect,
+			userdata);
+	if (!self)
+		return NULL;
+
+	int one = 1;
+	setsockopt(self->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (bind(self->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		nvnc_log(NVNC_LOG_ERROR, "Failed to bind metrics port %u: %m",
+				port);
+		goto failure;
+	}
+
+	if (metrics_server_start(self) < 0)
+		goto failure;
+
+	nvnc_log(NVNC_LOG_INFO, "Serving metrics on 127.0.0.1:%u", port);
+	return self;
+
+failure:
+	metrics_server_destroy(self);
+	return NULL;
+}
+
+void metrics_server_destroy(struct metrics_server* self)
+{
+	if (!self)
+		return;
+
+	while (!TAILQ_EMPTY(&self->clients))
+		client_destroy(TAILQ_FIRST(&self->clients));
+
+	if (self->handler) {
+		aml_stop(aml_get_default(), self->handler);
+		aml_unref(self->handler);
+	}
+
+	close(self->fd);
+	if (self->socket_path[0])
+		unlink(self->socket_path);
+	free(self);
+}
@@ -18,14 +18,54 @@
 #include <wayland-client-protocol.h>
 #include <wayland-client.h>
 #include <linux/input-event-codes.h>
+#include <aml.h>
 
 #include "pointer.h"
 #include "wlr-virtual-pointer-unstable-v1.h"
 #include "time-util.h"
 #include "image-source.h"
+#include "usdt.h"
+
+static void pointer_send_motion(struct pointer* self, uint32_t t)
+{
+	zwlr_virtual_pointer_v1_motion_absolute(self->pointer, t,
+			self->current_x * INT32_MAX,
+			self->current_y * INT32_MAX,
+			INT32_MAX, INT32_MAX);
+}
+
+static void pointer_send_frame(struct pointer* self)
+{
+	zwlr_virtual_pointer_v1_frame(self->pointer);
+	DTRACE_PROBE2(wayvnc, pointer_inject, self, self->current_mask);
+	if (self->stats)
+		self->stats->n_forwarded++;
+}
+
+static void pointer_flush_motion(struct pointer* self)
+{
+	if (!self->has_pending_motion)
+		return;
+
+	self->has_pending_motion = false;
+	aml_stop(aml_get_default(), self->motion_idle);
+
+	pointer_send_motion(self, self->pending_time);
+	pointer_send_frame(self);
+}
+
+static void on_motion_idle(struct aml_idle* idle)
+{
+	struct pointer* self = aml_get_userdata(idle);
+	pointer_flush_motion(self);
+}
 
 int pointer_init(struct pointer* self)
 {
+	self->motion_idle = aml_idle_new(on_motion_idle, self, NULL);
+	if (!self->motion_idle)
+		return -1;
+
 	zwlr_virtual_pointer_v1_axis_source(self->pointer,
 					    WL_POINTER_AXIS_SOURCE_WHEEL);
 	return 0;
@@ -33,6 +73,11 @@ int pointer_init(struct pointer* self)
 
 void pointer_destroy(struct pointer* self)
 {
+	if (self->motion_idle) {
+		pointer_flush_motion(self);
+		aml_unref(self->motion_idle);
+		self->motion_idle = NULL;
+	}
 	zwlr_virtual_pointer_v1_destroy(self->pointer);
 }
 
@@ -89,17 +134,35 @@ void pointer_set(struct pointer* self, double x, double y,
 		 enum nvnc_button_mask button_mask)
 {
 	uint32_t t = gettime_ms();
+	bool is_moved = x != self->current_x || y != self->current_y;
 
-	if (x != self->current_x || y != self->current_y)
-		zwlr_virtual_pointer_v1_motion_absolute(self->pointer, t,
-				x * INT32_MAX, y * INT32_MAX,
-				INT32_MAX, INT32_MAX);
+	if (self->stats)
+		self->stats->n_received++;
 
 	self->current_x = x;
 	self->current_y = y;
 
+	/* Consecutive motion events are coalesced, but never across button
+	 * changes.
+	 */
+	if (button_mask == self->current_mask && self->motion_idle) {
+		if (is_moved && !self->has_pending_motion) {
+			self->has_pending_motion = true;
+			aml_start(aml_get_default(), self->motion_idle);
+		}
+		self->pending_time = t;
+		return;
+	}
+
+	if (is_moved || self->has_pending_motion) {
+		if (self->has_pending_motion) {
+			self->has_pending_motion = false;
+			aml_stop(aml_get_default(), self->motion_idle);
+		}
+		pointer_send_motion(self, t);
+	}
+
 	if (button_mask != self->current_mask)
 		pointer_set_button_mask(self, t, button_mask);
-
-	zwlr_virtual_pointer_v1_frame(self->pointer);
+	pointer_send_frame(self);
 }
@@ -19,6 +19,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <sys/mman.h>
+#include <sys/param.h>
 #include <wayland-client.h>
 #include <libdrm/drm_fourcc.h>
 #include <aml.h>
@@ -35,66 +36,90 @@
 #include "image-source.h"
 #include "output.h"
 #include "wayland.h"
+#include "capture-scheduler.h"
+#include "sys/queue.h"
 
 extern struct wayland* wayland;
 
-enum wlr_screencopy_status {
-	WLR_SCREENCOPY_STOPPED = 0,
-	WLR_SCREENCOPY_IN_PROGRESS,
-	WLR_SCREENCOPY_FAILED,
-	WLR_SCREENCOPY_FATAL,
-	WLR_SCREENCOPY_DONE,
+struct wlr_screencopy;
+
+struct wlr_screencopy_frame {
+	TAILQ_ENTRY(wlr_screencopy_frame) link;
+	struct wlr_screencopy* parent;
+
+	struct zwlr_screencopy_frame_v1* frame;
+	struct wv_buffer* buffer;
+
+	bool is_immediate_copy;
+	bool is_ready;
+	uint64_t start_time;
+	uint64_t pts;
+
+	uint32_t wl_shm_width, wl_shm_height, wl_shm_stride;
+	enum wl_shm_format wl_shm_format;
+
+	bool have_linux_dmabuf;
+	uint32_t dmabuf_width, dmabuf_height;
+	uint32_t fourcc;
 };
 
+TAILQ_HEAD(wlr_screencopy_frame_queue, wlr_screencopy_frame);
+
 struct wlr_screencopy {
 	struct screencopy parent;
 
-	enum wlr_screencopy_status status;
-
 	struct wv_buffer_pool* pool;
-	struct wv_buffer* front;
-	struct wv_buffer* back;
 
-	struct zwlr_screencopy_frame_v1* frame;
+	/* Captures that have been requested from the compositor, in the order
+	 * in which they were requested. Frames are handed over to the user in
+	 * this order, and only if their pts is newer than the last one.
+	 */
+	struct wlr_screencopy_frame_queue frames;
+	int n_frames;
+	uint64_t last_pts;
+	struct pixman_region16 carried_damage;
 
-	uint64_t last_time;
+	struct capture_scheduler scheduler;
 	struct aml_timer* timer;
+	bool is_scheduled;
 
 	bool is_immediate_copy;
 	bool overlay_cursor;
 	struct output* output;
-
-	uint32_t wl_shm_width, wl_shm_height, wl_shm_stride;
-	enum wl_shm_format wl_shm_format;
-
-	bool have_linux_dmabuf;
-	uint32_t dmabuf_width, dmabuf_height;
-	uint32_t fourcc;
 };
 
 struct screencopy_impl wlr_screencopy_impl;
 
+static void screencopy_frame_destroy(struct wlr_screencopy_frame* frame)
+{
+	struct wlr_screencopy* self = frame->parent;
+
+	TAILQ_REMOVE(&self->frames, frame, link);
+	self->n_frames--;
+
+	if (frame->frame)
+		zwlr_screencopy_frame_v1_destroy(frame->frame);
+	if (frame->buffer)
+		wv_buffer_release(frame->buffer);
+	free(frame);
+}
+
 static void screencopy__stop(struct wlr_screencopy* self)
 {
 	aml_stop(aml_get_default(), self->timer);
+	self->is_scheduled = false;
 
-	self->status = WLR_SCREENCOPY_STOPPED;
+	while (!TAILQ_EMPTY(&self->frames))
+		screencopy_frame_destroy(TAILQ_FIRST(&self->frames));
 
-	if (self->frame) {
-		zwlr_screencopy_frame_v1_destroy(self->frame);
-		self->frame = NULL;
-	}
+	pixman_region_clear(&self->carried_damage);
+	self->last_pts = 0;
 }
 
 void wlr_screencopy_stop(struct screencopy* ptr)
 {
 	struct wlr_screencopy* self = (struct wlr_screencopy*)ptr;
-
-	if (self->front)
-		wv_buffer_release(self->front);
-	self->front = NULL;
-
-	return screencopy__stop(self);
+	screencopy__stop(self);
 }
 
 static void screencopy_linux_dmabuf(void* data,
@@ -102,7 +127,7 @@ static void screencopy_linux_dmabuf(void* data,
 			      uint32_t format, uint32_t width, uint32_t height)
 {
 #ifdef ENABLE_SCREENCOPY_DMABUF
-	struct wlr_screencopy* self = data;
+	struct wlr_screencopy_frame* self = data;
 
 	if (!(wv_buffer_get_available_types() & WV_BUFFER_DMABUF))
 		return;
@@ -114,14 +139,28 @@ static void screencopy_linux_dmabuf(void* data,
 #endif
 }
 
+/* Used when there are no buffers available. Other frames are still being
+ * processed, so try again once one of them is likely to have been released.
+ */
+static void screencopy__defer(struct wlr_screencopy* self)
+{
+	if (self->is_scheduled)
+		return;
+
+	self->is_scheduled = true;
+	aml_set_duration(self->timer, 1000000.0 / MAX(self->parent.rate_limit, 1.0));
+	aml_start(aml_get_default(), self->timer);
+}
+
 static void screencopy_buffer_done(void* data,
 			      struct zwlr_screencopy_frame_v1* frame)
 {
-	struct wlr_screencopy* self = data;
+	struct wlr_screencopy_frame* self = data;
+	struct wlr_screencopy* sc = self->parent;
 	struct wv_buffer_config config = {};
 
 #ifdef ENABLE_SCREENCOPY_DMABUF
-	if (self->have_linux_dmabuf && self->parent.enable_linux_dmabuf) {
+	if (self->have_linux_dmabuf && sc->parent.enable_linux_dmabuf) {
 		config.width = self->dmabuf_width;
 		config.height = self->dmabuf_height;
 		config.stride = 0;
@@ -137,20 +176,25 @@ static void screencopy_buffer_done(void* data,
 		config.type = WV_BUFFER_SHM;
 	}
 
-	wv_buffer_pool_reconfig(self->pool, &config);
+	wv_buffer_pool_reconfig(sc->pool, &config);
 
-	struct wv_buffer* buffer = wv_buffer_pool_acquire(self->pool);
+	struct wv_buffer* buffer = wv_buffer_pool_acquire(sc->pool);
+	if (!buffer && wv_buffer_pool_is_exhausted(sc->pool)) {
+		nvnc_trace("Buffer pool exhausted, deferring capture");
+		screencopy_frame_destroy(self);
+		screencopy__defer(sc);
+		return;
+	}
 	if (!buffer) {
-		screencopy__stop(self);
-		self->status = WLR_SCREENCOPY_FATAL;
-		self->parent.on_done(SCREENCOPY_FATAL, NULL,
-				&self->output->image_source,
-				self->parent.userdata);
+		screencopy__stop(sc);
+		sc->parent.on_done(SCREENCOPY_FATAL, NULL,
+				&sc->output->image_source,
+				sc->parent.userdata);
 		return;
 	}
 
-	assert(!self->front);
-	self->front = buffer;
+	assert(!self->buffer);
+	self->buffer = buffer;
 
 	if (self->is_immediate_copy)
 		zwlr_screencopy_frame_v1_copy(self->frame, buffer->wl_buffer);
@@ -164,7 +208,7 @@ static void screencopy_buffer(void* data,
 			      enum wl_shm_format format, uint32_t width,
 			      uint32_t height, uint32_t stride)
 {
-	struct wlr_screencopy* self = data;
+	struct wlr_screencopy_frame* self = data;
 
 	self->wl_shm_format = format;
 	self->wl_shm_width = width;
@@ -186,62 +230,95 @@ static void screencopy_flags(void* data,
 {
 	(void)frame;
 
-	struct wlr_screencopy* self = data;
+	struct wlr_screencopy_frame* self = data;
 
-	self->front->y_inverted =
+	self->buffer->y_inverted =
 		!!(flags & ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT);
 }
 
+static int wlr_screencopy_start(struct screencopy* ptr, bool is_immediate_copy);
+
+static void screencopy_deliver_frames(struct wlr_screencopy* self)
+{
+	struct wlr_screencopy_frame* frame;
+
+	while ((frame = TAILQ_FIRST(&self->frames)) && frame->is_ready) {
+		struct wv_buffer* buffer = frame->buffer;
+		uint64_t pts = frame->pts;
+		frame->buffer = NULL;
+		screencopy_frame_destroy(frame);
+
+		/* Frames that were waiting on the same commit come out with
+		 * the same image, so only the first one is delivered.
+		 */
+		if (self->last_pts && pts <= self->last_pts) {
+			// Keep the damage for the next frame that is delivered
+			pixman_region_union(&self->carried_damage,
+					&self->carried_damage,
+					&buffer->frame_damage);
+			wv_buffer_release(buffer);
+
+			// The user is still waiting for a frame
+			if (TAILQ_EMPTY(&self->frames))
+				wlr_screencopy_start(&self->parent, false);
+			continue;
+		}
+
+		pixman_region_union(&buffer->frame_damage,
+				&buffer->frame_damage, &self->carried_damage);
+		pixman_region_clear(&self->carried_damage);
+		self->last_pts = pts;
+
+		self->parent.on_done(SCREENCOPY_DONE, buffer,
+				&self->output->image_source,
+				self->parent.userdata);
+	}
+}
+
 static void screencopy_ready(void* data,
 			     struct zwlr_screencopy_frame_v1* frame,
 			     uint32_t sec_hi, uint32_t sec_lo, uint32_t nsec)
 {
-	(void)sec_hi;
-	(void)sec_lo;
-	(void)nsec;
-
-	struct wlr_screencopy* self = data;
+	struct wlr_screencopy_frame* self = data;
+	struct wlr_screencopy* sc = self->parent;
 
 	uint64_t sec = (uint64_t)sec_hi << 32 | (uint64_t)sec_lo;
 	uint64_t pts = sec * UINT64_C(1000000) + (uint64_t)nsec / UINT64_C(1000);
 
-	DTRACE_PROBE2(wayvnc, screencopy_ready, self, pts);
+	capture_scheduler_on_present(&sc->scheduler, pts);
 
-	screencopy__stop(self);
+	zwlr_screencopy_frame_v1_destroy(self->frame);
+	self->frame = NULL;
 
 	if (self->is_immediate_copy)
-		wv_buffer_damage_whole(self->front);
+		wv_buffer_damage_whole(self->buffer);
 
-	if (self->back)
-		wv_buffer_release(self->back);
-	self->back = self->front;
-	self->front = NULL;
+	nvnc_frame_set_pts(self->buffer->nvnc_frame, pts);
+	self->buffer->capture_time = self->start_time;
+	self->buffer->present_time = pts;
 
-	nvnc_frame_set_pts(self->back->nvnc_frame, pts);
+	DTRACE_PROBE4(wayvnc, screencopy_ready, sc, pts, self->buffer,
+			calculate_region_area(&self->buffer->frame_damage));
 
-	self->status = WLR_SCREENCOPY_DONE;
-	self->parent.on_done(SCREENCOPY_DONE, self->back,
-			&self->output->image_source, self->parent.userdata);
+	self->pts = pts;
+	self->is_ready = true;
 
-	self->back = NULL;
+	screencopy_deliver_frames(sc);
 }
 
 static void screencopy_failed(void* data,
 			      struct zwlr_screencopy_frame_v1* frame)
 {
-	struct wlr_screencopy* self = data;
+	struct wlr_screencopy_frame* self = data;
+	struct wlr_screencopy* sc = self->parent;
 
-	DTRACE_PROBE1(wayvnc, screencopy_failed, self);
-
-	screencopy__stop(self);
+	DTRACE_PROBE2(wayvnc, screencopy_failed, sc, 0);
 
-	if (self->front)
-		wv_buffer_release(self->front);
-	self->front = NULL;
+	screencopy_frame_destroy(self);
+	screencopy_deliver_frames(sc);
 
-	self->status = WLR_SCREENCOPY_FAILED;
-	self->parent.on_done(SCREENCOPY_FAILED, NULL,
-			&self->output->image_source, self->parent.userdata);
+	sc->parent.on_done(SCREENCOPY_FAILED, NULL,
+			&sc->output->image_source, sc->parent.userdata);
 }
 
 static void screencopy_damage(void* data,
@@ -249,16 +326,17 @@ static void screencopy_damage(void* data,
 			      uint32_t x, uint32_t y,
 			      uint32_t width, uint32_t height)
 {
-	struct wlr_screencopy* self = data;
+	struct wlr_screencopy_frame* self = data;
 
-	DTRACE_PROBE1(wayvnc, screencopy_damage, self);
+	DTRACE_PROBE5(wayvnc, screencopy_damage, self->parent, x, y, width,
+			height);
 
-	wv_buffer_damage_rect(self->front, x, y, width, height);
+	wv_buffer_damage_rect(self->buffer, x, y, width, height);
 }
 
 static int screencopy__start_capture(struct wlr_screencopy* self, uint64_t now)
 {
-	DTRACE_PROBE1(wayvnc, screencopy_start, self);
+	DTRACE_PROBE2(wayvnc, screencopy_start, self, self->n_frames + 1);
 
 	static const struct zwlr_screencopy_frame_v1_listener frame_listener = {
 		.buffer = screencopy_buffer,
@@ -270,16 +348,29 @@ static int screencopy__start_capture(struct wlr_screencopy* self, uint64_t now)
 		.damage = screencopy_damage,
 	};
 
-	self->frame = zwlr_screencopy_manager_v1_capture_output(
+	struct wlr_screencopy_frame* frame = calloc(1, sizeof(*frame));
+	if (!frame)
+		return -1;
+
+	frame->parent = self;
+	frame->is_immediate_copy = self->is_immediate_copy;
+	frame->start_time = now;
+
+	frame->frame = zwlr_screencopy_manager_v1_capture_output(
 			wayland->zwlr_screencopy_manager_v1,
 			self->overlay_cursor, self->output->wl_output);
-	if (!self->frame)
+	if (!frame->frame) {
+		free(frame);
 		return -1;
+	}
 
-	zwlr_screencopy_frame_v1_add_listener(self->frame, &frame_listener,
-					      self);
+	zwlr_screencopy_frame_v1_add_listener(frame->frame, &frame_listener,
+					      frame);
 
-	self->last_time = now;
+	TAILQ_INSERT_TAIL(&self->frames, frame, link);
+	self->n_frames++;
+
+	capture_scheduler_on_start(&self->scheduler, now);
 
 	return 0;
 }
@@ -288,6 +379,7 @@ static void screencopy__poll(struct aml_timer* handler)
 {
 	struct wlr_screencopy* self = aml_get_userdata(handler);
 	uint64_t now = gettime_us();
+	self->is_scheduled = false;
 	screencopy__start_capture(self, now);
 }
 
@@ -295,18 +387,18 @@ static int wlr_screencopy_start(struct screencopy* ptr, bool is_immediate_copy)
 {
 	struct wlr_screencopy* self = (struct wlr_screencopy*)ptr;
 
-	if (self->status == WLR_SCREENCOPY_IN_PROGRESS)
+	int queue_depth = ptr->queue_depth > 0 ? ptr->queue_depth : 1;
+	if (self->is_scheduled || self->n_frames >= queue_depth)
 		return 0;
 
 	self->is_immediate_copy = is_immediate_copy;
 
 	uint64_t now = gettime_us();
-	double dt = (now - self->last_time) * 1.0e-6;
-	int32_t time_left = (1.0 / ptr->rate_limit - dt) * 1.0e6;
-
-	self->status = WLR_SCREENCOPY_IN_PROGRESS;
+	int32_t time_left = capture_scheduler_get_delay(&self->scheduler,
+			ptr->rate_limit, now);
 
 	if (time_left > 0) {
+		self->is_scheduled = true;
 		aml_set_duration(self->timer, time_left);
 		return aml_start(aml_get_default(), self->timer);
 	}
@@ -328,10 +420,15 @@ static struct screencopy* wlr_screencopy_create(struct image_source* source,
 
 	self->parent.impl = &wlr_screencopy_impl;
 	self->parent.rate_limit = 30;
+	self->parent.queue_depth = 1;
 
 	self->output = output_from_image_source(source);
 	self->overlay_cursor = render_cursor;
 
+	TAILQ_INIT(&self->frames);
+	pixman_region_init(&self->carried_damage);
+	capture_scheduler_init(&self->scheduler);
+
 	self->pool = wv_buffer_pool_create(NULL);
 	assert(self->pool);
 
@@ -344,16 +441,11 @@ static struct screencopy* wlr_screencopy_create(struct image_source* source,
 static void wlr_screencopy_destroy(struct screencopy* ptr)
 {
 	struct wlr_screencopy* self = (struct wlr_screencopy*)ptr;
-	aml_stop(aml_get_default(), self->timer);
-	aml_unref(self->timer);
 
-	if (self->back)
-		wv_buffer_release(self->back);
-	if (self->front)
-		wv_buffer_release(self->front);
-	self->back = NULL;
-	self->front = NULL;
+	screencopy__stop(self);
+	aml_unref(self->timer);
 
+	pixman_region_fini(&self->carried_damage);
 	wv_buffer_pool_destroy(self->pool);
 	free(self);
 }
@@ -15,12 +15,16 @@
  */
 
 #include <errno.h>
+#include <stdbool.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "config.h"
+#include "util.h"
+#include "shm.h"
 
 // Linux with glibc < 2.27 has no wrapper
 #if defined(HAVE_MEMFD) && !defined(HAVE_MEMFD_CREATE)
@@ -45,10 +49,19 @@ static void randname(char *buf)
 }
 #endif
 
+#ifdef HAVE_MEMFD
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+#endif
+
 static int create_shm_file(void)
 {
 #ifdef HAVE_MEMFD
-	return memfd_create("wayvnc-shm", 0);
+	return memfd_create("wayvnc-shm", MFD_ALLOW_SEALING);
 #elif defined(__FreeBSD__)
 	// memfd_create added in FreeBSD 13, but SHM_ANON has been supported for ages
 	return shm_open(SHM_ANON, O_RDWR | O_CREAT | O_EXCL, 0600);
@@ -71,21 +84,104 @@ static int create_shm_file(void)
 #endif
 }
 
+static int resize_shm_file(int fd, size_t size)
+{
+	int ret;
+	do {
+		ret = ftruncate(fd, size);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+/* The compositor may get SIGBUS if the file shrinks while it is mapped, so the
+ * size is sealed. This is best effort.
+ */
+static void seal_shm_file(int fd, bool seal_write)
+{
+#ifdef F_ADD_SEALS
+	int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+	if (seal_write)
+		seals |= F_SEAL_WRITE;
+	fcntl(fd, F_ADD_SEALS, seals);
+#endif
+}
+
 int shm_alloc_fd(size_t size)
 {
 	int fd = create_shm_file();
 	if (fd < 0)
 		return -1;
 
-	int ret;
-	do {
-		ret = ftruncate(fd, size);
-	} while (ret < 0 && errno == EINTR);
+	if (resize_shm_file(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	seal_shm_file(fd, false);
+	return fd;
+}
 
-	if (ret < 0) {
+int shm_alloc_sealed_fd(const void* data, size_t size)
+{
+	int fd = create_shm_file();
+	if (fd < 0)
+		return -1;
+
+	if (resize_shm_file(fd, size) < 0)
+		goto failure;
+
+	size_t written = 0;
+	while (written < size) {
+		ssize_t ret = pwrite(fd, (const char*)data + written,
+				size - written, written);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			goto failure;
+		written += ret;
+	}
+
+	seal_shm_file(fd, true);
+	return fd;
+
+failure:
+	close(fd);
+	return -1;
+}
+
+int shm_alloc_hugetlb_fd(size_t* size)
+{
+#if defined(HAVE_MEMFD) && defined(__linux__)
+	int fd = memfd_create("wayvnc-shm", MFD_HUGETLB | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -1;
+
+	// On hugetlbfs, the block size is the huge page size
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_blksize <= 0) {
+		close(fd);
+		return -1;
+	}
+
+	size_t aligned_size = ALIGN_UP(*size, (size_t)st.st_blksize);
+	if (resize_shm_file(fd, aligned_size) < 0) {
 		close(fd);
 		return -1;
 	}
+	seal_shm_file(fd, false);
 
+	*size = aligned_size;
 	return fd;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+void shm_advise_hugepages(void* addr, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+	madvise(addr, size, MADV_HUGEPAGE);
+#endif
 }
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "tile-hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pixman.h>
+#include <sys/param.h>
+
+/* The hash uses the round function from xxHash64 on four independent lanes.
+ * The lanes have no dependency on each other, so the multiplications can be
+ * pipelined or vectorised by the compiler.
+ */
+#define PRIME64_1 UINT64_C(0x9e3779b185ebca87)
+#define PRIME64_2 UINT64_C(0xc2b2ae3d27d4eb4f)
+#define PRIME64_3 UINT64_C(0x165667b19e3779f9)
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline uint64_t load64(const uint8_t* p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint64_t tile_hash_pixels(const void* data, int stride, size_t row_size,
+		int height)
+{
+	const uint8_t* pixels = data;
+	uint64_t lane[4] = {
+		PRIME64_1 + PRIME64_2,
+		PRIME64_2,
+		0,
+		-PRIME64_1,
+	};
+
+	for (int y = 0; y < height; ++y) {
+		const uint8_t* row = pixels + (size_t)y * stride;
+		size_t x = 0;
+
+		for (; x + 32 <= row_size; x += 32) {
+			lane[0] = round64(lane[0], load64(row + x));
+			lane[1] = round64(lane[1], load64(row + x + 8));
+			lane[2] = round64(lane[2], load64(row + x + 16));
+			lane[3] = round64(lane[3], load64(row + x + 24));
+		}
+
+		for (; x + 8 <= row_size; x += 8)
+			lane[0] = round64(lane[0], load64(row + x));
+
+		if (x < row_size) {
+			uint64_t tail = 0;
+			memcpy(&tail, row + x, row_size - x);
+			lane[1] = round64(lane[1], tail);
+		}
+	}
+
+	uint64_t h = rotl64(lane[0], 1) + rotl64(lane[1], 7) +
+		rotl64(lane[2], 12) + rotl64(lane[3], 18);
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+int tile_hash_init(struct tile_hash* self, int width, int height)
+{
+	memset(self, 0, sizeof(*self));
+
+	self->width = width;
+	self->height = height;
+	self->n_cols = howmany(width, TILE_HASH_SIZE);
+	self->n_rows = howmany(height, TILE_HASH_SIZE);
+
+	size_t n_tiles = (size_t)self->n_cols * self->n_rows;
+	self->hashes = calloc(n_tiles, sizeof(*self->hashes));
+	self->states = calloc(n_tiles, sizeof(*self->states));
+	if (!self->hashes || !self->states) {
+		tile_hash_deinit(self);
+		return -1;
+	}
+
+	return 0;
+}
+
+void tile_hash_deinit(struct tile_hash* self)
+{
+	free(self->states);
+	free(self->hashes);
+	memset(self, 0, sizeof(*self));
+}
+
+void tile_hash_begin(struct tile_hash* self,
+		struct pixman_region16* damage)
+{
+	size_t n_tiles = (size_t)self->n_cols * self->n_rows;
+
+	// Without hashes from a previous frame, every tile must be hashed
+	if (!self->is_valid) {
+		memset(self->states, TILE_HASH_CHECK, n_tiles);
+		return;
+	}
+
+	memset(self->states, TILE_HASH_SKIP, n_tiles);
+
+	int n_rects = 0;
+	pixman_box16_t* rects = pixman_region_rectangles(damage, &n_rects);
+
+	for (int i = 0; i < n_rects; ++i) {
+		int x1 = MAX(rects[i].x1, 0) / TILE_HASH_SIZE;
+		int y1 = MAX(rects[i].y1, 0) / TILE_HASH_SIZE;
+		int x2 = MIN(howmany(rects[i].x2, TILE_HASH_SIZE), self->n_cols);
+		int y2 = MIN(howmany(rects[i].y2, TILE_HASH_SIZE), self->n_rows);
+
+		for (int y = y1; y < y2; ++y)
+			for (int x = x1; x < x2; ++x)
+				self->states[y * self->n_cols + x] =
+					TILE_HASH_CHECK;
+	}
+}
+
+void tile_hash_update(struct tile_hash* self, const void* pixels, int stride,
+		int bytes_per_pixel, int row_begin, int row_end)
+{
+	const uint8_t* bytes = pixels;
+
+	for (int row = row_begin; row < row_end; ++row) {
+		int y = row * TILE_HASH_SIZE;
+		int height = MIN(TILE_HASH_SIZE, self->height - y);
+
+		for (int col = 0; col < self->n_cols; ++col) {
+			int index = row * self->n_cols + col;
+			if (self->states[index] != TILE_HASH_CHECK)
+				continue;
+
+			int x = col * TILE_HASH_SIZE;
+			int width = MIN(TILE_HASH_SIZE, self->width - x);
+
+			uint64_t hash = tile_hash_pixels(bytes + (size_t)y * stride +
+					(size_t)x * bytes_per_pixel, stride,
+					(size_t)width * bytes_per_pixel, height);
+
+			self->states[index] = hash == self->hashes[index] ?
+				TILE_HASH_UNCHANGED : TILE_HASH_CHANGED;
+			self->hashes[index] = hash;
+		}
+	}
+}
+
+void tile_hash_end(struct tile_hash* self, struct pixman_region16* damage)
+{
+	// The first frame only seeds the hashes
+	if (!self->is_valid) {
+		self->is_valid = true;
+		return;
+	}
+
+	struct pixman_region16 changed;
+	pixman_region_init(&changed);
+
+	for (int row = 0; row < self->n_rows; ++row) {
+		const uint8_t* states = &self->states[row * self->n_cols];
+
+		// Consecutive changed tiles are added as one rectangle
+		for (int col = 0; col < self->n_cols;) {
+			if (states[col] != TILE_HASH_CHANGED) {
+				++col;
+				continue;
+			}
+
+			int start = col;
+			while (col < self->n_cols &&
+					states[col] == TILE_HASH_CHANGED)
+				++col;
+
+			pixman_region_union_rect(&changed, &changed,
+					start * TILE_HASH_SIZE,
+					row * TILE_HASH_SIZE,
+					(col - start) * TILE_HASH_SIZE,
+					TILE_HASH_SIZE);
+		}
+	}
+
+	pixman_region_intersect(damage, damage, &changed);
+	pixman_region_fini(&changed);
+}
+
+void tile_hash_apply(struct tile_hash* self, const void* pixels, int stride,
+		int bytes_per_pixel, struct pixman_region16* damage)
+{
+	tile_hash_begin(self, damage);
+	tile_hash_update(self, pixels, stride, bytes_per_pixel, 0,
+			self->n_rows);
+	tile_hash_end(self, damage);
+}
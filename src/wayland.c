@@ -248,9 +248,51 @@ static void registry_remove(void* data, struct wl_registry* registry,
 	}
 }
 
+static void wayland_set_flush_blocked(struct wayland* self, bool is_blocked)
+{
+	if (self->is_flush_blocked == is_blocked)
+		return;
+
+	self->is_flush_blocked = is_blocked;
+	aml_set_event_mask(self->wl_handler, is_blocked ?
+			AML_EVENT_READ | AML_EVENT_WRITE : AML_EVENT_READ);
+}
+
+static void wayland_do_flush(struct wayland* self)
+{
+	int rc = wl_display_flush(self->display);
+	if (rc > 0) {
+		self->flush_stats.n_flushes++;
+		self->flush_stats.n_bytes += rc;
+	}
+
+	if (rc < 0 && errno == EAGAIN) {
+		// Try again once the compositor has drained the socket
+		self->flush_stats.n_blocked++;
+		wayland_set_flush_blocked(self, true);
+		return;
+	}
+
+	// Other errors are caught when reading
+	wayland_set_flush_blocked(self, false);
+}
+
+void wayland_flush(struct wayland* self)
+{
+	if (!self->is_flush_blocked)
+		wayland_do_flush(self);
+}
+
 static void on_wayland_event(struct aml_handler* handler)
 {
 	struct wayland* self = aml_get_userdata(handler);
+	uint32_t events = aml_get_revents(handler);
+
+	if (events & AML_EVENT_WRITE)
+		wayland_do_flush(self);
+
+	if (!(events & AML_EVENT_READ))
+		return;
 
 	int rc MAYBE_UNUSED = wl_display_prepare_read(self->display);
 	assert(rc == 0);
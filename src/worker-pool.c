@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "worker-pool.h"
+#include "time-util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <aml.h>
+#include <neatvnc.h>
+
+#ifdef __FreeBSD__
+#include <pthread_np.h>
+typedef cpuset_t cpu_set_t;
+#endif
+
+struct worker_pool {
+	int n_threads;
+	pthread_t* threads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool do_exit;
+
+	/* The current job. All fields are protected by the mutex, except
+	 * for stripe_times, where each element is written by the worker that
+	 * processes the stripe.
+	 */
+	uint64_t job_id;
+	bool is_busy;
+	int n_stripes;
+	int next_stripe;
+	int n_stripes_done;
+	uint64_t* stripe_times;
+	worker_pool_stripe_fn stripe_fn;
+	worker_pool_done_fn done_fn;
+	void* userdata;
+
+	/* Written by the last worker of a job to wake up the main loop */
+	int notify_fds[2];
+	struct aml_handler* handler;
+};
+
+static void* worker_main(void* arg)
+{
+	struct worker_pool* self = arg;
+	uint64_t last_job_id = 0;
+
+	pthread_mutex_lock(&self->mutex);
+
+	while (!self->do_exit) {
+		if (!self->is_busy || self->job_id == last_job_id ||
+				self->next_stripe >= self->n_stripes) {
+			pthread_cond_wait(&self->cond, &self->mutex);
+			continue;
+		}
+
+		int stripe = self->next_stripe++;
+		if (self->next_stripe >= self->n_stripes)
+			last_job_id = self->job_id;
+
+		worker_pool_stripe_fn stripe_fn = self->stripe_fn;
+		void* userdata = self->userdata;
+		pthread_mutex_unlock(&self->mutex);
+
+		uint64_t start_time = gettime_us();
+		stripe_fn(userdata, stripe);
+		self->stripe_times[stripe] = gettime_us() - start_time;
+
+		pthread_mutex_lock(&self->mutex);
+		if (++self->n_stripes_done == self->n_stripes) {
+			char c = 0;
+			if (write(self->notify_fds[1], &c, 1) < 0)
+				nvnc_log(NVNC_LOG_ERROR, "Failed to notify main loop: %m");
+			pthread_cond_broadcast(&self->cond);
+		}
+	}
+
+	pthread_mutex_unlock(&self->mutex);
+	return NULL;
+}
+
+static void worker_pool_drain_notification(struct worker_pool* self)
+{
+	char buf[16];
+	while (read(self->notify_fds[0], buf, sizeof(buf)) > 0);
+}
+
+static void on_notify(struct aml_handler* handler)
+{
+	struct worker_pool* self = aml_get_userdata(handler);
+
+	worker_pool_drain_notification(self);
+
+	pthread_mutex_lock(&self->mutex);
+	bool is_done = self->is_busy &&
+		self->n_stripes_done == self->n_stripes;
+	if (is_done)
+		self->is_busy = false;
+	pthread_mutex_unlock(&self->mutex);
+
+	if (!is_done)
+		return;
+
+	self->done_fn(self->userdata, self->stripe_times, self->n_stripes);
+}
+
+static void pin_thread(pthread_t thread, int cpu)
+{
+	if (cpu >= CPU_SETSIZE) {
+		nvnc_log(NVNC_LOG_WARNING, "CPU %d is out of range", cpu);
+		return;
+	}
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	int rc = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (rc != 0)
+		nvnc_log(NVNC_LOG_WARNING, "Failed to pin worker thread to CPU %d: %s",
+				cpu, strerror(rc));
+}
+
+struct worker_pool* worker_pool_create(int n_threads, const int* cpus,
+		int n_cpus)
+{
+	struct worker_pool* self = calloc(1, sizeof(*self));
+	if (!self)
+		return NULL;
+
+	self->n_threads = n_threads;
+	self->notify_fds[0] = -1;
+	self->notify_fds[1] = -1;
+
+	pthread_mutex_init(&self->mutex, NULL);
+	pthread_cond_init(&self->cond, NULL);
+
+	if (pipe2(self->notify_fds, O_CLOEXEC | O_NONBLOCK) < 0)
+		goto failure;
+
+	self->handler = aml_handler_new(self->notify_fds[0], on_notify, self,
+			NULL);
+	if (!self->handler)
+		goto failure;
+
+	if (aml_start(aml_get_default(), self->handler) < 0)
+		goto failure;
+
+	self->threads = calloc(n_threads, sizeof(*self->threads));
+	if (!self->threads)
+		goto failure;
+
+	for (int i = 0; i < n_threads; ++i) {
+		if (pthread_create(&self->threads[i], NULL, worker_main,
+					self) != 0) {
+			self->n_threads = i;
+			goto failure;
+		}
+
+		if (n_cpus > 0)
+			pin_thread(self->threads[i], cpus[i % n_cpus]);
+	}
+
+	return self;
+
+failure:
+	nvnc_log(NVNC_LOG_ERROR, "Failed to create worker pool: %m");
+	worker_pool_destroy(self);
+	return NULL;
+}
+
+void worker_pool_destroy(struct worker_pool* self)
+{
+	if (!self)
+		return;
+
+	pthread_mutex_lock(&self->mutex);
+	self->do_exit = true;
+	pthread_cond_broadcast(&self->cond);
+	pthread_mutex_unlock(&self->mutex);
+
+	for (int i = 0; i < self->n_threads; ++i)
+		pthread_join(self->threads[i], NULL);
+
+	if (self->handler) {
+		aml_stop(aml_get_default(), self->handler);
+		aml_unref(self->handler);
+	}
+
+	if (self->notify_fds[0] >= 0) {
+		close(self->notify_fds[0]);
+		close(self->notify_fds[1]);
+	}
+
+	pthread_cond_destroy(&self->cond);
+	pthread_mutex_destroy(&self->mutex);
+	free(self->stripe_times);
+	free(self->threads);
+	free(self);
+}
+
+int worker_pool_get_n_threads(const struct worker_pool* self)
+{
+	return self->n_threads;
+}
+
+bool worker_pool_is_busy(const struct worker_pool* self)
+{
+	return self->is_busy;
+}
+
+int worker_pool_run(struct worker_pool* self, int n_stripes,
+		worker_pool_stripe_fn stripe_fn, worker_pool_done_fn done_fn,
+		void* userdata)
+{
+	if (self->is_busy || n_stripes <= 0)
+		return -1;
+
+	uint64_t* stripe_times = realloc(self->stripe_times,
+			n_stripes * sizeof(*stripe_times));
+	if (!stripe_times)
+		return -1;
+
+	pthread_mutex_lock(&self->mutex);
+	self->stripe_times = stripe_times;
+	self->job_id++;
+	self->is_busy = true;
+	self->n_stripes = n_stripes;
+	self->next_stripe = 0;
+	self->n_stripes_done = 0;
+	self->stripe_fn = stripe_fn;
+	self->done_fn = done_fn;
+	self->userdata = userdata;
+	pthread_cond_broadcast(&self->cond);
+	pthread_mutex_unlock(&self->mutex);
+
+	return 0;
+}
+
+void worker_pool_wait(struct worker_pool* self)
+{
+	pthread_mutex_lock(&self->mutex);
+	while (self->is_busy && self->n_stripes_done < self->n_stripes)
+		pthread_cond_wait(&self->cond, &self->mutex);
+	pthread_mutex_unlock(&self->mutex);
+}
@@ -0,0 +1,78 @@
+#include "tst.h"
+#include "capture-scheduler.h"
+
+static int test_no_cadence_uses_rate_limit(void)
+{
+	struct capture_scheduler scheduler;
+	capture_scheduler_init(&scheduler);
+
+	ASSERT_INT32_EQ(0, capture_scheduler_get_delay(&scheduler, 50, 1000000));
+
+	capture_scheduler_on_start(&scheduler, 1000000);
+	ASSERT_INT32_EQ(20000, capture_scheduler_get_delay(&scheduler, 50,
+				1000000));
+	ASSERT_INT32_EQ(5000, capture_scheduler_get_delay(&scheduler, 50,
+				1015000));
+	ASSERT_INT32_EQ(0, capture_scheduler_get_delay(&scheduler, 50,
+				1030000));
+	return 0;
+}
+
+static int test_learn_interval(void)
+{
+	struct capture_scheduler scheduler;
+	capture_scheduler_init(&scheduler);
+
+	capture_scheduler_on_present(&scheduler, 1000000);
+	ASSERT_UINT32_EQ(0, capture_scheduler_get_interval(&scheduler));
+
+	capture_scheduler_on_present(&scheduler, 1016000);
+	ASSERT_UINT32_EQ(16000, capture_scheduler_get_interval(&scheduler));
+
+	// Frames that span several commits count as one commit each
+	capture_scheduler_on_present(&scheduler, 1064000);
+	ASSERT_UINT32_EQ(16000, capture_scheduler_get_interval(&scheduler));
+
+	// Idle gaps are ignored
+	capture_scheduler_on_present(&scheduler, 5000000);
+	ASSERT_UINT32_EQ(16000, capture_scheduler_get_interval(&scheduler));
+
+	// Timestamps going backwards are ignored
+	capture_scheduler_on_present(&scheduler, 4000000);
+	ASSERT_UINT32_EQ(16000, capture_scheduler_get_interval(&scheduler));
+	return 0;
+}
+
+static int test_align_to_commit(void)
+{
+	struct capture_scheduler scheduler;
+	capture_scheduler_init(&scheduler);
+
+	capture_scheduler_on_present(&scheduler, 1000000);
+	capture_scheduler_on_present(&scheduler, 1016000);
+	capture_scheduler_on_start(&scheduler, 1017000);
+
+	/* The rate limit allows a capture at 1037000, and the next commit
+	 * after that is expected at 1048000.
+	 */
+	int32_t delay = capture_scheduler_get_delay(&scheduler, 50, 1020000);
+	ASSERT_INT32_GT(28000, delay);
+	ASSERT_INT32_GE(0, 29000 - delay);
+
+	// Stale timestamps are not trusted
+	delay = capture_scheduler_get_delay(&scheduler, 50, 3000000);
+	ASSERT_INT32_EQ(0, delay);
+
+	capture_scheduler_reset(&scheduler);
+	ASSERT_UINT32_EQ(0, capture_scheduler_get_interval(&scheduler));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_no_cadence_uses_rate_limit);
+	RUN_TEST(test_learn_interval);
+	RUN_TEST(test_align_to_commit);
+	return r;
+}
@@ -0,0 +1,175 @@
+#include "tst.h"
+#include "cursor-cache.h"
+
+#include <neatvnc.h>
+#include <string.h>
+
+#define SIZE 16
+
+static uint32_t arrow[SIZE * SIZE];
+static uint32_t ibeam[SIZE * SIZE];
+static uint32_t hand[SIZE * SIZE];
+
+static void init_images(void)
+{
+	for (int i = 0; i < SIZE * SIZE; ++i) {
+		arrow[i] = 0xff000000 | i;
+		ibeam[i] = 0xff100000 | i;
+		hand[i] = 0xff200000 | i;
+	}
+}
+
+static struct cursor_image make_image(const uint32_t* pixels, int x_hotspot,
+		int y_hotspot)
+{
+	return (struct cursor_image){
+		.pixels = pixels,
+		.width = SIZE,
+		.height = SIZE,
+		.stride = SIZE * 4,
+		.bytes_per_pixel = 4,
+		.format = 0x34325241, // ARGB8888
+		.x_hotspot = x_hotspot,
+		.y_hotspot = y_hotspot,
+	};
+}
+
+static int test_unchanged_is_suppressed(void)
+{
+	struct cursor_cache cache;
+	cursor_cache_init(&cache);
+
+	struct cursor_image image = make_image(arrow, 0, 0);
+	struct nvnc_frame* first = NULL;
+	struct nvnc_frame* frame = NULL;
+
+	ASSERT_INT_EQ(CURSOR_CACHE_MISS,
+			cursor_cache_lookup(&cache, &image, true, &first));
+	ASSERT_TRUE(first);
+	ASSERT_INT_EQ(0, memcmp(arrow, nvnc_frame_get_addr(first),
+				sizeof(arrow)));
+
+	// Same content, reported as damaged
+	ASSERT_INT_EQ(CURSOR_CACHE_UNCHANGED,
+			cursor_cache_lookup(&cache, &image, true, &frame));
+	ASSERT_PTR_EQ(first, frame);
+
+	// Not damaged
+	ASSERT_INT_EQ(CURSOR_CACHE_UNCHANGED,
+			cursor_cache_lookup(&cache, &image, false, &frame));
+	ASSERT_PTR_EQ(first, frame);
+
+	ASSERT_UINT_EQ(2, cache.stats.n_unchanged);
+	ASSERT_UINT_EQ(1, cache.stats.n_misses);
+
+	cursor_cache_deinit(&cache);
+	return 0;
+}
+
+static int test_recent_shapes_are_hits(void)
+{
+	struct cursor_cache cache;
+	cursor_cache_init(&cache);
+
+	struct cursor_image a = make_image(arrow, 0, 0);
+	struct cursor_image b = make_image(ibeam, 4, 8);
+	struct cursor_image c = make_image(hand, 6, 0);
+	struct nvnc_frame* frame_a = NULL;
+	struct nvnc_frame* frame = NULL;
+
+	ASSERT_INT_EQ(CURSOR_CACHE_MISS,
+			cursor_cache_lookup(&cache, &a, true, &frame_a));
+	ASSERT_INT_EQ(CURSOR_CACHE_MISS,
+			cursor_cache_lookup(&cache, &b, true, &frame));
+	ASSERT_INT_EQ(CURSOR_CACHE_MISS,
+			cursor_cache_lookup(&cache, &c, true, &frame));
+
+	ASSERT_INT_EQ(CURSOR_CACHE_HIT,
+			cursor_cache_lookup(&cache, &a, true, &frame));
+	ASSERT_PTR_EQ(frame_a, frame);
+	ASSERT_INT_EQ(CURSOR_CACHE_HIT,
+			cursor_cache_lookup(&cache, &b, true, &frame));
+
+	ASSERT_UINT_EQ(2, cache.stats.n_hits);
+	ASSERT_UINT_EQ(3, cache.stats.n_misses);
+
+	cursor_cache_deinit(&cache);
+	return 0;
+}
+
+static int test_hotspot_is_part_of_key(void)
+{
+	struct cursor_cache cache;
+	cursor_cache_init(&cache);
+
+	struct cursor_image a = make_image(arrow, 0, 0);
+	struct cursor_image b = make_image(arrow, 1, 0);
+	struct nvnc_frame* frame = NULL;
+
+	ASSERT_INT_EQ(CURSOR_CACHE_MISS,
+			cursor_cache_lookup(&cache, &a, true, &frame));
+	ASSERT_INT_EQ(CURSOR_CACHE_MISS,
+			cursor_cache_lookup(&cache, &b, false, &frame));
+
+	cursor_cache_deinit(&cache);
+	return 0;
+}
+
+static int test_reset(void)
+{
+	struct cursor_cache cache;
+	cursor_cache_init(&cache);
+
+	struct cursor_image image = make_image(arrow, 0, 0);
+	struct nvnc_frame* frame = NULL;
+
+	ASSERT_INT_EQ(CURSOR_CACHE_MISS,
+			cursor_cache_lookup(&cache, &image, true, &frame));
+	cursor_cache_reset(&cache);
+	ASSERT_INT_EQ(CURSOR_CACHE_HIT,
+			cursor_cache_lookup(&cache, &image, false, &frame));
+
+	cursor_cache_deinit(&cache);
+	return 0;
+}
+
+static int test_least_recently_used_is_evicted(void)
+{
+	struct cursor_cache cache;
+	cursor_cache_init(&cache);
+
+	static uint32_t images[CURSOR_CACHE_SIZE + 1][SIZE * SIZE];
+	struct nvnc_frame* frame = NULL;
+
+	for (int i = 0; i < CURSOR_CACHE_SIZE + 1; ++i) {
+		images[i][0] = i;
+		struct cursor_image image = make_image(images[i], 0, 0);
+		ASSERT_INT_EQ(CURSOR_CACHE_MISS,
+				cursor_cache_lookup(&cache, &image, true,
+					&frame));
+	}
+
+	// The first one was evicted to make room for the last one
+	struct cursor_image first = make_image(images[0], 0, 0);
+	ASSERT_INT_EQ(CURSOR_CACHE_MISS,
+			cursor_cache_lookup(&cache, &first, true, &frame));
+
+	struct cursor_image last = make_image(images[CURSOR_CACHE_SIZE], 0, 0);
+	ASSERT_INT_EQ(CURSOR_CACHE_HIT,
+			cursor_cache_lookup(&cache, &last, true, &frame));
+
+	cursor_cache_deinit(&cache);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	init_images();
+	RUN_TEST(test_unchanged_is_suppressed);
+	RUN_TEST(test_recent_shapes_are_hits);
+	RUN_TEST(test_hotspot_is_part_of_key);
+	RUN_TEST(test_reset);
+	RUN_TEST(test_least_recently_used_is_evicted);
+	return r;
+}
@@ -0,0 +1,84 @@
+#include "tst.h"
+#include "damage-ring.h"
+
+#include <pixman.h>
+
+static int test_collect_up_to_date(void)
+{
+	struct damage_ring ring;
+	damage_ring_init(&ring);
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 0, 0, 10, 10);
+	uint64_t seq = damage_ring_push(&ring, &damage);
+
+	struct pixman_region16 result;
+	pixman_region_init(&result);
+	ASSERT_TRUE(damage_ring_collect(&ring, seq, &result));
+	ASSERT_FALSE(pixman_region_not_empty(&result));
+
+	pixman_region_fini(&result);
+	pixman_region_fini(&damage);
+	damage_ring_deinit(&ring);
+	return 0;
+}
+
+static int test_collect_union(void)
+{
+	struct damage_ring ring;
+	damage_ring_init(&ring);
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 0, 0, 10, 10);
+	damage_ring_push(&ring, &damage);
+	pixman_region_reset(&damage, &(pixman_box16_t){ 20, 20, 30, 30 });
+	damage_ring_push(&ring, &damage);
+
+	struct pixman_region16 result;
+	pixman_region_init(&result);
+	ASSERT_TRUE(damage_ring_collect(&ring, 0, &result));
+	ASSERT_INT_EQ(2, pixman_region_n_rects(&result));
+
+	pixman_region_clear(&result);
+	ASSERT_TRUE(damage_ring_collect(&ring, 1, &result));
+	ASSERT_INT_EQ(1, pixman_region_n_rects(&result));
+	ASSERT_INT_EQ(20, pixman_region_extents(&result)->x1);
+
+	pixman_region_fini(&result);
+	pixman_region_fini(&damage);
+	damage_ring_deinit(&ring);
+	return 0;
+}
+
+static int test_overflow(void)
+{
+	struct damage_ring ring;
+	damage_ring_init(&ring);
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 0, 0, 10, 10);
+	for (int i = 0; i < DAMAGE_RING_SIZE; ++i)
+		damage_ring_push(&ring, &damage);
+
+	struct pixman_region16 result;
+	pixman_region_init(&result);
+	ASSERT_TRUE(damage_ring_collect(&ring, 0, &result));
+
+	damage_ring_push(&ring, &damage);
+	ASSERT_FALSE(damage_ring_collect(&ring, 0, &result));
+	ASSERT_TRUE(damage_ring_collect(&ring, 1, &result));
+
+	pixman_region_fini(&result);
+	pixman_region_fini(&damage);
+	damage_ring_deinit(&ring);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_collect_up_to_date);
+	RUN_TEST(test_collect_union);
+	RUN_TEST(test_overflow);
+	return r;
+}
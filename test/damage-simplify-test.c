@@ -0,0 +1,110 @@
+#include "tst.h"
+#include "damage-simplify.h"
+
+#include <pixman.h>
+
+static int test_snap_to_tiles(void)
+{
+	struct damage_simplify_config config = { .tile_size = 64 };
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 70, 10, 10, 10);
+
+	damage_simplify(&damage, &damage, &config, 1000, 1000);
+
+	ASSERT_INT_EQ(1, pixman_region_n_rects(&damage));
+	pixman_box16_t* box = pixman_region_extents(&damage);
+	ASSERT_INT_EQ(64, box->x1);
+	ASSERT_INT_EQ(0, box->y1);
+	ASSERT_INT_EQ(128, box->x2);
+	ASSERT_INT_EQ(64, box->y2);
+
+	pixman_region_fini(&damage);
+	return 0;
+}
+
+static int test_snap_clips_to_size(void)
+{
+	struct damage_simplify_config config = { .tile_size = 64 };
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 90, 90, 10, 10);
+
+	damage_simplify(&damage, &damage, &config, 100, 100);
+
+	pixman_box16_t* box = pixman_region_extents(&damage);
+	ASSERT_INT_EQ(100, box->x2);
+	ASSERT_INT_EQ(100, box->y2);
+
+	pixman_region_fini(&damage);
+	return 0;
+}
+
+static int test_merge_close_rects(void)
+{
+	struct damage_simplify_config config = { .max_overhead = 50 };
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 0, 0, 10, 10);
+	pixman_region_union_rect(&damage, &damage, 11, 0, 10, 10);
+
+	damage_simplify(&damage, &damage, &config, 1000, 1000);
+
+	ASSERT_INT_EQ(1, pixman_region_n_rects(&damage));
+	ASSERT_INT_EQ(21, pixman_region_extents(&damage)->x2);
+
+	pixman_region_fini(&damage);
+	return 0;
+}
+
+static int test_keep_distant_rects(void)
+{
+	struct damage_simplify_config config = { .max_overhead = 50 };
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 0, 0, 10, 10);
+	pixman_region_union_rect(&damage, &damage, 500, 500, 10, 10);
+
+	damage_simplify(&damage, &damage, &config, 1000, 1000);
+
+	ASSERT_INT_EQ(2, pixman_region_n_rects(&damage));
+
+	pixman_region_fini(&damage);
+	return 0;
+}
+
+static int test_cap_rect_count(void)
+{
+	struct damage_simplify_config config = { .max_rects = 4 };
+
+	struct pixman_region16 damage;
+	pixman_region_init(&damage);
+	for (int i = 0; i < 32; ++i)
+		pixman_region_union_rect(&damage, &damage, i * 30, i * 30, 10,
+				10);
+
+	damage_simplify(&damage, &damage, &config, 1000, 1000);
+
+	int n_rects = pixman_region_n_rects(&damage);
+	ASSERT_INT_LE(4, n_rects);
+
+	// Nothing may be lost
+	for (int i = 0; i < 32; ++i)
+		pixman_region_union_rect(&damage, &damage, i * 30, i * 30, 10,
+				10);
+	ASSERT_INT_EQ(n_rects, pixman_region_n_rects(&damage));
+
+	pixman_region_fini(&damage);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_snap_to_tiles);
+	RUN_TEST(test_snap_clips_to_size);
+	RUN_TEST(test_merge_close_rects);
+	RUN_TEST(test_keep_distant_rects);
+	RUN_TEST(test_cap_rect_count);
+	return r;
+}
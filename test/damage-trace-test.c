@@ -0,0 +1,188 @@
+#include "tst.h"
+#include "damage-trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pixman.h>
+
+static int make_path(char* path)
+{
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return -1;
+	close(fd);
+	return 0;
+}
+
+static int test_round_trip(void)
+{
+	char path[] = "/tmp/damage-trace-test-XXXXXX";
+	ASSERT_INT_EQ(0, make_path(path));
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 0, 0, 10, 10);
+	pixman_region_union_rect(&damage, &damage, 100, 200, 30, 40);
+
+	struct damage_trace_frame frame = {
+		.capture_time = 1000,
+		.present_time = 0x123456789,
+		.done_time = 0x12345678a,
+		.width = 1920,
+		.height = 1080,
+		.format = 0x34325258,
+		.source = 42,
+		.damage = &damage,
+	};
+
+	struct damage_trace* trace = damage_trace_create(path);
+	ASSERT_TRUE(trace);
+	ASSERT_INT_EQ(0, damage_trace_write(trace, &frame));
+	pixman_region_clear(&damage);
+	ASSERT_INT_EQ(0, damage_trace_write(trace, &frame));
+	ASSERT_INT_EQ(0, damage_trace_close(trace));
+
+	struct pixman_region16 result_damage;
+	pixman_region_init(&result_damage);
+	struct damage_trace_frame result = { .damage = &result_damage };
+
+	trace = damage_trace_open(path);
+	ASSERT_TRUE(trace);
+
+	ASSERT_INT_EQ(1, damage_trace_read(trace, &result));
+	ASSERT_UINT_EQ(1000, result.capture_time);
+	ASSERT_TRUE(result.present_time == 0x123456789);
+	ASSERT_TRUE(result.done_time == 0x12345678a);
+	ASSERT_INT_EQ(1920, result.width);
+	ASSERT_INT_EQ(1080, result.height);
+	ASSERT_UINT_EQ(0x34325258, result.format);
+	ASSERT_UINT_EQ(42, result.source);
+	ASSERT_INT_EQ(2, pixman_region_n_rects(&result_damage));
+	ASSERT_TRUE(pixman_region_contains_point(&result_damage, 129, 239,
+				NULL));
+	ASSERT_FALSE(pixman_region_contains_point(&result_damage, 130, 240,
+				NULL));
+
+	ASSERT_INT_EQ(1, damage_trace_read(trace, &result));
+	ASSERT_FALSE(pixman_region_not_empty(&result_damage));
+
+	ASSERT_INT_EQ(0, damage_trace_read(trace, &result));
+
+	ASSERT_INT_EQ(0, damage_trace_rewind(trace));
+	ASSERT_INT_EQ(1, damage_trace_read(trace, &result));
+	ASSERT_INT_EQ(2, pixman_region_n_rects(&result_damage));
+
+	damage_trace_close(trace);
+	pixman_region_fini(&result_damage);
+	pixman_region_fini(&damage);
+	unlink(path);
+	return 0;
+}
+
+static int test_bad_magic(void)
+{
+	char path[] = "/tmp/damage-trace-test-XXXXXX";
+	ASSERT_INT_EQ(0, make_path(path));
+
+	FILE* file = fopen(path, "wb");
+	ASSERT_TRUE(file);
+	fputs("not a trace", file);
+	fclose(file);
+
+	ASSERT_FALSE(damage_trace_open(path));
+
+	unlink(path);
+	return 0;
+}
+
+static int test_truncated(void)
+{
+	char path[] = "/tmp/damage-trace-test-XXXXXX";
+	ASSERT_INT_EQ(0, make_path(path));
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 0, 0, 10, 10);
+	struct damage_trace_frame frame = {
+		.width = 100,
+		.height = 100,
+		.damage = &damage,
+	};
+
+	struct damage_trace* trace = damage_trace_create(path);
+	ASSERT_TRUE(trace);
+	ASSERT_INT_EQ(0, damage_trace_write(trace, &frame));
+	ASSERT_INT_EQ(0, damage_trace_close(trace));
+
+	// Cut the last rectangle short
+	ASSERT_INT_EQ(0, truncate(path, 8 + 38 + 4));
+
+	trace = damage_trace_open(path);
+	ASSERT_TRUE(trace);
+	ASSERT_INT_EQ(-1, damage_trace_read(trace, &frame));
+	damage_trace_close(trace);
+
+	pixman_region_fini(&damage);
+	unlink(path);
+	return 0;
+}
+
+static int test_too_many_rects(void)
+{
+	char path[] = "/tmp/damage-trace-test-XXXXXX";
+	ASSERT_INT_EQ(0, make_path(path));
+
+	// A checkerboard of 1x1 rectangles, one more than can be recorded
+	int n_boxes = UINT16_MAX + 1;
+	pixman_box16_t* boxes = calloc(n_boxes, sizeof(*boxes));
+	ASSERT_TRUE(boxes);
+	for (int i = 0; i < n_boxes; ++i) {
+		int x = (i % 256) * 2;
+		int y = (i / 256) * 2;
+		boxes[i] = (pixman_box16_t){ x, y, x + 1, y + 1 };
+	}
+
+	struct pixman_region16 damage;
+	pixman_region_init_rects(&damage, boxes, n_boxes);
+	free(boxes);
+	ASSERT_INT_EQ(n_boxes, pixman_region_n_rects(&damage));
+
+	struct damage_trace_frame frame = {
+		.width = 512,
+		.height = 512,
+		.damage = &damage,
+	};
+
+	struct damage_trace* trace = damage_trace_create(path);
+	ASSERT_TRUE(trace);
+	ASSERT_INT_EQ(0, damage_trace_write(trace, &frame));
+	ASSERT_INT_EQ(0, damage_trace_close(trace));
+
+	struct pixman_region16 result_damage;
+	pixman_region_init(&result_damage);
+	struct damage_trace_frame result = { .damage = &result_damage };
+
+	trace = damage_trace_open(path);
+	ASSERT_TRUE(trace);
+	ASSERT_INT_EQ(1, damage_trace_read(trace, &result));
+	ASSERT_INT_EQ(1, pixman_region_n_rects(&result_damage));
+	ASSERT_TRUE(pixman_region_contains_point(&result_damage, 510, 510,
+				NULL));
+	ASSERT_FALSE(pixman_region_contains_point(&result_damage, 511, 511,
+				NULL));
+	damage_trace_close(trace);
+
+	pixman_region_fini(&result_damage);
+	pixman_region_fini(&damage);
+	unlink(path);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_round_trip);
+	RUN_TEST(test_bad_magic);
+	RUN_TEST(test_truncated);
+	RUN_TEST(test_too_many_rects);
+	return r;
+}
@@ -0,0 +1,91 @@
+#include "tst.h"
+#include "histogram.h"
+
+static int test_empty(void)
+{
+	struct histogram hist;
+	histogram_reset(&hist);
+
+	ASSERT_UINT32_EQ(0, histogram_mean(&hist));
+	ASSERT_UINT32_EQ(0, histogram_percentile(&hist, 50));
+	return 0;
+}
+
+static int test_small_values_are_exact(void)
+{
+	struct histogram hist;
+	histogram_reset(&hist);
+
+	for (int i = 1; i <= 10; ++i)
+		histogram_record(&hist, i);
+
+	ASSERT_UINT32_EQ(1, hist.min);
+	ASSERT_UINT32_EQ(10, hist.max);
+	ASSERT_UINT32_EQ(5, histogram_mean(&hist));
+	ASSERT_UINT32_EQ(5, histogram_percentile(&hist, 50));
+	ASSERT_UINT32_EQ(9, histogram_percentile(&hist, 90));
+	ASSERT_UINT32_EQ(10, histogram_percentile(&hist, 100));
+	return 0;
+}
+
+static int test_relative_error(void)
+{
+	struct histogram hist;
+	histogram_reset(&hist);
+
+	for (uint32_t i = 1; i <= 100000; ++i)
+		histogram_record(&hist, i);
+
+	uint32_t p50 = histogram_percentile(&hist, 50);
+	ASSERT_UINT32_GE(50000, p50);
+	ASSERT_TRUE(p50 <= 50000 + 50000 / 16);
+
+	uint32_t p99 = histogram_percentile(&hist, 99);
+	ASSERT_UINT32_GE(99000, p99);
+	ASSERT_TRUE(p99 <= 99000 + 99000 / 16);
+
+	ASSERT_UINT32_EQ(100000, histogram_percentile(&hist, 100));
+	return 0;
+}
+
+static int test_clamp(void)
+{
+	struct histogram hist;
+	histogram_reset(&hist);
+
+	histogram_record(&hist, UINT64_C(1) << 40);
+	ASSERT_UINT32_EQ(UINT32_MAX, hist.max);
+	ASSERT_UINT32_EQ(UINT32_MAX, histogram_percentile(&hist, 50));
+	return 0;
+}
+
+static int test_count_le(void)
+{
+	struct histogram hist;
+	histogram_reset(&hist);
+
+	for (uint32_t i = 1; i <= 1000; ++i)
+		histogram_record(&hist, i);
+
+	ASSERT_TRUE(histogram_count_le(&hist, 0) == 0);
+	ASSERT_TRUE(histogram_count_le(&hist, 10) == 10);
+
+	uint64_t n = histogram_count_le(&hist, 500);
+	ASSERT_TRUE(n <= 500);
+	ASSERT_TRUE(n >= 500 - 500 / 16);
+
+	ASSERT_TRUE(histogram_count_le(&hist, 1000) <= 1000);
+	ASSERT_TRUE(histogram_count_le(&hist, UINT32_MAX) == 1000);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_empty);
+	RUN_TEST(test_small_values_are_exact);
+	RUN_TEST(test_relative_error);
+	RUN_TEST(test_clamp);
+	RUN_TEST(test_count_le);
+	return r;
+}
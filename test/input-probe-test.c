@@ -0,0 +1,160 @@
+#include "tst.h"
+#include "input-probe.h"
+
+#include <pixman.h>
+
+struct matches {
+	int n;
+	uint64_t latency;
+	enum input_probe_kind kind;
+};
+
+static void on_match(const struct input_probe_event* event, uint64_t latency,
+		void* userdata)
+{
+	struct matches* matches = userdata;
+	matches->n++;
+	matches->latency = latency;
+	matches->kind = event->kind;
+}
+
+static int test_key_matches_any_damage(void)
+{
+	struct input_probe probe;
+	input_probe_init(&probe);
+	input_probe_mark(&probe, INPUT_PROBE_KEY, 0, 0, 1000);
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 500, 500, 10, 10);
+
+	struct matches matches = { 0 };
+	input_probe_match(&probe, &damage, 1000, 1000, 2000, 5000, NULL,
+			on_match, &matches);
+	ASSERT_INT_EQ(1, matches.n);
+	ASSERT_UINT_EQ(4000, matches.latency);
+	ASSERT_INT_EQ(INPUT_PROBE_KEY, matches.kind);
+	ASSERT_INT_EQ(0, probe.n_events);
+	ASSERT_UINT_EQ(1, probe.stats.n_matched);
+
+	pixman_region_fini(&damage);
+	return 0;
+}
+
+static int test_pointer_needs_damage_at_location(void)
+{
+	struct input_probe probe;
+	input_probe_init(&probe);
+	input_probe_mark(&probe, INPUT_PROBE_POINTER, 0.5, 0.5, 1000);
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 0, 0, 10, 10);
+
+	struct matches matches = { 0 };
+	input_probe_match(&probe, &damage, 1000, 1000, 2000, 5000, NULL,
+			on_match, &matches);
+	ASSERT_INT_EQ(0, matches.n);
+	ASSERT_INT_EQ(1, probe.n_events);
+
+	pixman_region_union_rect(&damage, &damage, 505, 505, 10, 10);
+	input_probe_match(&probe, &damage, 1000, 1000, 6000, 8000, NULL,
+			on_match, &matches);
+	ASSERT_INT_EQ(1, matches.n);
+	ASSERT_UINT_EQ(7000, matches.latency);
+	ASSERT_INT_EQ(0, probe.n_events);
+
+	pixman_region_fini(&damage);
+	return 0;
+}
+
+static int test_frame_captured_before_event(void)
+{
+	struct input_probe probe;
+	input_probe_init(&probe);
+	input_probe_mark(&probe, INPUT_PROBE_KEY, 0, 0, 3000);
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 0, 0, 10, 10);
+
+	struct matches matches = { 0 };
+	input_probe_match(&probe, &damage, 100, 100, 2000, 4000, NULL,
+			on_match, &matches);
+	ASSERT_INT_EQ(0, matches.n);
+	ASSERT_INT_EQ(1, probe.n_events);
+
+	input_probe_match(&probe, &damage, 100, 100, 4000, 5000, NULL,
+			on_match, &matches);
+	ASSERT_INT_EQ(1, matches.n);
+	ASSERT_UINT_EQ(2000, matches.latency);
+
+	pixman_region_fini(&damage);
+	return 0;
+}
+
+// The frame covers the right half of the framebuffer
+static bool map_right_half(double* x, double* y, void* userdata)
+{
+	if (*x < 0.5)
+		return false;
+	*x = (*x - 0.5) * 2.0;
+	return true;
+}
+
+static int test_pointer_mapped_onto_frame(void)
+{
+	struct input_probe probe;
+	input_probe_init(&probe);
+	input_probe_mark(&probe, INPUT_PROBE_POINTER, 0.25, 0.5, 1000);
+	input_probe_mark(&probe, INPUT_PROBE_POINTER, 0.75, 0.5, 1000);
+
+	// Damage at the same place in both halves
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 495, 495, 10, 10);
+
+	struct matches matches = { 0 };
+	input_probe_match(&probe, &damage, 1000, 1000, 2000, 5000,
+			map_right_half, on_match, &matches);
+	ASSERT_INT_EQ(1, matches.n);
+	ASSERT_INT_EQ(1, probe.n_events);
+	ASSERT_TRUE(probe.events[0].x < 0.5);
+
+	pixman_region_fini(&damage);
+	return 0;
+}
+
+static int test_expire(void)
+{
+	struct input_probe probe;
+	input_probe_init(&probe);
+	input_probe_mark(&probe, INPUT_PROBE_POINTER, 0.5, 0.5, 1000);
+	input_probe_mark(&probe, INPUT_PROBE_KEY, 0, 0,
+			1000 + INPUT_PROBE_TIMEOUT_US + 1);
+
+	ASSERT_INT_EQ(1, probe.n_events);
+	ASSERT_UINT_EQ(1, probe.stats.n_expired);
+	return 0;
+}
+
+static int test_drop_oldest(void)
+{
+	struct input_probe probe;
+	input_probe_init(&probe);
+	for (int i = 0; i < INPUT_PROBE_SIZE + 2; ++i)
+		input_probe_mark(&probe, INPUT_PROBE_KEY, 0, 0, i + 1);
+
+	ASSERT_INT_EQ(INPUT_PROBE_SIZE, probe.n_events);
+	ASSERT_UINT_EQ(2, probe.stats.n_dropped);
+	ASSERT_UINT_EQ(3, probe.events[0].time);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_key_matches_any_damage);
+	RUN_TEST(test_pointer_needs_damage_at_location);
+	RUN_TEST(test_frame_captured_before_event);
+	RUN_TEST(test_pointer_mapped_onto_frame);
+	RUN_TEST(test_expire);
+	RUN_TEST(test_drop_oldest);
+	return r;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "tst.h"
+#include "keyset.h"
+
+static int test_set_and_clear(void)
+{
+	struct keyset set;
+	keyset_init(&set);
+
+	ASSERT_TRUE(keyset_is_empty(&set));
+	ASSERT_FALSE(keyset_is_set(&set, 38));
+
+	ASSERT_TRUE(keyset_set(&set, 38));
+	ASSERT_TRUE(keyset_is_set(&set, 38));
+	ASSERT_FALSE(keyset_is_set(&set, 37));
+	ASSERT_FALSE(keyset_is_empty(&set));
+
+	keyset_clear(&set, 38);
+	ASSERT_FALSE(keyset_is_set(&set, 38));
+	ASSERT_TRUE(keyset_is_empty(&set));
+	return 0;
+}
+
+static int test_out_of_range(void)
+{
+	struct keyset set;
+	keyset_init(&set);
+
+	ASSERT_TRUE(keyset_set(&set, KEYSET_MAX_CODE - 1));
+	ASSERT_FALSE(keyset_set(&set, KEYSET_MAX_CODE));
+	ASSERT_FALSE(keyset_is_set(&set, KEYSET_MAX_CODE));
+	keyset_clear(&set, KEYSET_MAX_CODE);
+	ASSERT_INT_EQ(1, keyset_count(&set));
+	return 0;
+}
+
+static int test_count(void)
+{
+	struct keyset set;
+	keyset_init(&set);
+
+	keyset_set(&set, 0);
+	keyset_set(&set, 63);
+	keyset_set(&set, 64);
+	keyset_set(&set, 700);
+	keyset_set(&set, 700);
+	ASSERT_INT_EQ(4, keyset_count(&set));
+	return 0;
+}
+
+static int test_iterate(void)
+{
+	struct keyset set;
+	keyset_init(&set);
+
+	ASSERT_INT_EQ(-1, keyset_next(&set, 0));
+
+	keyset_set(&set, 9);
+	keyset_set(&set, 64);
+	keyset_set(&set, 775);
+
+	ASSERT_INT_EQ(9, keyset_next(&set, 0));
+	ASSERT_INT_EQ(9, keyset_next(&set, 9));
+	ASSERT_INT_EQ(64, keyset_next(&set, 10));
+	ASSERT_INT_EQ(775, keyset_next(&set, 65));
+	ASSERT_INT_EQ(-1, keyset_next(&set, 776));
+	ASSERT_INT_EQ(-1, keyset_next(&set, KEYSET_MAX_CODE));
+
+	int sum = 0, n = 0;
+	keyset_for_each(&set, code) {
+		sum += code;
+		n++;
+	}
+	ASSERT_INT_EQ(3, n);
+	ASSERT_INT_EQ(9 + 64 + 775, sum);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_set_and_clear);
+	RUN_TEST(test_out_of_range);
+	RUN_TEST(test_count);
+	RUN_TEST(test_iterate);
+	return r;
+}
@@ -0,0 +1,95 @@
+#include "tst.h"
+#include "metrics.h"
+#include "histogram.h"
+
+#include <string.h>
+
+static int test_samples(void)
+{
+	struct metrics_writer writer;
+	metrics_writer_init(&writer);
+
+	metrics_write_family(&writer, "wayvnc_frames_total", "counter",
+			"Frames captured");
+	metrics_write_uint(&writer, "wayvnc_frames_total", NULL, 42);
+	metrics_write_double(&writer, "wayvnc_ratio", "pool=\"0\"", 0.5);
+
+	ASSERT_FALSE(writer.error);
+	ASSERT_TRUE(strcmp(writer.data,
+			"# HELP wayvnc_frames_total Frames captured\n"
+			"# TYPE wayvnc_frames_total counter\n"
+			"wayvnc_frames_total 42\n"
+			"wayvnc_ratio{pool=\"0\"} 0.5\n") == 0);
+
+	metrics_writer_destroy(&writer);
+	return 0;
+}
+
+static int test_histogram(void)
+{
+	struct histogram hist;
+	histogram_reset(&hist);
+	histogram_record(&hist, 50);
+	histogram_record(&hist, 2000000);
+
+	struct metrics_writer writer;
+	metrics_writer_init(&writer);
+	metrics_write_histogram(&writer, "lat", "stage=\"capture\"", &hist);
+
+	ASSERT_FALSE(writer.error);
+	ASSERT_TRUE(strstr(writer.data,
+			"lat_bucket{stage=\"capture\",le=\"0.0001\"} 1\n"));
+	ASSERT_TRUE(strstr(writer.data,
+			"lat_bucket{stage=\"capture\",le=\"1\"} 1\n"));
+	ASSERT_TRUE(strstr(writer.data,
+			"lat_bucket{stage=\"capture\",le=\"+Inf\"} 2\n"));
+	ASSERT_TRUE(strstr(writer.data,
+			"lat_sum{stage=\"capture\"} 2.000050\n"));
+	ASSERT_TRUE(strstr(writer.data, "lat_count{stage=\"capture\"} 2\n"));
+
+	metrics_writer_destroy(&writer);
+	return 0;
+}
+
+static int test_histogram_without_labels(void)
+{
+	struct histogram hist;
+	histogram_reset(&hist);
+
+	struct metrics_writer writer;
+	metrics_writer_init(&writer);
+	metrics_write_histogram(&writer, "lat", NULL, &hist);
+
+	ASSERT_TRUE(strstr(writer.data, "lat_bucket{le=\"+Inf\"} 0\n"));
+	ASSERT_TRUE(strstr(writer.data, "lat_count 0\n"));
+
+	metrics_writer_destroy(&writer);
+	return 0;
+}
+
+static int test_growth(void)
+{
+	struct metrics_writer writer;
+	metrics_writer_init(&writer);
+
+	for (int i = 0; i < 1000; ++i)
+		metrics_write_uint(&writer, "wayvnc_some_long_metric_name",
+				"label=\"value\"", i);
+
+	ASSERT_FALSE(writer.error);
+	ASSERT_TRUE(strstr(writer.data, "} 999\n"));
+	ASSERT_TRUE(writer.len == strlen(writer.data));
+
+	metrics_writer_destroy(&writer);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_samples);
+	RUN_TEST(test_histogram);
+	RUN_TEST(test_histogram_without_labels);
+	RUN_TEST(test_growth);
+	return r;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2025 Andri Yngvason
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "tst.h"
+#include "tile-hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pixman.h>
+
+#define WIDTH 200
+#define HEIGHT 150
+#define STRIDE (WIDTH * 4)
+
+static uint32_t* create_frame(void)
+{
+	uint32_t* pixels = malloc(STRIDE * HEIGHT);
+	for (int i = 0; i < WIDTH * HEIGHT; ++i)
+		pixels[i] = i * 2654435761u;
+	return pixels;
+}
+
+static int test_first_frame_keeps_damage(void)
+{
+	struct tile_hash hash;
+	ASSERT_INT_EQ(0, tile_hash_init(&hash, WIDTH, HEIGHT));
+	ASSERT_INT_EQ(4, hash.n_cols);
+	ASSERT_INT_EQ(3, hash.n_rows);
+
+	uint32_t* pixels = create_frame();
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 0, 0, WIDTH, HEIGHT);
+	tile_hash_apply(&hash, pixels, STRIDE, 4, &damage);
+
+	ASSERT_TRUE(hash.is_valid);
+	ASSERT_INT_EQ(WIDTH, pixman_region_extents(&damage)->x2);
+	ASSERT_INT_EQ(HEIGHT, pixman_region_extents(&damage)->y2);
+
+	pixman_region_fini(&damage);
+	free(pixels);
+	tile_hash_deinit(&hash);
+	return 0;
+}
+
+static int test_unchanged_frame_has_no_damage(void)
+{
+	struct tile_hash hash;
+	ASSERT_INT_EQ(0, tile_hash_init(&hash, WIDTH, HEIGHT));
+
+	uint32_t* pixels = create_frame();
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 0, 0, WIDTH, HEIGHT);
+	tile_hash_apply(&hash, pixels, STRIDE, 4, &damage);
+	pixman_region_fini(&damage);
+
+	pixman_region_init_rect(&damage, 0, 0, WIDTH, HEIGHT);
+	tile_hash_apply(&hash, pixels, STRIDE, 4, &damage);
+	ASSERT_FALSE(pixman_region_not_empty(&damage));
+
+	pixman_region_fini(&damage);
+	free(pixels);
+	tile_hash_deinit(&hash);
+	return 0;
+}
+
+static int test_changed_pixel_damages_tile(void)
+{
+	struct tile_hash hash;
+	ASSERT_INT_EQ(0, tile_hash_init(&hash, WIDTH, HEIGHT));
+
+	uint32_t* pixels = create_frame();
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 0, 0, WIDTH, HEIGHT);
+	tile_hash_apply(&hash, pixels, STRIDE, 4, &damage);
+	pixman_region_fini(&damage);
+
+	// Bottom right tile, which is only partially covered by the frame
+	pixels[(HEIGHT - 1) * WIDTH + WIDTH - 1] ^= 1;
+
+	pixman_region_init_rect(&damage, 0, 0, WIDTH, HEIGHT);
+	tile_hash_apply(&hash, pixels, STRIDE, 4, &damage);
+
+	ASSERT_INT_EQ(1, pixman_region_n_rects(&damage));
+	pixman_box16_t* box = pixman_region_extents(&damage);
+	ASSERT_INT_EQ(192, box->x1);
+	ASSERT_INT_EQ(128, box->y1);
+	ASSERT_INT_EQ(WIDTH, box->x2);
+	ASSERT_INT_EQ(HEIGHT, box->y2);
+
+	pixman_region_fini(&damage);
+	free(pixels);
+	tile_hash_deinit(&hash);
+	return 0;
+}
+
+static int test_undamaged_tiles_are_not_checked(void)
+{
+	struct tile_hash hash;
+	ASSERT_INT_EQ(0, tile_hash_init(&hash, WIDTH, HEIGHT));
+
+	uint32_t* pixels = create_frame();
+
+	struct pixman_region16 damage;
+	pixman_region_init_rect(&damage, 0, 0, WIDTH, HEIGHT);
+	tile_hash_apply(&hash, pixels, STRIDE, 4, &damage);
+	pixman_region_fini(&damage);
+
+	/* The first tile changes, but is not reported as damaged. The second
+	 * tile changes and the third tile is reported as damaged without any
+	 * change.
+	 */
+	pixels[0] ^= 1;
+	pixels[70] ^= 1;
+
+	pixman_region_init_rect(&damage, 64, 0, 100, 20);
+	tile_hash_apply(&hash, pixels, STRIDE, 4, &damage);
+
+	ASSERT_INT_EQ(1, pixman_region_n_rects(&damage));
+	pixman_box16_t* box = pixman_region_extents(&damage);
+	ASSERT_INT_EQ(64, box->x1);
+	ASSERT_INT_EQ(0, box->y1);
+	ASSERT_INT_EQ(128, box->x2);
+	ASSERT_INT_EQ(20, box->y2);
+
+	pixman_region_fini(&damage);
+	free(pixels);
+	tile_hash_deinit(&hash);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_first_frame_keeps_damage);
+	RUN_TEST(test_unchanged_frame_has_no_damage);
+	RUN_TEST(test_changed_pixel_damages_tile);
+	RUN_TEST(test_undamaged_tiles_are_not_checked);
+	return r;
+}
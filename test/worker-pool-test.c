@@ -0,0 +1,122 @@
+#include "tst.h"
+#include "worker-pool.h"
+
+#include <aml.h>
+#include <stdatomic.h>
+
+#define N_STRIPES 100
+
+struct job {
+	atomic_int n_calls;
+	atomic_int stripe_calls[N_STRIPES];
+	int n_done_calls;
+	int n_stripes_done;
+};
+
+static void on_stripe(void* userdata, int stripe)
+{
+	struct job* job = userdata;
+	atomic_fetch_add(&job->n_calls, 1);
+	atomic_fetch_add(&job->stripe_calls[stripe], 1);
+}
+
+static void on_done(void* userdata, const uint64_t* stripe_times,
+		int n_stripes)
+{
+	struct job* job = userdata;
+	job->n_done_calls++;
+	job->n_stripes_done = n_stripes;
+}
+
+static void dispatch_until_idle(struct aml* aml, struct worker_pool* pool)
+{
+	while (worker_pool_is_busy(pool)) {
+		aml_poll(aml, 1000);
+		aml_dispatch(aml);
+	}
+}
+
+static int test_run_all_stripes(void)
+{
+	struct aml* aml = aml_new();
+	aml_set_default(aml);
+
+	struct worker_pool* pool = worker_pool_create(3, NULL, 0);
+	ASSERT_TRUE(pool);
+	ASSERT_INT_EQ(3, worker_pool_get_n_threads(pool));
+
+	for (int n = 0; n < 3; ++n) {
+		struct job job = { 0 };
+		ASSERT_INT_EQ(0, worker_pool_run(pool, N_STRIPES, on_stripe,
+					on_done, &job));
+		ASSERT_TRUE(worker_pool_is_busy(pool));
+		dispatch_until_idle(aml, pool);
+
+		ASSERT_INT_EQ(N_STRIPES, job.n_calls);
+		for (int i = 0; i < N_STRIPES; ++i)
+			ASSERT_INT_EQ(1, job.stripe_calls[i]);
+		ASSERT_INT_EQ(1, job.n_done_calls);
+		ASSERT_INT_EQ(N_STRIPES, job.n_stripes_done);
+	}
+
+	worker_pool_destroy(pool);
+	aml_unref(aml);
+	return 0;
+}
+
+static int test_one_job_at_a_time(void)
+{
+	struct aml* aml = aml_new();
+	aml_set_default(aml);
+
+	struct worker_pool* pool = worker_pool_create(2, NULL, 0);
+	ASSERT_TRUE(pool);
+
+	struct job job = { 0 };
+	struct job other = { 0 };
+	ASSERT_INT_EQ(0, worker_pool_run(pool, N_STRIPES, on_stripe, on_done,
+				&job));
+	ASSERT_INT_EQ(-1, worker_pool_run(pool, N_STRIPES, on_stripe, on_done,
+				&other));
+	dispatch_until_idle(aml, pool);
+
+	ASSERT_INT_EQ(N_STRIPES, job.n_calls);
+	ASSERT_INT_EQ(0, other.n_calls);
+
+	worker_pool_destroy(pool);
+	aml_unref(aml);
+	return 0;
+}
+
+static int test_wait(void)
+{
+	struct aml* aml = aml_new();
+	aml_set_default(aml);
+
+	struct worker_pool* pool = worker_pool_create(2, NULL, 0);
+	ASSERT_TRUE(pool);
+
+	struct job job = { 0 };
+	ASSERT_INT_EQ(0, worker_pool_run(pool, N_STRIPES, on_stripe, on_done,
+				&job));
+	worker_pool_wait(pool);
+	ASSERT_INT_EQ(N_STRIPES, job.n_calls);
+	ASSERT_INT_EQ(0, job.n_done_calls);
+
+	// The done callback is still delivered through the main loop
+	dispatch_until_idle(aml, pool);
+	ASSERT_INT_EQ(1, job.n_done_calls);
+
+	worker_pool_destroy(pool);
+	aml_unref(aml);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_run_all_stripes);
+	RUN_TEST(test_one_job_at_a_time);
+	RUN_TEST(test_wait);
+	return r;
+}
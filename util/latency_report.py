@@ -1,9 +1,10 @@
 #!/usr/bin/python
 
 import os
+import re
 import math
 
-stream = os.popen('perf script -F time,event')
+stream = os.popen('perf script -F time,event,trace')
 
 is_in_update_fb = False
 
@@ -54,21 +55,79 @@ class StateTracker:
         print('\tMin, max: {:.1f} ms, {:.1f} ms'.format(self.dt_min * 1e3, self.dt_max * 1e3))
         print('\tAverage, std.dev.: {:.1f} ms, {:.1f} ms'.format(self.avg() * 1e3, self.stddev() * 1e3))
 
+class ValueTracker:
+    def __init__(self, name, src, event, arg, unit, scale):
+        self.name = name
+        self.src = src
+        self.event = event
+        self.arg = arg
+        self.unit = unit
+        self.scale = scale
+        self.values = []
+
+    def apply(self, src, event, args):
+        if (src, event) != (self.src, self.event):
+            return
+        if self.arg in args:
+            self.values.append(args[self.arg] * self.scale)
+
+    def percentile(self, p):
+        return self.values[min(len(self.values) - 1, int(len(self.values) * p))]
+
+    def report(self):
+        if not self.values:
+            return
+
+        self.values.sort()
+        avg = sum(self.values) / len(self.values)
+        print('{}:'.format(self.name))
+        print('\tMin, max: {:.1f} {u}, {:.1f} {u}'.format(self.values[0], self.values[-1], u=self.unit))
+        print('\tAverage, p50, p99: {:.1f} {u}, {:.1f} {u}, {:.1f} {u}'.format(avg,
+            self.percentile(0.5), self.percentile(0.99), u=self.unit))
+
+arg_re = re.compile(r'arg(\d+)=(\S+)')
+
+def parse_args(trace):
+    args = {}
+    for (i, value) in arg_re.findall(trace):
+        try:
+            args[int(i)] = int(value, 0)
+        except ValueError:
+            pass
+    return args
+
 trackers = [
     StateTracker('Framebuffer update', 'sdt_neatvnc', 'update_fb_start', 'update_fb_done'),
     StateTracker('Framebuffer update (only sending)', 'sdt_neatvnc', 'send_fb_start', 'send_fb_done'),
     StateTracker('Screencopy', 'sdt_wayvnc', 'screencopy_start', 'screencopy_ready'),
+    StateTracker('Cursor capture', 'sdt_wayvnc', 'cursor_capture_start', 'cursor_capture_ready'),
+    StateTracker('Change detection', 'sdt_wayvnc', 'change_detection_start', 'change_detection_done'),
+    StateTracker('Rate limiting', 'sdt_wayvnc', 'rate_limit_wait', 'rate_limit_done'),
+    StateTracker('Control command', 'sdt_wayvnc', 'ctl_command_start', 'ctl_command_done'),
     StateTracker('Refine damage', 'sdt_wayvnc', 'refine_damage_start', 'refine_damage_end'),
     StateTracker('Render', 'sdt_wayvnc', 'render_start', 'render_end'),
 ]
 
+value_trackers = [
+    ValueTracker('Input to frame', 'sdt_wayvnc', 'input_to_frame', 3, 'ms', 1e-3),
+    ValueTracker('Fed damage', 'sdt_wayvnc', 'frame_feed', 4, 'kpx', 1e-3),
+]
+
 for line in stream:
-    [t, src, event, _] = line.replace(' ', '').split(':')
+    fields = line.split(':', 3)
+    if len(fields) < 3:
+        continue
+
+    [t, src, event] = [f.strip() for f in fields[:3]]
     t = float(t)
+    args = parse_args(fields[3]) if len(fields) > 3 else {}
 
     for tracker in trackers:
         tracker.apply(src, event, t)
 
-for tracker in trackers:
+    for tracker in value_trackers:
+        tracker.apply(src, event, args)
+
+for tracker in trackers + value_trackers:
     tracker.report()
     print()